@@ -12,72 +12,1403 @@
 #ifndef DATALOGGER_H
 #define DATALOGGER_H
 
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Build with -DDLGR_COUNT_EVENTS (ie make CFLAGS=-DDLGR_COUNT_EVENTS) to count diagnostics instead of writing them to stderr, see dlgr_stats_dump().
 #ifndef eprintf
+#ifdef DLGR_COUNT_EVENTS
+// The arguments are still checked, but never evaluated.
+#define eprintf(str, ...)                                  \
+    (void) sizeof(fprintf(stderr, str, ##__VA_ARGS__)); \
+    dlgr_count_event(__func__, __LINE__);
+#else
 #define eprintf(str, ...)                                                    \
     fprintf(stderr, "%s, %d: " str "\n", __func__, __LINE__, ##__VA_ARGS__); \
     fflush(stderr);
 #endif
+#endif
+
+// Default segment size and retention, changed per variable at runtime with dlgr_set_storage() or settings.cfg.
+#define MAX_FILE_SIZE 0x100000 // 1MB
+#define MAX_LOG_SET_SIZE 0xC800000 // 200MB
 
 // File and directories cannot exceed these limits.
-// #define MAX_FILE_SIZE 0x100000 // 1MB
-#define MAX_FILE_SIZE 0x10 // FOR DEBUG PURPOSES ONLY.
 #define MAX_FNAME_SIZE 0x80
 #define MAX_VAR_SIZE 0x100000
-// #define MAX_LOG_SET_SIZE 0xC800000 // 200MB
-#define MAX_LOG_SET_SIZE 0x40 // FOR DEBUG PURPOSES ONLY.
 
-#define CALCULATE_NEXT_FILE_SIZE ({fseek(var_log_f, 0, SEEK_END); log_file_size = ftell(var_log_f); fseek(var_log_f, 0, SEEK_SET); fclose(var_log_f); log_file_size + var_size;})
+// Every DLGR_TIME_INDEX_STRIDE-th record of a timestamped segment gets an entry in its sparse time index.
+#define DLGR_TIME_INDEX_STRIDE 0x40
+
+// In-process registry limits.
+#define DLGR_MAX_VARS 0x400
+#define DLGR_VAR_TABLE_SIZE (DLGR_MAX_VARS * 2) // Must be a power of two.
+#define MAX_VAR_NAME_SIZE (MAX_FNAME_SIZE - 0x10) // Leaves room for "_nnnnnnnnnn.log".
+
+/**
+ * @brief How closed log segments are compressed.
+ * 
+ */
+typedef enum
+{
+    DLGR_CODEC_NONE = 0, // Segments stay raw.
+    DLGR_CODEC_DELTA, // Integers: delta-of-delta, zigzag varint encoded.
+    DLGR_CODEC_XOR // Floats: XOR with the previous value, meaningful bits only (Gorilla).
+} dlgr_codec_t;
+
+/**
+ * @brief What the records of a variable hold, so the logger can aggregate them. Arrays are tagged with their element type.
+ * 
+ */
+typedef enum
+{
+    DLGR_TYPE_NONE = 0, // Opaque bytes.
+    DLGR_TYPE_I8,
+    DLGR_TYPE_I16,
+    DLGR_TYPE_I32,
+    DLGR_TYPE_I64,
+    DLGR_TYPE_U8,
+    DLGR_TYPE_U16,
+    DLGR_TYPE_U32,
+    DLGR_TYPE_U64,
+    DLGR_TYPE_F32,
+    DLGR_TYPE_F64
+} dlgr_type_t;
+
+/**
+ * @brief The result of an aggregation query, or one bucket of a downsampling query.
+ * 
+ */
+typedef struct
+{
+    long long count; // Samples aggregated: records times elements per record.
+    double min;
+    double max;
+    double sum;
+    double mean; // sum / count, 0 if count is 0.
+} dlgr_aggregate_t;
+
+/**
+ * @brief Registration options, ie (dlgr_options_t){.timestamped = 1}. Zeroed options register a plain variable.
+ * 
+ */
+typedef struct
+{
+    int timestamped; // Store a timestamp with every record, enabling dlgr_read_time_range().
+    dlgr_codec_t codec; // Compress segments once they are closed. Reads are unaffected.
+    int element_size; // Bytes per integer or float the codec sees, ie sizeof(int) for an int array. 0 for a scalar variable, or the size of type.
+    dlgr_type_t type; // Type of the records, or of each element of an array, enabling aggregation queries.
+    int columnar; // Store each member of a frame or field of a struct in its own column, see dlgr_register_struct().
+} dlgr_options_t;
+
+/**
+ * @brief An entry of the sparse time index of a segment (var_name_N.tsi).
+ * 
+ */
+typedef struct
+{
+    long long timestamp; // Timestamp of the record.
+    int record; // Record number within the segment, a multiple of DLGR_TIME_INDEX_STRIDE.
+    int reserved;
+} dlgr_time_index_entry_t;
+
+/**
+ * @brief A member of a frame, for dlgr_register_frame(). See DLGR_FRAME_MEMBER().
+ * 
+ */
+typedef struct
+{
+    const char* name;
+    int size;
+} dlgr_member_t;
+
+/**
+ * @brief Where a member lives within a frame record, as stored in the frame's .frm file.
+ * 
+ */
+typedef struct
+{
+    char name[MAX_VAR_NAME_SIZE];
+    int offset;
+    int size;
+    dlgr_type_t type; // DLGR_TYPE_NONE if opaque.
+} dlgr_member_layout_t;
+
+/**
+ * @brief A field of a struct, for dlgr_register_struct(). See DLGR_STRUCT_FIELD().
+ * 
+ */
+typedef struct
+{
+    const char* name;
+    int offset; // Byte offset within the struct, ie offsetof().
+    int size;
+    dlgr_type_t type; // Type of the field, or of each element of an array field. DLGR_TYPE_NONE if opaque.
+} dlgr_field_t;
+
+/**
+ * @brief Segment size and retention of a variable, ie (dlgr_storage_t){.segment_size = 0x1000, .max_segments = 8}. A zero limit is no limit.
+ * 
+ * Retention removes the oldest segments first, when a write moves to a new segment or the limits change.
+ */
+typedef struct
+{
+    int segment_size; // Bytes per log segment, rounded down to whole records but at least one. 0 for MAX_FILE_SIZE.
+    long long max_bytes; // Bytes all segments of the variable may take on disk, counting the current one as full.
+    int max_segments; // Segments kept, including the current one.
+    long long max_age_ms; // Closed segments last written longer ago than this are removed.
+} dlgr_storage_t;
+
+#define DLGR_DEFAULT_STORAGE ((dlgr_storage_t){MAX_FILE_SIZE, MAX_LOG_SET_SIZE, 0, 0})
+
+/**
+ * @brief An entry of the manifest of a variable (var_name.man): one live log segment.
+ * 
+ */
+typedef struct
+{
+    int var_index; // Index of the segment, as in var_name_var_index.log.
+    int records; // Records in the segment.
+    long long bytes; // Bytes the segment takes on disk, compressed or not.
+    long long first_seq; // Sequence number of its first record. Each variable numbers its records from 0.
+    long long closed_ms; // CLOCK_REALTIME ms when the segment was closed, 0 for the current segment.
+    long long first_ts; // Timestamp of its first record, if the variable is timestamped and the segment holds any.
+    long long last_ts; // Timestamp of its last record, likewise.
+} dlgr_segment_info_t;
+
+/**
+ * @brief The live segments of a variable at one moment, see dlgr_snapshot().
+ * 
+ */
+typedef struct
+{
+    int var_size;
+    int timestamped;
+    int num_segments;
+    dlgr_segment_info_t* segments; // Oldest first. The last is the current segment, bounded to the records committed at the snapshot.
+} dlgr_snapshot_t;
+
+/**
+ * @brief When written records are forced to storage.
+ * 
+ */
+typedef enum
+{
+    DLGR_SYNC_NONE = 0, // Never sync, leave it to the OS (or to dlgr_flush()).
+    DLGR_SYNC_EVERY, // fdatasync() the segment after every record.
+    DLGR_SYNC_GROUP, // fdatasync() the segment every group_records records or every group_ms milliseconds, whichever comes first. A background thread syncs records no write has since, at most group_ms after they were written.
+    DLGR_SYNC_ROTATE // fdatasync() a segment only when it is rotated out.
+} dlgr_sync_mode_t;
+
+/**
+ * @brief A durability policy.
+ * 
+ * Only the current segment of a variable is synced; a rotated-out segment is always synced before it is closed, unless the mode is DLGR_SYNC_NONE.
+ * 
+ */
+typedef struct
+{
+    dlgr_sync_mode_t mode;
+    int group_records; // DLGR_SYNC_GROUP only, 0 to disable the record trigger.
+    int group_ms; // DLGR_SYNC_GROUP only, 0 to disable the time trigger.
+} dlgr_durability_t;
+
+#define DLGR_DEFAULT_DURABILITY ((dlgr_durability_t){DLGR_SYNC_EVERY, 0, 0})
+
+/**
+ * @brief What an asynchronous write does when the ring is full.
+ * 
+ */
+typedef enum
+{
+    DLGR_OVERFLOW_BLOCK = 0, // Wait for the writer thread to make room.
+    DLGR_OVERFLOW_DROP_OLDEST, // Discard the oldest queued slot.
+    DLGR_OVERFLOW_DROP_NEWEST // Discard the records being written.
+} dlgr_overflow_t;
+
+/**
+ * @brief Asynchronous logging configuration.
+ * 
+ */
+typedef struct
+{
+    int capacity; // Number of ring slots, must be a power of two.
+    int slot_size; // Bytes of records one slot holds. Larger records are written synchronously.
+    dlgr_overflow_t overflow;
+} dlgr_async_config_t;
+
+/**
+ * @brief Asynchronous logging counters, in records unless noted.
+ * 
+ */
+typedef struct
+{
+    unsigned long long enqueued;
+    unsigned long long written;
+    unsigned long long dropped_oldest;
+    unsigned long long dropped_newest;
+    unsigned long long blocked; // Writes that had to wait for room.
+    unsigned long long write_errors; // Failed appends by the writer thread.
+} dlgr_async_stats_t;
+
+/**
+ * @brief How log files are written, synced, and read.
+ * 
+ */
+typedef enum
+{
+    DLGR_IO_POSIX = 0, // A system call per write, sync, and read.
+    DLGR_IO_URING // Linux io_uring: the writer thread submits each pass, and a read its segments, in one system call.
+} dlgr_io_backend_t;
+
+/**
+ * @brief INTERNAL USE ONLY. One read of dlgr_io_read().
+ * 
+ */
+typedef struct
+{
+    int fd;
+    void* buf;
+    size_t bytes;
+    off_t offset;
+    int tag; // Not used by dlgr_io_read(), ie the segment read.
+    ssize_t result; // Bytes read, or -1.
+} dlgr_io_read_t;
+
+#define DLGR_IO_READS 0x40 // Segments a read has open and in flight at once.
+
+/**
+ * @brief What failed, for the error counters of dlgr_stats_t.
+ * 
+ */
+typedef enum
+{
+    DLGR_ERROR_OPEN = 0, // A segment file could not be opened or created for writing.
+    DLGR_ERROR_WRITE, // A write to a segment failed or was short.
+    DLGR_ERROR_SYNC, // A segment could not be synced.
+    DLGR_ERROR_READ, // A read failed, or wanted records that had been removed.
+    DLGR_ERROR_COMPRESS, // A closed segment could not be compressed, and stayed raw.
+    DLGR_ERROR_MANIFEST, // The manifest could not be stored.
+    DLGR_ERROR_COUNT
+} dlgr_error_t;
+
+/**
+ * @brief Instrumentation counters of a variable since it was loaded or registered, see dlgr_stats().
+ * 
+ */
+typedef struct
+{
+    unsigned long long records_written;
+    unsigned long long bytes_written;
+    unsigned long long rotations; // Segments rotated out.
+    unsigned long long retention_deletions; // Segments removed by retention.
+    unsigned long long syncs; // Syncs of the open segment, by its durability policy, a rotation, or dlgr_flush().
+    unsigned long long sync_ns; // Time spent in those syncs.
+    unsigned long long sync_max_ns; // Longest of them.
+    unsigned long long reads; // Calls that read records: latest, range, time range, field, cursor, and view opens.
+    unsigned long long bytes_read; // Bytes those calls returned, or mapped for a view.
+    unsigned long long errors[DLGR_ERROR_COUNT]; // Failures, by dlgr_error_t.
+} dlgr_stats_t;
+
+/**
+ * @brief INTERNAL USE ONLY. The live counters behind dlgr_stats_t, updated without taking the lock of the variable.
+ * 
+ */
+typedef struct
+{
+    atomic_ullong records_written;
+    atomic_ullong bytes_written;
+    atomic_ullong rotations;
+    atomic_ullong retention_deletions;
+    atomic_ullong syncs;
+    atomic_ullong sync_ns;
+    atomic_ullong sync_max_ns;
+    atomic_ullong reads;
+    atomic_ullong bytes_read;
+    atomic_ullong errors[DLGR_ERROR_COUNT];
+} dlgr_counters_t;
+
+// INTERNAL USE ONLY. Adds n to a counter of var, ie DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1).
+#define DLGR_COUNT(var, counter, n) atomic_fetch_add_explicit(&(var)->counters.counter, (n), memory_order_relaxed)
+
+/**
+ * @brief A run of contiguous records within one mapped log segment.
+ * 
+ */
+typedef struct
+{
+    const void* data; // First record.
+    int count; // Number of records.
+    int var_index; // Index of the segment.
+    long long first_seq; // Sequence number of the first record.
+} dlgr_span_t;
+
+/**
+ * @brief A zero-copy, read-only view of the history of a variable.
+ * 
+ */
+typedef struct
+{
+    int var_size; // Byte-size of one record.
+    int num_spans;
+    long long total_count; // Records across all spans.
+    dlgr_span_t* spans; // Oldest first.
+    size_t* map_sizes; // INTERNAL USE ONLY. Mapped length of each span.
+} dlgr_view_t;
+
+/**
+ * @brief A forward cursor over the history of a variable, see dlgr_cursor_open().
+ * 
+ */
+typedef struct
+{
+    int handle;
+    int var_size; // Byte-size of one record.
+    long long next_seq; // Sequence number of the next record dlgr_cursor_next() returns.
+    int fd; // INTERNAL USE ONLY. Open segment, -1 if none.
+    dlgr_segment_info_t segment; // INTERNAL USE ONLY. Manifest entry of the open segment.
+    int prefetch_fd; // INTERNAL USE ONLY. Next segment, opened and being read ahead, -1 if none.
+    int prefetch_index; // INTERNAL USE ONLY. Index of the prefetched segment.
+} dlgr_cursor_t;
+
+/**
+ * @brief In-memory state of a registered variable.
+ * 
+ * Loaded once from the variable's .reg and .idx files, after which the hot path never touches the filesystem for metadata. The .reg and .idx files remain the persistent source of truth.
+ * 
+ */
+typedef struct dlgr_var
+{
+    char var_name[MAX_VAR_NAME_SIZE]; // Name of the variable, ie acs_x.
+    int var_size; // Byte-size of one record.
+    int var_index; // Index of the current log segment.
+    int seg_fill; // Bytes currently stored in the current log segment, and the offset of the next write.
+    int seg_fd; // File descriptor of the current log segment, -1 if not open.
+    int seg_dirfd; // Directory the current log segment is written in: the hot directory, or the log directory.
+    int timestamped; // Set if records carry timestamps.
+    int ts_fd; // File descriptor of the timestamp column (var_name_N.ts) of the current segment, -1 if not open.
+    int tsi_fd; // File descriptor of the sparse time index (var_name_N.tsi) of the current segment, -1 if not open.
+    dlgr_durability_t durability; // Effective durability policy.
+    int durability_override; // Set if durability was set for this variable rather than inherited from the logger.
+    int unsynced; // Records written to the current segment since it was last synced.
+    long long last_sync_ms; // CLOCK_MONOTONIC time of the last sync, DLGR_SYNC_GROUP only.
+    dlgr_storage_t storage; // Effective segment size and retention.
+    int storage_override; // Set if storage was set for this variable rather than inherited from the logger.
+    dlgr_codec_t codec; // Codec of closed segments.
+    int element_size; // Bytes per element for the codec.
+    dlgr_type_t type; // Type of the records, DLGR_TYPE_NONE if opaque.
+    dlgr_segment_info_t* segments; // Manifest of live segments, oldest first. The last is the current segment.
+    int num_segments; // Entries in segments, at least one once loaded or registered.
+    int segments_capacity; // Allocated entries of segments.
+    int num_members; // Members if this is a frame, 0 otherwise.
+    dlgr_member_layout_t* members; // Layout of a frame record, NULL if not a frame.
+    int columnar; // Set if each member is stored in its own column (var_name_N.cK) rather than in rows (var_name_N.log).
+    int* column_fds; // File descriptor of each column of the current segment if columnar, NULL if not open. column_fds[0] is seg_fd.
+    int* spare_fds; // Files of the next segment, opened ahead by the background thread: each column, or the log. NULL if none.
+    int spare_ts_fd; // Timestamp column of the next segment, -1 if none.
+    int spare_tsi_fd; // Time index of the next segment, -1 if none.
+    int spare_index; // Index of the next segment, if spare_fds is set.
+    int spare_dirfd; // Directory the next segment was opened in.
+    int spare_busy; // Set while the background thread opens the next segment.
+    pthread_cond_t spare_done; // Signalled, with lock, once it has.
+    int manifest_dirty; // Set by a rotation until the background thread stores the manifest.
+    unsigned long long manifest_gen; // Counts copies of the manifest taken to be stored, under lock.
+    unsigned long long manifest_stored_gen; // Copy last stored, under manifest_lock, so an older one never replaces it.
+    pthread_mutex_t manifest_lock; // Serializes stores of the manifest. Taken after lock when both are held.
+    dlgr_counters_t counters; // Instrumentation, see dlgr_stats().
+    pthread_mutex_t lock; // Serializes writers and index changes.
+} dlgr_var_t;
+
+/**
+ * @brief Loads every variable registered in a log directory, in one pass over its listing.
+ * 
+ * Optional: variables are otherwise loaded on first use. The oldest closed segments whose files have gone missing are
+ * dropped from their manifests. dir is held open as the log directory from then on; the working directory is left
+ * alone. Once variables are registered or loaded, dir must be the log directory already in use.
+ * 
+ * @param dir The log directory, or NULL for the working directory.
+ * @return int Negative on failure, number of variables loaded on success.
+ */
+int dlgr_open(const char* dir);
 
-// #define CALCULATE_NEXT_FILE_SIZE ({struct stat stbuf[1]; stat(fname_buf, stbuf); stbuf->st_size;})
+/**
+ * @brief Same as dlgr_open(), for reading a log directory another process is writing, ie dlgr_export.
+ * 
+ * Nothing in the directory is written, for the rest of the process: manifests are neither rewritten nor built from
+ * older .idx files on disk, missing segments are only skipped in memory, and registering or writing fails. Call before
+ * registering or loading any variable.
+ * 
+ * @param dir The log directory, or NULL for the working directory.
+ * @return int Negative on failure, number of variables loaded on success.
+ */
+int dlgr_open_read_only(const char* dir);
 
 /**
  * @brief INTERNAL USE ONLY. Registers named data with a byte-size.
  * 
- * Creates a var_name.reg file containing the var_size, and an initial var_name.idx file initially containing the value 0, and iterated each time a new log file is created for this var_name.
+ * Creates a var_name.reg file containing the var_size, and a var_name.man manifest holding an empty var_name_0.log.
+ * Registering a variable again with the same size and options does nothing, keeping its history; with a different
+ * size or options, it starts over.
  * 
  * @param var_name The name to register.
  * @param var_size The byte-size to register.
- * @return int Negative on failure, 1 on success.
+ * @return int Negative on failure, the variable's handle on success.
  */
 int dlgr_register(const char* var_name, int var_size);
 
+/**
+ * @brief INTERNAL USE ONLY. Same as dlgr_register(), with options.
+ * 
+ * @param var_name The name to register.
+ * @param var_size The byte-size to register.
+ * @param options Registration options, stored in the .reg file.
+ * @return int Negative on failure, the variable's handle on success.
+ */
+int dlgr_register_opts(const char* var_name, int var_size, dlgr_options_t options);
+
+/**
+ * @brief INTERNAL USE ONLY. Finds an existing registration of var_name with the same size and options.
+ * 
+ * @param var_name The name of the variable.
+ * @param var_size The byte-size it would be registered with.
+ * @param options The options it would be registered with.
+ * @return int Negative if there is none, or it differs; the variable's handle otherwise.
+ */
+int dlgr_find_registration(const char* var_name, int var_size, dlgr_options_t options);
+
+/**
+ * @brief INTERNAL USE ONLY. Same as dlgr_register_opts(), for a variable whose columnar layout is stored right after.
+ * 
+ * The codec is only checked to exist; each column is compressed by the size and type of its member.
+ * 
+ * @param var_name The name to register.
+ * @param var_size The byte-size to register.
+ * @param options Registration options, stored in the .reg file.
+ * @return int Negative on failure, the variable's handle on success.
+ */
+int dlgr_register_columns(const char* var_name, int var_size, dlgr_options_t options);
+
+/**
+ * @brief Registers a frame: a group of variables written together as one record into one shared log.
+ * 
+ * Members are laid out in the given order with no padding. The layout is stored in frame_name.frm alongside the usual .reg and .idx files.
+ * 
+ * @param frame_name The name to register the frame under.
+ * @param members The members, in record order.
+ * @param num_members The number of members.
+ * @param options Registration options, as for dlgr_register_opts().
+ * @return int Negative on failure, the frame's handle on success.
+ */
+int dlgr_register_frame(const char* frame_name, const dlgr_member_t* members, int num_members, dlgr_options_t options);
+
+/**
+ * @brief Registers a struct written whole, ie with DLGR_WRITE(), whose fields can be read one at a time.
+ * 
+ * With options.columnar set, each field is stored in its own column file per segment (structure-of-arrays), so
+ * dlgr_read_field() reads only the bytes of that field, and padding between fields is not stored. Whole-record
+ * reads reassemble rows, with padding zeroed. Columns are compressed separately, by the type of their field.
+ * 
+ * @param struct_name The name to register the struct under.
+ * @param struct_size The byte-size of the struct, ie sizeof().
+ * @param fields The fields. They must not overlap.
+ * @param num_fields The number of fields.
+ * @param options Registration options, as for dlgr_register_opts().
+ * @return int Negative on failure, the struct's handle on success.
+ */
+int dlgr_register_struct(const char* struct_name, int struct_size, const dlgr_field_t* fields, int num_fields, dlgr_options_t options);
+
+/**
+ * @brief Writes one record of a frame, gathered from its members.
+ * 
+ * @param handle Handle of the frame.
+ * @param member_data A pointer to each member's data, in registration order.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_write_frame(int handle, const void* const* member_data);
+
+/**
+ * @brief Reads the newest values of one member of a frame, newest first.
+ * 
+ * @param handle Handle of the frame.
+ * @param member_name Name of the member.
+ * @param storage Where the read data will be stored, at least count * the member's size bytes.
+ * @param count The maximum number of values to read.
+ * @return int Negative on failure, number of values read on success.
+ */
+int dlgr_read_member(int handle, const char* member_name, void* storage, int count);
+
+/**
+ * @brief Reads records first_seq to first_seq + count - 1 of one member of a frame or field of a struct, oldest first.
+ * 
+ * Reads only the column of the field if the variable is columnar.
+ * 
+ * @param var_name The name of the frame or struct.
+ * @param field_name Name of the member or field.
+ * @param first_seq Sequence number of the first record to read.
+ * @param count The maximum number of values to read.
+ * @param storage Where the read data will be stored, at least count * the field's size bytes.
+ * @return int Negative on failure or if first_seq has been removed, number of values read on success.
+ */
+int dlgr_read_field(const char* var_name, const char* field_name, long long first_seq, int count, void* storage);
+
+/**
+ * @brief Same as dlgr_read_field(), by handle.
+ * 
+ * @param handle Handle of the frame or struct.
+ * @param field_name Name of the member or field.
+ * @param first_seq Sequence number of the first record to read.
+ * @param count The maximum number of values to read.
+ * @param storage Where the read data will be stored.
+ * @return int Negative on failure, number of values read on success.
+ */
+int dlgr_read_field_handle(int handle, const char* field_name, long long first_seq, int count, void* storage);
+
+/**
+ * @brief INTERNAL USE ONLY. Reassembles count rows of segment var_index of a columnar variable, from first_record, into an anonymous file.
+ * 
+ * The rows are at the offsets they have in the segment; the file holds nothing before them, and ends after them.
+ * 
+ * @param var The variable.
+ * @param var_index Index of the segment.
+ * @param first_record First row to reassemble.
+ * @param count Rows to reassemble, negative for all whole rows from first_record.
+ * @return int Negative on failure, a read-only file descriptor of the rows on success.
+ */
+int dlgr_open_columns(const dlgr_var_t* var, int var_index, int first_record, int count);
+
+/**
+ * @brief INTERNAL USE ONLY. Loads the member layout of var from its .frm file, if it is a frame.
+ * 
+ * @param var The variable.
+ * @return int Negative on failure, 0 if var is not a frame, 1 on success.
+ */
+int dlgr_load_frame(dlgr_var_t* var);
+
+/**
+ * @brief Returns the handle of a registered variable.
+ * 
+ * The first lookup of a variable not registered by this process loads its .reg and .idx files; subsequent lookups are served from memory. A handle stays bound to its name for the lifetime of the process.
+ * 
+ * @param var_name The name of the variable.
+ * @return int Negative on failure, the variable's handle on success.
+ */
+int dlgr_get_handle(const char* var_name);
+
+/**
+ * @brief INTERNAL USE ONLY. Returns the in-memory state of a handle.
+ * 
+ * @param handle Handle returned by dlgr_register() or dlgr_get_handle().
+ * @return dlgr_var_t* NULL on failure, the variable's state on success.
+ */
+dlgr_var_t* dlgr_get_var(int handle);
+
 /**
  * @brief INTERNAL USE ONLY. Writes named data to a log.
  * 
  * @param var_name The name of the data to store.
  * @param data The data to store.
- * @return int 
+ * @return int Negative on failure, 1 on success.
  */
 int dlgr_write(const char* var_name, void* data);
 
 /**
- * @brief INTERNAL USE ONLY. Returns the number of bytes needed to store a number of read named-data of some previously defined (by dlgr_register()) size.
+ * @brief INTERNAL USE ONLY. Writes data to the log of a handle.
  * 
- * Failure modes include if var_name has not been previously registered.
+ * @param handle Handle of the variable to store.
+ * @param data The data to store.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_write_handle(int handle, void* data);
+
+/**
+ * @brief INTERNAL USE ONLY. Writes count contiguous records of named data to a log.
  * 
- * @param var_name The name of the data to be read.
- * @param number The number of these data chunks to be read.
- * @return int Negative on failure, bytes required to store this data.
+ * The records are split across log segments with one write per segment touched, and old segments are removed once per call.
+ * 
+ * @param var_name The name of the data to store.
+ * @param data The records to store, count * the registered size bytes.
+ * @param count The number of records.
+ * @return int Negative on failure, 1 on success.
  */
-int dlgr_prime_read(const char* var_name, int number);
+int dlgr_write_batch(const char* var_name, void* data, int count);
 
 /**
- * @brief INTERNAL USE ONLY. Reads data from logs and stores it.
+ * @brief INTERNAL USE ONLY. Same as dlgr_write_batch(), for a handle.
  * 
- * Failure modes include if dlgr_prime_read() was not called immediately prior. This is checked by seeing if number * primed_varname_size = primed_byte_size.
+ * @param handle Handle of the variable to store.
+ * @param data The records to store, count * the registered size bytes.
+ * @param count The number of records.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_write_batch_handle(int handle, void* data, int count);
+
+/**
+ * @brief INTERNAL USE ONLY. Same as dlgr_write_batch_handle(), with a timestamp for every record.
  * 
- * @param storage Where the read data will be stored. 
- * @param number The number of data to be read (i.e. 'number'-many ints).
- * @return int Negative on failure, positive on success.
+ * Records of variables that are not timestamped are written without their timestamps. Timestamps should not decrease.
+ * 
+ * @param handle Handle of the variable to store.
+ * @param data The records to store, count * the registered size bytes.
+ * @param timestamps The timestamp of each record, or NULL to stamp every record with dlgr_time_now().
+ * @param count The number of records.
+ * @return int Negative on failure, 1 on success.
  */
-int dlgr_perform_read(void* storage, int number);
+int dlgr_write_timed_handle(int handle, void* data, const long long* timestamps, int count);
 
 /**
- * @brief 
+ * @brief Returns the current time as used for timestamps: nanoseconds since the epoch (CLOCK_REALTIME).
  * 
- * @param var_name 
- * @param fname_buf_size 
- * @return int 
+ * @return long long 
+ */
+long long dlgr_time_now(void);
+
+/**
+ * @brief Reads the records of a timestamped variable with timestamps within [t0, t1], oldest first.
+ * 
+ * Binary-searches the segments by their first timestamp and each segment's sparse time index, so only the bytes returned and a few index blocks are read.
+ * 
+ * @param handle Handle of the variable to be read.
+ * @param t0 Earliest timestamp to return.
+ * @param t1 Latest timestamp to return.
+ * @param storage Where the read data will be stored, at least max_count * the registered size bytes.
+ * @param timestamps Where the timestamps of the read data will be stored, or NULL.
+ * @param max_count The maximum number of records to read; the oldest max_count matching records are returned.
+ * @return int Negative on failure, number of records read on success.
+ */
+int dlgr_read_time_range(int handle, long long t0, long long t1, void* storage, long long* timestamps, int max_count);
+
+/**
+ * @brief Reads the timestamps of count contiguous records of a timestamped variable, starting at sequence number first_seq, oldest first.
+ * 
+ * The timestamps of the records dlgr_read_range_handle() returns for the same range.
+ * 
+ * @param handle Handle of the variable to be read.
+ * @param first_seq Sequence number of the first record.
+ * @param count The maximum number of timestamps to read.
+ * @param timestamps Where the timestamps will be stored, at least count long longs.
+ * @return int Negative on failure, number of timestamps read on success (fewer than count if the range runs past the newest record).
+ */
+int dlgr_read_timestamps(int handle, long long first_seq, int count, long long* timestamps);
+
+/**
+ * @brief INTERNAL USE ONLY. Appends count contiguous records to the log of var, rotating segments as needed.
+ * 
+ * Caller must hold var->lock.
+ * 
+ * @param var The variable to append to.
+ * @param data The records to store.
+ * @param timestamps The timestamp of each record, or NULL for now. Ignored if var is not timestamped.
+ * @param count The number of records.
+ * @return int Negative on failure, number of records written on success.
+ */
+int dlgr_append(dlgr_var_t* var, const void* data, const long long* timestamps, int count);
+
+/**
+ * @brief Maps the history of a handle into memory, without copying it.
+ * 
+ * Every segment is mapped read-only, the current one up to the records committed when the view is opened. The view stays valid while the writer rotates segments or removes old ones, until dlgr_view_close().
+ * 
+ * @param handle Handle of the variable to view.
+ * @param view Where the spans are stored, oldest first.
+ * @return int Negative on failure, number of spans on success.
+ */
+int dlgr_view_open(int handle, dlgr_view_t* view);
+
+/**
+ * @brief Opens a cursor that streams the history of a handle oldest to newest, from sequence number from_seq on.
+ * 
+ * Only the open segment and the next one are held at a time. The next one is read ahead while the open one is consumed, and segments are dropped from the page cache once consumed, so any length of history is replayed in constant memory.
+ * 
+ * @param handle Handle of the variable.
+ * @param from_seq Sequence number of the first record, ie 0 for the whole history. Records already removed by retention are skipped.
+ * @param cursor The cursor.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_cursor_open(int handle, long long from_seq, dlgr_cursor_t* cursor);
+
+/**
+ * @brief Reads the next records of a cursor, oldest first.
+ * 
+ * Returns 0 once the cursor has caught up with the writer; later calls return records logged since. If retention removes records before they are read, the cursor skips to the oldest record left, which cursor->next_seq reflects.
+ * 
+ * @param cursor The cursor.
+ * @param buf Where the records are stored, at least max * the registered size bytes.
+ * @param max The maximum number of records to read.
+ * @return int Negative on failure, number of records read on success.
+ */
+int dlgr_cursor_next(dlgr_cursor_t* cursor, void* buf, int max);
+
+/**
+ * @brief Closes a cursor opened by dlgr_cursor_open().
+ * 
+ * @param cursor The cursor.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_cursor_close(dlgr_cursor_t* cursor);
+
+/**
+ * @brief INTERNAL USE ONLY. Finds the manifest entry of the segment holding a record of a handle.
+ * 
+ * @param handle Handle of the variable.
+ * @param seq Sequence number of the record. If it has been removed, the oldest segment is found instead.
+ * @param segment Where the entry is stored.
+ * @param next_index Where the index of the following segment is stored, -1 if segment is the current one.
+ * @return int Negative on failure, 0 if seq has not been logged yet, 1 on success.
+ */
+int dlgr_find_segment(int handle, long long seq, dlgr_segment_info_t* segment, int* next_index);
+
+/**
+ * @brief INTERNAL USE ONLY. Same as dlgr_view_open(), mapping only the segments holding records first_seq to first_seq + count - 1.
+ * 
+ * @param handle Handle of the variable to view.
+ * @param first_seq Sequence number of the first record wanted.
+ * @param count Number of records wanted.
+ * @param view Where the spans are stored, oldest first. Spans are whole segments, and may start before first_seq or end after the range.
+ * @return int Negative on failure, number of spans on success.
+ */
+int dlgr_view_open_range(int handle, long long first_seq, long long count, dlgr_view_t* view);
+
+/**
+ * @brief Computes count, min, max, sum, and mean over records of a typed variable, by sequence number.
+ * 
+ * Runs vectorized kernels over the mapped segments; no records are copied out. Arrays are aggregated over all their elements.
+ * 
+ * @param handle Handle of the variable, registered with a type.
+ * @param first_seq Sequence number of the first record.
+ * @param count Number of records.
+ * @param result Where the result is stored. Records not retained are left out of it.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_aggregate(int handle, long long first_seq, long long count, dlgr_aggregate_t* result);
+
+/**
+ * @brief Same as dlgr_aggregate(), over the records of a timestamped, typed variable stamped t0 to t1 inclusive.
+ * 
+ * @param handle Handle of the variable.
+ * @param t0 Start of the time range.
+ * @param t1 End of the time range.
+ * @param result Where the result is stored.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_aggregate_time(int handle, long long t0, long long t1, dlgr_aggregate_t* result);
+
+/**
+ * @brief Aggregates consecutive windows of records of a typed variable, ie for plotting a long history.
+ * 
+ * @param handle Handle of the variable, registered with a type.
+ * @param first_seq Sequence number of the first record.
+ * @param count Number of records.
+ * @param window Records per bucket; the last bucket may be short.
+ * @param buckets Where the aggregate of each window is stored, oldest first.
+ * @param max_buckets The maximum number of buckets.
+ * @return int Negative on failure, number of buckets stored on success.
+ */
+int dlgr_downsample(int handle, long long first_seq, long long count, long long window, dlgr_aggregate_t* buckets, int max_buckets);
+
+/**
+ * @brief Aggregates fixed time windows of a timestamped, typed variable: t0 to t0 + window - 1, and so on up to t1 inclusive.
+ * 
+ * @param handle Handle of the variable.
+ * @param t0 Start of the time range.
+ * @param t1 End of the time range.
+ * @param window Length of a window, in timestamp units.
+ * @param buckets Where the aggregate of each window is stored, oldest first. Windows without records have a count of 0.
+ * @param max_buckets The maximum number of buckets.
+ * @return int Negative on failure, number of buckets stored on success.
+ */
+int dlgr_downsample_time(int handle, long long t0, long long t1, long long window, dlgr_aggregate_t* buckets, int max_buckets);
+
+/**
+ * @brief INTERNAL USE ONLY. Returns the byte-size of a type, 0 for DLGR_TYPE_NONE and negative if invalid.
+ * 
+ * @param type The type.
+ * @return int Size in bytes.
+ */
+int dlgr_type_size(dlgr_type_t type);
+
+/**
+ * @brief INTERNAL USE ONLY. Finds the sequence number of the first record of a timestamped variable stamped at or after t.
+ * 
+ * @param handle Handle of the variable.
+ * @param t The time.
+ * @param after Set to find the first record stamped after t instead.
+ * @param seq Where the sequence number is stored; the next sequence number if every record is earlier.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_time_to_seq(int handle, long long t, int after, long long* seq);
+
+/**
+ * @brief Unmaps a view opened by dlgr_view_open().
+ * 
+ * @param view The view to close.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_view_close(dlgr_view_t* view);
+
+/**
+ * @brief INTERNAL USE ONLY. Checks a codec and its element size against a record size.
+ * 
+ * @param codec The codec.
+ * @param record_size Bytes per record.
+ * @param element_size Requested element size, 0 for the whole record.
+ * @return int Negative if invalid, the element size to use on success (0 for DLGR_CODEC_NONE).
+ */
+int dlgr_codec_element_size(dlgr_codec_t codec, int record_size, int element_size);
+
+/**
+ * @brief INTERNAL USE ONLY. Compresses the closed file fname into fname.z.tmp, for dlgr_publish_compressed() to put in place. Incompressible files are left as they are.
+ * 
+ * @param dirfd Directory of fname, or AT_FDCWD.
+ * @param fname The file of records.
+ * @param codec The codec.
+ * @param element_size Bytes per element, from dlgr_codec_element_size().
+ * @param record_size Bytes per record.
+ * @param sync Set to make fname.z.tmp durable.
+ * @return int Negative on failure, 0 if left uncompressed, 1 on success.
+ */
+int dlgr_compress_file(int dirfd, const char* fname, dlgr_codec_t codec, int element_size, int record_size, int sync);
+
+/**
+ * @brief INTERNAL USE ONLY. Renames fname.z.tmp, from dlgr_compress_file(), to fname.z and removes fname.
+ * 
+ * @param dirfd Directory of fname.
+ * @param fname The file of records.
+ * @param sync Set to sync dirfd, making the rename durable.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_publish_compressed(int dirfd, const char* fname, int sync);
+
+/**
+ * @brief INTERNAL USE ONLY. Decodes fname.z into an anonymous in-memory file, or shares the decoding of a recent call.
+ * 
+ * @param dirfd Directory of fname.z, or AT_FDCWD.
+ * @param fname The file name before compression.
+ * @return int Negative on failure, a read-only file descriptor of the decoded records on success.
+ */
+int dlgr_open_compressed(int dirfd, const char* fname);
+
+/**
+ * @brief INTERNAL USE ONLY. Copies the manifest of a handle, so its segments can be read without holding the variable.
+ * 
+ * Segments listed may be removed by retention while the snapshot is read; readers treat a missing segment as the end of the data.
+ * 
+ * @param handle Handle of the variable.
+ * @param newest_records Only the newest segments holding at least this many records are copied; negative for all.
+ * @param snapshot Where the copy is stored. Free it with dlgr_snapshot_free().
+ * @return int Negative on failure, the number of segments copied on success.
+ */
+int dlgr_snapshot(int handle, long long newest_records, dlgr_snapshot_t* snapshot);
+
+/**
+ * @brief INTERNAL USE ONLY. Frees a snapshot taken by dlgr_snapshot().
+ * 
+ * @param snapshot The snapshot.
+ */
+void dlgr_snapshot_free(dlgr_snapshot_t* snapshot);
+
+/**
+ * @brief INTERNAL USE ONLY. Opens a file of a log segment of var for reading.
+ * 
+ * A compressed file is decoded, and read through the returned descriptor as if it were raw.
+ * 
+ * @param var The variable.
+ * @param var_index Index of the segment.
+ * @param ext Which file of the segment: "log" (records), "ts" (timestamps), or "tsi" (sparse time index).
+ * @return int Negative if the file does not exist, a file descriptor on success.
+ */
+int dlgr_open_segment_read(const dlgr_var_t* var, int var_index, const char* ext);
+
+/**
+ * @brief INTERNAL USE ONLY. Opens the records of a log segment of var for reading count records from first_record.
+ * 
+ * Same as dlgr_open_segment_read(var, var_index, "log"), except a columnar segment only has those rows reassembled.
+ * 
+ * @param var The variable.
+ * @param var_index Index of the segment.
+ * @param first_record First record to be read.
+ * @param count Records to be read, negative for all from first_record.
+ * @return int Negative if the segment does not exist, a file descriptor on success.
+ */
+int dlgr_open_segment_rows(const dlgr_var_t* var, int var_index, int first_record, int count);
+
+/**
+ * @brief Keeps the current log segment of every variable in a hot directory, ie a tmpfs, rather than in the log directory.
+ * 
+ * Closed segments are then moved into the log directory by a background thread, in one sequential copy each, while
+ * registrations and manifests stay in the log directory. Reads find a segment in either. A segment is only as durable
+ * as the hot directory until it has moved; dlgr_shutdown() moves the current ones too, and dlgr_open() those a crash
+ * left behind. Call before any variable is registered or loaded.
+ * 
+ * @param dir The hot directory.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_set_hot_dir(const char* dir);
+
+/**
+ * @brief Waits until every closed segment queued for compression or the log directory has been handled.
+ * 
+ * @return int Negative on failure, 0 if there is no hot directory, 1 on success.
+ */
+int dlgr_migrate_flush(void);
+
+/**
+ * @brief INTERNAL USE ONLY. The hot directory set by dlgr_set_hot_dir().
+ * 
+ * @return int -1 if there is none, its directory file descriptor otherwise.
+ */
+int dlgr_hot_dir_fd(void);
+
+/**
+ * @brief INTERNAL USE ONLY. The log directory: the one given to dlgr_open(), or else the working directory when the
+ * library first needed it. Held open, so a later chdir() by the application doesn't move the logs.
+ * 
+ * @return int -1 if it could not be opened, its directory file descriptor otherwise.
+ */
+int dlgr_log_dir_fd(void);
+
+/**
+ * @brief INTERNAL USE ONLY. Makes dir the log directory, see dlgr_open().
+ * 
+ * Once variables are registered or loaded the log directory can no longer change, and only the same one is accepted.
+ * 
+ * @param dir The log directory.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_set_log_dir(const char* dir);
+
+/**
+ * @brief INTERNAL USE ONLY. Opens a registration or manifest file in the log directory, as fopen() would with mode "r" or "w".
+ * 
+ * @param fname Name of the file.
+ * @param mode "r" or "w".
+ * @return FILE* NULL on failure, the open file on success.
+ */
+FILE* dlgr_fopen_log(const char* fname, const char* mode);
+
+/**
+ * @brief INTERNAL USE ONLY. Compresses closed segment var_index of var with its codec.
+ * 
+ * The files are encoded without var->lock, then put in place and the manifest updated under it, unless the segment has
+ * been removed by retention meanwhile. A file that fails to compress stays raw, which reads just as well.
+ * 
+ * @param var The variable.
+ * @param var_index Index of the segment.
+ * @return int Negative on failure, 0 if nothing was compressed, 1 on success.
+ */
+int dlgr_compress_segment(dlgr_var_t* var, int var_index);
+
+/**
+ * @brief INTERNAL USE ONLY. Queues closed segment var_index of var for the background thread, which compresses it if var
+ * has a codec, then moves it from the hot directory into the log directory if it is there.
+ * 
+ * @param var The variable.
+ * @param var_index Index of the segment.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_migrate(dlgr_var_t* var, int var_index);
+
+/**
+ * @brief INTERNAL USE ONLY. Queues current segment var_index of var for the background thread, see dlgr_prepare_segment().
+ * 
+ * @param var The variable.
+ * @param var_index Index of the segment.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_prepare(dlgr_var_t* var, int var_index);
+
+/**
+ * @brief INTERNAL USE ONLY. Does what a rotation into segment var_index of var leaves to the background thread.
+ * 
+ * Stores the manifest the rotation changed, removes segments beyond the retention limits of var, and opens and
+ * preallocates segment var_index + 1, for the next rotation to switch to. Nothing is done once var has moved on from
+ * var_index or closed it.
+ * 
+ * @param var The variable.
+ * @param var_index Index of the current segment.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_prepare_segment(dlgr_var_t* var, int var_index);
+
+/**
+ * @brief INTERNAL USE ONLY. Moves the files of segment var_index of var from the hot directory into the log directory.
+ * 
+ * The files are copied aside, then renamed into place and removed from the hot directory under var->lock, unless the
+ * segment has been removed by retention or is being written meanwhile.
+ * 
+ * @param var The variable.
+ * @param var_index Index of the segment.
+ * @return int Negative on failure, 0 if nothing was moved, 1 on success.
+ */
+int dlgr_migrate_segment(dlgr_var_t* var, int var_index);
+
+/**
+ * @brief Selects how log files are written, synced, and read; DLGR_IO_POSIX until called.
+ * 
+ * Under DLGR_IO_URING the writer thread of dlgr_async_start() makes each pass, the writes of every variable it drained
+ * and their syncs, in one io_uring_enter(), and reads spanning several segments read them all at once. Synchronous
+ * writes are made as before. Falls back to DLGR_IO_POSIX where the kernel lacks io_uring or forbids it. Call before
+ * dlgr_open(), or at any time; the writer thread picks it up at its next pass.
+ * 
+ * @param backend The backend.
+ * @return int Negative on failure, the backend in use on success.
+ */
+int dlgr_set_io_backend(dlgr_io_backend_t backend);
+
+/**
+ * @brief INTERNAL USE ONLY. Starts batching the writes and syncs of the calling thread, under DLGR_IO_URING.
+ * 
+ * The caller must hold the lock of every variable it writes until dlgr_io_batch_end(), then call dlgr_io_batch_sync().
+ * 
+ * @return int 0 if writes are made right away, 1 if they are batched.
+ */
+int dlgr_io_batch_begin(void);
+
+/**
+ * @brief INTERNAL USE ONLY. Submits the batched writes of the calling thread, waits for them, and stops batching.
+ * 
+ * Syncs batched meanwhile are left for dlgr_io_batch_sync().
+ * 
+ * @return int Negative if any write failed, 1 on success.
+ */
+int dlgr_io_batch_end(void);
+
+/**
+ * @brief INTERNAL USE ONLY. Makes the syncs left by dlgr_io_batch_end(), all at once. Needs no variable locked.
+ * 
+ * @return int Negative if any sync failed, 1 on success.
+ */
+int dlgr_io_batch_sync(void);
+
+/**
+ * @brief INTERNAL USE ONLY. Submits the batch of the calling thread, if any, and waits for it.
+ * 
+ * Writes that failed take their variable back to the first record they carried, and are counted and reported.
+ * 
+ * @return int Negative if any write or sync failed, 1 on success.
+ */
+int dlgr_io_flush(void);
+
+/**
+ * @brief INTERNAL USE ONLY. pwrite() to a file of the current segment of var, or batched. Caller must hold var->lock.
+ * 
+ * @param var The variable.
+ * @param record First record of the segment the bytes belong to.
+ * @param fd The file.
+ * @param buf The bytes, copied if batched.
+ * @param bytes Number of bytes.
+ * @param offset Offset in the file.
+ * @return ssize_t Bytes written (or batched), -1 on failure.
+ */
+ssize_t dlgr_io_pwrite(dlgr_var_t* var, int record, int fd, const void* buf, size_t bytes, off_t offset);
+
+/**
+ * @brief INTERNAL USE ONLY. fdatasync() every file of the current segment of var, or batches it. Caller must hold var->lock.
+ * 
+ * @param var The variable, with its segment open.
+ * @return int Negative on failure, 0 if batched, 1 if synced.
+ */
+int dlgr_io_sync(dlgr_var_t* var);
+
+/**
+ * @brief INTERNAL USE ONLY. Makes several reads, all in flight at once under DLGR_IO_URING.
+ * 
+ * @param reads The reads, whose results are stored in them.
+ * @param num_reads Number of reads.
+ * @return int Negative if any read came up short, 1 on success.
+ */
+int dlgr_io_read(dlgr_io_read_t* reads, int num_reads);
+
+/**
+ * @brief INTERNAL USE ONLY. Reads bytes from fd at offset, retrying short reads.
+ * 
+ * @param fd The file.
+ * @param buf Where the bytes are stored.
+ * @param bytes Number of bytes.
+ * @param offset Offset in the file.
+ * @return ssize_t Bytes read, less than bytes only at end of file, or -1.
+ */
+ssize_t dlgr_pread_full(int fd, void* buf, size_t bytes, off_t offset);
+
+/**
+ * @brief Starts asynchronous logging.
+ * 
+ * Writes of any handle are then copied into a lock-free ring in bounded time, and a background thread drains the ring into the logs, coalescing the records of each variable. Reads see records once they have been drained; call dlgr_async_flush() first to read everything written so far.
+ * 
+ * @param config Ring capacity, slot size, and overflow policy.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_async_start(dlgr_async_config_t config);
+
+/**
+ * @brief Drains the ring, stops the writer thread, and returns to synchronous logging.
+ * 
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_async_stop(void);
+
+/**
+ * @brief Waits until every record written before the call has been drained into the logs.
+ * 
+ * Returns immediately if asynchronous logging is not running.
+ * 
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_async_flush(void);
+
+/**
+ * @brief Reads the counters of the running ring.
+ * 
+ * @param stats Where the counters are stored, zeroed if asynchronous logging is not running.
+ * @return int Negative on failure, 0 if not running, 1 on success.
+ */
+int dlgr_async_stats(dlgr_async_stats_t* stats);
+
+/**
+ * @brief INTERNAL USE ONLY. Queues records for the writer thread.
+ * 
+ * @param handle Handle of the variable.
+ * @param data The records.
+ * @param timestamps The timestamp of each record, or NULL for now. Ignored unless timestamped is set.
+ * @param count The number of records.
+ * @param var_size Registered size of the variable.
+ * @param timestamped Set if the variable is timestamped; the timestamps are then queued with the records.
+ * @return int Negative on failure, 0 if the caller must write the records itself, 1 if they were queued (or dropped by the overflow policy).
+ */
+int dlgr_async_enqueue(int handle, const void* data, const long long* timestamps, int count, int var_size, int timestamped);
+
+/**
+ * @brief Reads the instrumentation counters of a variable.
+ * 
+ * @param handle Handle of the variable.
+ * @param stats Where the counters are stored.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_stats(int handle, dlgr_stats_t* stats);
+
+/**
+ * @brief Writes the counters of every loaded variable, one line each, followed by the number of counted diagnostics.
+ * 
+ * @param stream Where to write, ie stdout.
+ * @return int Negative on failure, number of variables written on success.
+ */
+int dlgr_stats_dump(FILE* stream);
+
+/**
+ * @brief INTERNAL USE ONLY. Counts a diagnostic in place of printing it, with -DDLGR_COUNT_EVENTS.
+ * 
+ * @param func Function the diagnostic came from.
+ * @param line Line the diagnostic came from.
+ */
+void dlgr_count_event(const char* func, int line);
+
+/**
+ * @brief Sets the logger-wide durability policy.
+ * 
+ * Applies to every variable that has not been given its own policy by dlgr_set_durability(), including ones registered later. Defaults to DLGR_DEFAULT_DURABILITY.
+ * 
+ * @param durability The policy.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_set_default_durability(dlgr_durability_t durability);
+
+/**
+ * @brief Sets the durability policy of one variable, overriding the logger-wide policy.
+ * 
+ * @param handle Handle of the variable.
+ * @param durability The policy.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_set_durability(int handle, dlgr_durability_t durability);
+
+/**
+ * @brief Sets the logger-wide segment size and retention.
+ * 
+ * Applies to every variable that has not been given its own by dlgr_set_storage() or settings, including ones registered later. Defaults to DLGR_DEFAULT_STORAGE.
+ * 
+ * @param storage The segment size and retention limits.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_set_default_storage(dlgr_storage_t storage);
+
+/**
+ * @brief Sets the segment size and retention of one variable, overriding the logger-wide ones. Segments beyond the new limits are removed right away.
+ * 
+ * @param handle Handle of the variable.
+ * @param storage The segment size and retention limits.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_set_storage(int handle, dlgr_storage_t storage);
+
+/**
+ * @brief Loads segment sizes and retention from a settings file.
+ * 
+ * Each line holds "name segment_size max_bytes [max_segments [max_age_ms]]", where the name * sets the logger-wide defaults. Settings of variables not yet registered apply once they are.
+ * 
+ * @param fname The settings file, ie "settings.cfg".
+ * @return int Negative on failure, the number of settings applied on success.
+ */
+int dlgr_load_settings(const char* fname);
+
+/**
+ * @brief Forces any records of a handle not yet synced to storage.
+ * 
+ * Drains the asynchronous ring first, if running. The manifest is stored, and retention applied, if the background
+ * thread has not yet done so since the last rotation.
+ * 
+ * @param handle Handle of the variable to flush.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_flush(int handle);
+
+/**
+ * @brief Forces any records of all variables not yet synced to storage.
+ * 
+ * @return int Negative if any flush failed, 1 on success.
+ */
+int dlgr_flush_all(void);
+
+/**
+ * @brief Flushes and closes the open log segment of a handle.
+ * 
+ * The segment is reopened by the next write. Call this before handing a variable's files to another process.
+ * 
+ * @param handle Handle of the variable to close.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_close(int handle);
+
+/**
+ * @brief Closes the open log segments of all variables.
+ * 
+ * Stops asynchronous logging and flushes every variable first. Should be called before the process exits. Handles remain valid, and any later write reopens its segment.
+ * 
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_shutdown(void);
+
+/**
+ * @brief INTERNAL USE ONLY. Returns the number of bytes needed to store a number of read named-data of some previously defined (by dlgr_register()) size.
+ * 
+ * Primes the calling thread's next dlgr_perform_read(). Kept for compatibility, see dlgr_read_latest().
+ * 
+ * Failure modes include if var_name has not been previously registered.
+ * 
+ * @param var_name The name of the data to be read.
+ * @param number The number of these data chunks to be read.
+ * @return int Negative on failure, bytes required to store this data.
+ */
+int dlgr_prime_read(const char* var_name, int number);
+
+/**
+ * @brief INTERNAL USE ONLY. Same as dlgr_prime_read(), for a handle.
+ * 
+ * @param handle Handle of the variable to be read.
+ * @param number The number of these data chunks to be read.
+ * @return int Negative on failure, bytes required to store this data.
+ */
+int dlgr_prime_read_handle(int handle, int number);
+
+/**
+ * @brief INTERNAL USE ONLY. Reads data from logs and stores it.
+ * 
+ * Failure modes include if dlgr_prime_read() was not called immediately prior on the same thread. This is checked by seeing if number * primed_varname_size = primed_byte_size.
+ * 
+ * @param storage Where the read data will be stored. 
+ * @param number The number of data to be read (i.e. 'number'-many ints).
+ * @return int Negative on failure, positive on success.
+ */
+int dlgr_perform_read(void* storage, int number);
+
+/**
+ * @brief Reads the newest records of named data, newest first.
+ * 
+ * Keeps no state between calls, so it may be called concurrently from any number of threads and concurrently with writers. Records written during the call are not returned.
+ * 
+ * @param var_name The name of the data to be read.
+ * @param storage Where the read data will be stored, at least count * the registered size bytes.
+ * @param count The maximum number of records to read.
+ * @return int Negative on failure, number of records read on success (less than count if the history is shorter).
+ */
+int dlgr_read_latest(const char* var_name, void* storage, int count);
+
+/**
+ * @brief Same as dlgr_read_latest(), for a handle.
+ * 
+ * @param handle Handle of the variable to be read.
+ * @param storage Where the read data will be stored, at least count * the registered size bytes.
+ * @param count The maximum number of records to read.
+ * @return int Negative on failure, number of records read on success.
+ */
+int dlgr_read_latest_handle(int handle, void* storage, int count);
+
+/**
+ * @brief Reads the newest records of several variables as of one moment, newest first.
+ * 
+ * Every variable is locked while the segments holding its newest records are noted, so no write to any of them lands between one and the next; then the reads of all of them are made together, in parallel where the I/O backend can. Records written during the call are not returned.
+ * 
+ * @param var_names The names of the data to be read. A name may appear more than once.
+ * @param counts The maximum number of records to read of each.
+ * @param storages Where the read data of each will be stored, at least counts[i] * its registered size bytes.
+ * @param number_read Where the number of records read of each is stored (less than counts[i] if its history is shorter).
+ * @param num_vars Number of variables, at most DLGR_MAX_VARS.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_read_multi(const char* const* var_names, const int* counts, void* const* storages, int* number_read, int num_vars);
+
+/**
+ * @brief Same as dlgr_read_multi(), for handles.
+ * 
+ * @param handles Handles of the variables to be read.
+ * @param counts The maximum number of records to read of each.
+ * @param storages Where the read data of each will be stored, at least counts[i] * its registered size bytes.
+ * @param number_read Where the number of records read of each is stored.
+ * @param num_vars Number of variables, at most DLGR_MAX_VARS.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_read_multi_handle(const int* handles, const int* counts, void* const* storages, int* number_read, int num_vars);
+
+/**
+ * @brief Reads records of named data by sequence number, oldest first.
+ * 
+ * Every record of a variable gets the next sequence number when it is logged, counting from 0 at registration. The records are found from the manifest, with one positioned read per segment touched.
+ * 
+ * @param var_name The name of the data to be read.
+ * @param first_seq Sequence number of the first record to read.
+ * @param count The maximum number of records to read.
+ * @param storage Where the read data will be stored, at least count * the registered size bytes.
+ * @return int Negative on failure or if first_seq has been removed by retention, number of records read on success (less than count at the newest record).
+ */
+int dlgr_read_range(const char* var_name, long long first_seq, int count, void* storage);
+
+/**
+ * @brief Same as dlgr_read_range(), for a handle.
+ * 
+ * @param handle Handle of the variable to be read.
+ * @param first_seq Sequence number of the first record to read.
+ * @param count The maximum number of records to read.
+ * @param storage Where the read data will be stored, at least count * the registered size bytes.
+ * @return int Negative on failure, number of records read on success.
+ */
+int dlgr_read_range_handle(int handle, long long first_seq, int count, void* storage);
+
+/**
+ * @brief Gets the sequence numbers a handle can be read at with dlgr_read_range().
+ * 
+ * @param handle Handle of the variable.
+ * @param first_seq Where the sequence number of the oldest retained record is stored.
+ * @param next_seq Where the sequence number the next record will get is stored.
+ * @return int Negative on failure, 1 on success.
+ */
+int dlgr_get_seq_range(int handle, long long* first_seq, long long* next_seq);
+
+/**
+ * @brief INTERNAL USE ONLY. Returns the registered byte-size of a variable.
+ * 
+ * @param var_name Name of the variable whose registration to check.
+ * @param fname_buf_size Unused, kept for compatibility.
+ * @return int Negative on failure, variable size on success.
  */
 int dlgr_check_registration(const char* var_name, const int fname_buf_size);
 
@@ -12,19 +12,136 @@
 #ifndef DATALOGGER_EXTERN_H
 #define DATALOGGER_EXTERN_H
 
+#include <stddef.h>
+#include <stdatomic.h>
+
 // Note: varname should be formatted as modname_varname. dlgr_register(const char* var_name, void* var_data, int var_size);
 /**
- * @brief 
+ * @brief Registers varname and returns its handle (negative on failure).
  * 
  */
 #define DLGR_REGISTER(varname, varsize) dlgr_register(#varname, varsize)
 
+/**
+ * @brief Registers varname with options, ie DLGR_REGISTER_OPTS(acs_x, sizeof(acs_x), .timestamped = 1).
+ * 
+ */
+#define DLGR_REGISTER_OPTS(varname, varsize, ...) dlgr_register_opts(#varname, varsize, (dlgr_options_t){__VA_ARGS__})
+
+/**
+ * @brief Describes varname as a member of a frame, for DLGR_REGISTER_FRAME().
+ * 
+ */
+#define DLGR_FRAME_MEMBER(varname) ((dlgr_member_t){#varname, sizeof(varname)})
+
+/**
+ * @brief Describes field member of structtype, ie DLGR_STRUCT_FIELD(acs_state_t, rate, DLGR_TYPE_F32).
+ * 
+ */
+#define DLGR_STRUCT_FIELD(structtype, member, fieldtype) ((dlgr_field_t){#member, offsetof(structtype, member), sizeof(((structtype*) 0)->member), fieldtype})
+
+/**
+ * @brief Registers varname as a struct with fields, ie DLGR_REGISTER_STRUCT(acs_state, (dlgr_options_t){.columnar = 1}, DLGR_STRUCT_FIELD(...), ...).
+ * 
+ */
+#define DLGR_REGISTER_STRUCT(varname, options, ...) dlgr_register_struct(#varname, sizeof(varname), (dlgr_field_t[]){__VA_ARGS__}, sizeof((dlgr_field_t[]){__VA_ARGS__}) / sizeof(dlgr_field_t), options)
+
+/**
+ * @brief Registers a frame of members, ie DLGR_REGISTER_FRAME(acs_frame, DLGR_FRAME_MEMBER(acs_x), DLGR_FRAME_MEMBER(acs_y)).
+ * 
+ */
+#define DLGR_REGISTER_FRAME(framename, ...) dlgr_register_frame(#framename, (dlgr_member_t[]){__VA_ARGS__}, sizeof((dlgr_member_t[]){__VA_ARGS__}) / sizeof(dlgr_member_t), (dlgr_options_t){0})
+
+/**
+ * @brief Returns the handle of a previously registered varname (negative on failure).
+ * 
+ */
+#define DLGR_HANDLE(varname) dlgr_get_handle(#varname)
+
+// Looks up the handle of varname once per call site and caches it, so repeated calls never touch the filesystem for metadata.
+// Any thread may reach the call site; racing lookups find the same handle.
+#define DLGR_CACHED_HANDLE(varname) ({                                                      \
+    static _Atomic int dlgr_cached_handle = -1;                                              \
+    int dlgr_handle = atomic_load_explicit(&dlgr_cached_handle, memory_order_relaxed);       \
+    if (dlgr_handle < 0){                                                                    \
+        dlgr_handle = dlgr_get_handle(#varname);                                             \
+        atomic_store_explicit(&dlgr_cached_handle, dlgr_handle, memory_order_relaxed);       \
+    }                                                                                        \
+    dlgr_handle;                                                                             \
+})
+
 // #varname = "passed_varname", passed_varname_DATASIZE_LOGNUM == file to save log to 
 /**
- * @brief 
+ * @brief Writes varname to its log. The handle of varname is cached at the call site.
+ * 
+ */
+#define DLGR_WRITE(varname) dlgr_write_handle(DLGR_CACHED_HANDLE(varname), &varname)
+
+/**
+ * @brief Writes the first count elements of the array varname to its log, ie DLGR_WRITE_ARRAY(acs_samples, 256) with a registered size of sizeof(acs_samples[0]).
+ * 
+ */
+#define DLGR_WRITE_ARRAY(varname, count) dlgr_write_batch_handle(DLGR_CACHED_HANDLE(varname), varname, count)
+
+/**
+ * @brief Writes varname to its log with an explicit timestamp, see dlgr_time_now().
+ * 
+ */
+#define DLGR_WRITE_TIMED(varname, timestamp) ({ long long dlgr_timestamp = (timestamp); dlgr_write_timed_handle(DLGR_CACHED_HANDLE(varname), &varname, &dlgr_timestamp, 1); })
+
+/**
+ * @brief Writes one record of a frame from its members, ie DLGR_WRITE_FRAME(acs_frame, &acs_x, &acs_y).
+ * 
+ */
+#define DLGR_WRITE_FRAME(framename, ...) dlgr_write_frame(DLGR_CACHED_HANDLE(framename), (const void*[]){__VA_ARGS__})
+
+/**
+ * @brief Writes varname to the log of a handle returned by DLGR_REGISTER() or DLGR_HANDLE().
+ * 
+ */
+#define DLGR_WRITE_HANDLE(handle, varname) dlgr_write_handle(handle, &varname)
+
+/**
+ * @brief Sets the durability policy of varname, ie DLGR_SET_DURABILITY(acs_x, DLGR_SYNC_GROUP, 100, 50).
+ * 
+ */
+#define DLGR_SET_DURABILITY(varname, sync_mode, records, ms) dlgr_set_durability(DLGR_CACHED_HANDLE(varname), (dlgr_durability_t){sync_mode, records, ms})
+
+/**
+ * @brief Sets the segment size and retention of varname, ie DLGR_SET_STORAGE(acs_x, .segment_size = 0x1000, .max_segments = 8).
+ * 
+ */
+#define DLGR_SET_STORAGE(varname, ...) dlgr_set_storage(DLGR_CACHED_HANDLE(varname), (dlgr_storage_t){__VA_ARGS__})
+
+/**
+ * @brief Forces any records of varname not yet synced to storage.
+ * 
+ */
+#define DLGR_FLUSH(varname) dlgr_flush(DLGR_CACHED_HANDLE(varname))
+
+/**
+ * @brief Starts asynchronous logging with a ring of capacity slots of slot_size bytes, ie DLGR_ASYNC_START(1024, 64, DLGR_OVERFLOW_DROP_OLDEST).
  * 
  */
-#define DLGR_WRITE(varname) dlgr_write(#varname, &varname)
+#define DLGR_ASYNC_START(capacity, slot_size, overflow) dlgr_async_start((dlgr_async_config_t){capacity, slot_size, overflow})
+
+/**
+ * @brief Drains the ring and returns to synchronous logging.
+ * 
+ */
+#define DLGR_ASYNC_STOP() dlgr_async_stop()
+
+/**
+ * @brief Closes the open log segment of varname.
+ * 
+ */
+#define DLGR_CLOSE(varname) dlgr_close(dlgr_get_handle(#varname))
+
+/**
+ * @brief Closes the open log segments of all variables.
+ * 
+ */
+#define DLGR_SHUTDOWN() dlgr_shutdown()
 
 // Returns the number of bytes necessary to perform a read.
 // Stores the varname and number for later.
@@ -32,7 +149,13 @@
  * @brief 
  * 
  */
-#define DLGR_PRIME_READ(varname, number) dlgr_prime_read(#varname, number)
+#define DLGR_PRIME_READ(varname, number) dlgr_prime_read_handle(DLGR_CACHED_HANDLE(varname), number)
+
+/**
+ * @brief Same as DLGR_PRIME_READ(), for a handle returned by DLGR_REGISTER() or DLGR_HANDLE().
+ * 
+ */
+#define DLGR_PRIME_READ_HANDLE(handle, number) dlgr_prime_read_handle(handle, number)
 
 // Will return if DLGR_PRIME_READ wasnt called prior, because
 // it unsets the varname and number that was set using _PRIME_.
@@ -45,6 +168,72 @@
  */
 #define DLGR_PERFORM_READ(storageptr, bytes) dlgr_perform_read(storageptr, bytes)
 
+/**
+ * @brief Reads the newest count records of varname into storageptr, newest first. Returns the number of records read.
+ * 
+ */
+#define DLGR_READ_LATEST(varname, storageptr, count) dlgr_read_latest_handle(DLGR_CACHED_HANDLE(varname), storageptr, count)
+
+/**
+ * @brief Reads count records of varname into storageptr from sequence number first_seq on, oldest first. Returns the number of records read.
+ * 
+ */
+#define DLGR_READ_RANGE(varname, first_seq, storageptr, count) dlgr_read_range_handle(DLGR_CACHED_HANDLE(varname), first_seq, count, storageptr)
+
+/**
+ * @brief Reads up to max_count records of varname with timestamps within [t0, t1] into storageptr, oldest first. Returns the number of records read.
+ * 
+ */
+#define DLGR_READ_TIME_RANGE(varname, t0, t1, storageptr, max_count) dlgr_read_time_range(DLGR_CACHED_HANDLE(varname), t0, t1, storageptr, NULL, max_count)
+
+/**
+ * @brief Reads the timestamps of count records of varname from sequence number first_seq into storageptr, oldest first. Returns the number read.
+ * 
+ */
+#define DLGR_READ_TIMESTAMPS(varname, first_seq, storageptr, count) dlgr_read_timestamps(DLGR_CACHED_HANDLE(varname), first_seq, count, storageptr)
+
+/**
+ * @brief Reads the newest count values of member varname of a frame into storageptr, newest first. Returns the number of values read.
+ * 
+ */
+#define DLGR_READ_MEMBER(framename, varname, storageptr, count) dlgr_read_member(DLGR_CACHED_HANDLE(framename), #varname, storageptr, count)
+
+/**
+ * @brief Reads count values of field fieldname of varname from sequence number first_seq on into storageptr, oldest first. Returns the number of values read.
+ * 
+ */
+#define DLGR_READ_FIELD(varname, fieldname, first_seq, storageptr, count) dlgr_read_field_handle(DLGR_CACHED_HANDLE(varname), #fieldname, first_seq, count, storageptr)
+
+/**
+ * @brief Opens cursorptr over the history of varname from sequence number from_seq on, see dlgr_cursor_open(). Close with dlgr_cursor_close(cursorptr).
+ * 
+ */
+#define DLGR_CURSOR_OPEN(varname, from_seq, cursorptr) dlgr_cursor_open(DLGR_CACHED_HANDLE(varname), from_seq, cursorptr)
+
+/**
+ * @brief Aggregates count records of varname from sequence number first_seq on into resultptr, see dlgr_aggregate().
+ * 
+ */
+#define DLGR_AGGREGATE(varname, first_seq, count, resultptr) dlgr_aggregate(DLGR_CACHED_HANDLE(varname), first_seq, count, resultptr)
+
+/**
+ * @brief Aggregates the records of varname stamped t0 to t1 into resultptr, see dlgr_aggregate_time().
+ * 
+ */
+#define DLGR_AGGREGATE_TIME(varname, t0, t1, resultptr) dlgr_aggregate_time(DLGR_CACHED_HANDLE(varname), t0, t1, resultptr)
+
+/**
+ * @brief Maps the history of varname into viewptr, see dlgr_view_open(). Close with dlgr_view_close(viewptr).
+ * 
+ */
+#define DLGR_VIEW_OPEN(varname, viewptr) dlgr_view_open(DLGR_CACHED_HANDLE(varname), viewptr)
+
+/**
+ * @brief Reads the instrumentation counters of varname into statsptr, see dlgr_stats().
+ * 
+ */
+#define DLGR_STATS(varname, statsptr) dlgr_stats(DLGR_CACHED_HANDLE(varname), statsptr)
+
 /**
  * @brief Gets current log index for varname (not the number of logs, old ones may have been deleted).
  * 
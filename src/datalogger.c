@@ -9,485 +9,2860 @@
  * 
  */
 
+#define _GNU_SOURCE // fallocate(), memrchr()
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Example Directory (NEW)
+/* datalogger/
+ * settings.cfg         <-- Holds logging settings, see below.
+ * acs_VAR1.reg         <-- Holds the size and options of this variable.
+ * acs_VAR1.man         <-- Holds the manifest of live log segments of this variable, the last one current.
+ * acs_VAR1_0.log       <-- MODULE_VARIABLE_LOGNUMBER.dat
+ * acs_VAR1_1.log
+ * acs_VAR2.reg
+ * acs_VAR2.man
+ * acs_VAR2_0.log
+ * acs_STATE.reg
+ * acs_STATE.man
+ * acs_STATE.frm        <-- Layout of a frame or struct, see datalogger_frame.c.
+ * acs_STATE_0.c0       <-- A columnar variable stores each member in its own file, MODULE_VARIABLE_LOGNUMBER.cMEMBER
+ * acs_STATE_0.c1
+ * <Other Modules>
+ */
+
+// Manifest file format, one line per live segment, oldest first
+/* # var_index records bytes first_seq closed_ms first_ts last_ts
+ * 3 4096 16384 12288 1617800000000 1617799000000000000 1617799999000000000  <-- Closed: records, bytes on disk, first sequence
+ *                                                                               number, CLOCK_REALTIME ms closed, and the
+ *                                                                               timestamps of its first and last records.
+ * 4 17 68 16384 0 1617800000000000000 1617800016000000000                   <-- Current: as of the last store, measured again on load.
+ * Older manifests end each line at closed_ms; the timestamps are then read from the segments once, on load.
+ */
+
+// settings.cfg file format, loaded by dlgr_load_settings()
+/* # name segment_size max_bytes [max_segments [max_age_ms]]
+ * *     0x100000     0xC800000         <-- Logger-wide defaults.
+ * acs_x 0x1000       0x40000    8      <-- One variable.
+ */
+
+// char* moduleName is just a placeholder. Later, we will get the
+// module names from somewhere else.
+
+// Registry of variables known to this process, indexed by handle. Entries are never freed or moved, so a handle stays valid for the lifetime of the process.
+static dlgr_var_t* dlgr_vars[DLGR_MAX_VARS];
+static int dlgr_num_vars = 0;
+
+// Open-addressed hash table mapping variable names to (handle + 1), 0 marks an empty slot.
+static int dlgr_var_table[DLGR_VAR_TABLE_SIZE];
+
+// Durability policy of variables without their own.
+static dlgr_durability_t dlgr_default_durability = DLGR_DEFAULT_DURABILITY;
+
+// Segment size and retention of variables without their own.
+static dlgr_storage_t dlgr_default_storage = DLGR_DEFAULT_STORAGE;
+
+// Set by dlgr_open_read_only(): the log directory belongs to another process, and nothing in it is written.
+static int dlgr_read_only = 0;
+
+// Storage settings by variable name, kept for variables this process has not seen yet.
+typedef struct
+{
+    char var_name[MAX_VAR_NAME_SIZE];
+    dlgr_storage_t storage;
+} dlgr_setting_t;
+static dlgr_setting_t* dlgr_settings = NULL;
+static int dlgr_num_settings = 0;
+
+// Read primed by dlgr_prime_read() on this thread, consumed by dlgr_perform_read().
+static __thread struct
+{
+    int handle;
+    int number;
+    int required_bytes;
+} dlgr_primed_read = {-1, 0, 0};
+
+// Guards dlgr_vars, dlgr_num_vars, dlgr_var_table, the defaults, and dlgr_settings.
+static pthread_mutex_t dlgr_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int dlgr_hash(const char* var_name){
+    // djb2
+    unsigned int hash = 5381;
+    while(*var_name){
+        hash = (hash * 33) ^ (unsigned char) *var_name++;
+    }
+    return hash;
+}
+
+static long long dlgr_monotonic_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000LL) + (ts.tv_nsec / 1000000);
+}
+
+// Returns the handle of var_name, or -1 if it is not in the registry. Caller must hold dlgr_registry_lock.
+static int dlgr_find_handle(const char* var_name){
+    for(unsigned int slot = dlgr_hash(var_name) & (DLGR_VAR_TABLE_SIZE - 1); dlgr_var_table[slot] != 0; slot = (slot + 1) & (DLGR_VAR_TABLE_SIZE - 1)){
+        int handle = dlgr_var_table[slot] - 1;
+        if(strcmp(dlgr_vars[handle]->var_name, var_name) == 0){
+            return handle;
+        }
+    }
+    return -1;
+}
+
+// Allocates a registry entry for var_name, not yet in the registry. Caller must hold dlgr_registry_lock.
+static dlgr_var_t* dlgr_new_var(const char* var_name){
+    dlgr_var_t* var = calloc(1, sizeof(dlgr_var_t));
+    if(var == NULL){
+        eprintf("Could not allocate registry entry for %s.", var_name);
+        return NULL;
+    }
+    strncpy(var->var_name, var_name, MAX_VAR_NAME_SIZE - 1);
+    var->seg_fd = -1;
+    var->seg_dirfd = dlgr_log_dir_fd();
+    var->ts_fd = -1;
+    var->tsi_fd = -1;
+    var->spare_ts_fd = -1;
+    var->spare_tsi_fd = -1;
+    var->durability = dlgr_default_durability;
+    var->last_sync_ms = dlgr_monotonic_ms();
+    var->storage = dlgr_default_storage;
+    for(int i = 0; i < dlgr_num_settings; i++){
+        if(strcmp(dlgr_settings[i].var_name, var_name) == 0){
+            var->storage = dlgr_settings[i].storage;
+            var->storage_override = 1;
+            break;
+        }
+    }
+    pthread_mutex_init(&var->lock, NULL);
+    pthread_mutex_init(&var->manifest_lock, NULL);
+    pthread_cond_init(&var->spare_done, NULL);
+
+    return var;
+}
+
+// Frees an entry that never made it into the registry.
+static void dlgr_free_var(dlgr_var_t* var){
+    if(var != NULL){
+        pthread_mutex_destroy(&var->lock);
+        pthread_mutex_destroy(&var->manifest_lock);
+        pthread_cond_destroy(&var->spare_done);
+        free(var->members);
+        free(var->column_fds);
+        free(var->segments);
+        free(var);
+    }
+}
+
+// Adds var to the registry and returns its new handle. Caller must hold dlgr_registry_lock and have checked that var->var_name is not present.
+static int dlgr_insert_var(dlgr_var_t* var){
+    if(dlgr_num_vars >= DLGR_MAX_VARS){
+        eprintf("Registry full: cannot track more than %d variables.", DLGR_MAX_VARS);
+        return -1;
+    }
+
+    int handle = dlgr_num_vars++;
+    dlgr_vars[handle] = var;
+
+    unsigned int slot = dlgr_hash(var->var_name) & (DLGR_VAR_TABLE_SIZE - 1);
+    while(dlgr_var_table[slot] != 0){
+        slot = (slot + 1) & (DLGR_VAR_TABLE_SIZE - 1);
+    }
+    dlgr_var_table[slot] = handle + 1;
+
+    return handle;
+}
+
+FILE* dlgr_fopen_log(const char* fname, const char* mode){
+    const int flags = mode[0] == 'w' ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+    int fd = openat(dlgr_log_dir_fd(), fname, flags | O_CLOEXEC, 0644);
+    if(fd < 0){
+        return NULL;
+    }
+
+    FILE* f = fdopen(fd, mode);
+    if(f == NULL){
+        close(fd);
+    }
+    return f;
+}
+
+// Stats a segment file in the hot directory, or else in the log directory. Negative if it is in neither.
+static int dlgr_stat_file(const char* fname, struct stat* stbuf){
+    const int hot_fd = dlgr_hot_dir_fd();
+    if((hot_fd >= 0) && (fstatat(hot_fd, fname, stbuf, 0) == 0)){
+        return 1;
+    }
+    return fstatat(dlgr_log_dir_fd(), fname, stbuf, 0) == 0 ? 1 : -1;
+}
+
+// Removes a segment file from both directories. Negative if it was in neither.
+static int dlgr_remove_file(const char* fname){
+    const int hot_fd = dlgr_hot_dir_fd();
+    const int removed = (hot_fd >= 0) && (unlinkat(hot_fd, fname, 0) == 0);
+    return ((unlinkat(dlgr_log_dir_fd(), fname, 0) == 0) || removed) ? 1 : -1;
+}
+
+// Returns the directory of the current segment of var. New segments start in the hot directory; one already in the log directory, from a run without one, is finished there.
+static int dlgr_segment_dirfd(const dlgr_var_t* var){
+    const int hot_fd = dlgr_hot_dir_fd();
+    const int log_fd = dlgr_log_dir_fd();
+    if(hot_fd < 0){
+        return log_fd;
+    }
+
+    char fname_buf[MAX_FNAME_SIZE];
+    struct stat stbuf;
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.%s", var->var_name, var->var_index, var->columnar ? "c0" : "log");
+    if((fstatat(hot_fd, fname_buf, &stbuf, 0) != 0) && (fstatat(log_fd, fname_buf, &stbuf, 0) == 0)){
+        return log_fd;
+    }
+    return hot_fd;
+}
+
+// Checks if the current segment of var is written in the hot directory.
+static int dlgr_segment_hot(const dlgr_var_t* var){
+    const int hot_fd = dlgr_hot_dir_fd();
+    return (hot_fd >= 0) && (var->seg_dirfd == hot_fd);
+}
+
+// Returns the bytes of whole records written to log segment var_index of var, or 0 if it does not exist.
+static int dlgr_segment_size(const dlgr_var_t* var, int var_index){
+    char fname_buf[MAX_FNAME_SIZE];
+    struct stat stbuf;
+
+    if(!var->columnar){
+        snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.log", var->var_name, var_index);
+        if(dlgr_stat_file(fname_buf, &stbuf) < 0){
+            return 0;
+        }
+        return (stbuf.st_size / var->var_size) * var->var_size;
+    }
+
+    // A record is only whole once every column holds it.
+    int records = -1;
+    for(int i = 0; i < var->num_members; i++){
+        snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.c%d", var->var_name, var_index, i);
+        if(dlgr_stat_file(fname_buf, &stbuf) < 0){
+            return 0;
+        }
+        const int column_records = stbuf.st_size / var->members[i].size;
+        if((records < 0) || (column_records < records)){
+            records = column_records;
+        }
+    }
+    return records > 0 ? records * var->var_size : 0;
+}
+
+// Stats the records of a log segment as stored on disk, compressed or not. Negative if it does not exist.
+static int dlgr_stat_segment(const char* var_name, int var_index, struct stat* stbuf){
+    char fname_buf[MAX_FNAME_SIZE];
+
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.log", var_name, var_index);
+    if(dlgr_stat_file(fname_buf, stbuf) > 0){
+        return 1;
+    }
+
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.log.z", var_name, var_index);
+    return dlgr_stat_file(fname_buf, stbuf);
+}
+
+// Returns the bytes segment var_index of var takes up on disk, compressed or not, with all its columns. Negative if it does not exist.
+static long long dlgr_segment_stored_bytes(const dlgr_var_t* var, int var_index){
+    struct stat stbuf;
+    if(!var->columnar){
+        return dlgr_stat_segment(var->var_name, var_index, &stbuf) > 0 ? stbuf.st_size : -1;
+    }
+
+    char fname_buf[MAX_FNAME_SIZE];
+    long long bytes = -1;
+    for(int i = 0; i < var->num_members; i++){
+        snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.c%d", var->var_name, var_index, i);
+        if(dlgr_stat_file(fname_buf, &stbuf) < 0){
+            snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.c%d.z", var->var_name, var_index, i);
+            if(dlgr_stat_file(fname_buf, &stbuf) < 0){
+                continue;
+            }
+        }
+        bytes = (bytes < 0 ? 0 : bytes) + stbuf.st_size;
+    }
+    return bytes;
+}
+
+static long long dlgr_realtime_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (ts.tv_sec * 1000LL) + (ts.tv_nsec / 1000000);
+}
+
+// Appends a segment to the manifest of var, as its new current segment. Caller must hold var->lock.
+static int dlgr_push_segment(dlgr_var_t* var, int var_index, long long first_seq){
+    if(var->num_segments == var->segments_capacity){
+        const int new_capacity = var->segments_capacity ? var->segments_capacity * 2 : 8;
+        dlgr_segment_info_t* segments = realloc(var->segments, new_capacity * sizeof(dlgr_segment_info_t));
+        if(segments == NULL){
+            eprintf("Could not grow the manifest of %s.", var->var_name);
+            return -1;
+        }
+        var->segments = segments;
+        var->segments_capacity = new_capacity;
+    }
+
+    dlgr_segment_info_t* segment = &var->segments[var->num_segments++];
+    segment->var_index = var_index;
+    segment->records = 0;
+    segment->bytes = 0;
+    segment->first_seq = first_seq;
+    segment->closed_ms = 0;
+    segment->first_ts = 0;
+    segment->last_ts = 0;
+
+    return 1;
+}
+
+// Reads the timestamps of the first and last records of a segment of var into its manifest entry, if it has any.
+static void dlgr_segment_times(const dlgr_var_t* var, dlgr_segment_info_t* segment){
+    if(!var->timestamped || (segment->records <= 0)){
+        return;
+    }
+
+    int ts_fd = dlgr_open_segment_read(var, segment->var_index, "ts");
+    if(ts_fd < 0){
+        return;
+    }
+    if((pread(ts_fd, &segment->first_ts, sizeof(long long), 0) != sizeof(long long))
+        || (pread(ts_fd, &segment->last_ts, sizeof(long long), (off_t) (segment->records - 1) * sizeof(long long)) != sizeof(long long))){
+        eprintf("Could not read the timestamps of segment %d of %s.", segment->var_index, var->var_name);
+    }
+    close(ts_fd);
+}
+
+// Brings the manifest entry of the current segment up to date with the records written to it. Caller must hold var->lock.
+static void dlgr_update_head(dlgr_var_t* var){
+    dlgr_segment_info_t* head = &var->segments[var->num_segments - 1];
+    head->records = var->seg_fill / var->var_size;
+    head->bytes = var->seg_fill;
+}
+
+// Atomically replaces the .man file of var with copy gen of its manifest, unless a later copy is stored already.
+static int dlgr_write_manifest(dlgr_var_t* var, const dlgr_segment_info_t* segments, int num_segments, int sync, unsigned long long gen){
+    if(dlgr_read_only){
+        eprintf("Log directory is open read-only, manifest of %s not stored.", var->var_name);
+        return -1;
+    }
+
+    pthread_mutex_lock(&var->manifest_lock);
+    if(gen <= var->manifest_stored_gen){
+        pthread_mutex_unlock(&var->manifest_lock);
+        return 1;
+    }
+
+    char fname_buf[MAX_FNAME_SIZE], tmp_buf[MAX_FNAME_SIZE];
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s.man", var->var_name);
+    snprintf(tmp_buf, MAX_FNAME_SIZE, "%s.man.tmp", var->var_name);
+
+    FILE* manifest_f = dlgr_fopen_log(tmp_buf, "w");
+    if(manifest_f == NULL){
+        eprintf("Could not open %s for writing.", tmp_buf);
+        DLGR_COUNT(var, errors[DLGR_ERROR_MANIFEST], 1);
+        pthread_mutex_unlock(&var->manifest_lock);
+        return -1;
+    }
+
+    int retval = 1;
+    for(int i = 0; (i < num_segments) && (retval > 0); i++){
+        const dlgr_segment_info_t* segment = &segments[i];
+        retval = fprintf(manifest_f, "%d %d %lld %lld %lld %lld %lld\n", segment->var_index, segment->records, segment->bytes, segment->first_seq, segment->closed_ms, segment->first_ts, segment->last_ts);
+    }
+    if((retval > 0) && (fflush(manifest_f) != 0)){
+        retval = -1;
+    }
+    if((retval > 0) && sync && (fdatasync(fileno(manifest_f)) != 0)){
+        retval = -1;
+    }
+    fclose(manifest_f);
+
+    const int log_fd = dlgr_log_dir_fd();
+    if((retval <= 0) || (renameat(log_fd, tmp_buf, log_fd, fname_buf) != 0)){
+        eprintf("Writing manifest %s failed.", fname_buf);
+        DLGR_COUNT(var, errors[DLGR_ERROR_MANIFEST], 1);
+        unlinkat(log_fd, tmp_buf, 0);
+        pthread_mutex_unlock(&var->manifest_lock);
+        return -1;
+    }
+    var->manifest_stored_gen = gen;
+
+    // The rename is only durable once the directory is.
+    if(sync && (fsync(log_fd) != 0)){
+        eprintf("Could not sync the log directory after writing manifest %s.", fname_buf);
+        DLGR_COUNT(var, errors[DLGR_ERROR_MANIFEST], 1);
+        retval = -1;
+    }
+    pthread_mutex_unlock(&var->manifest_lock);
+
+    return retval;
+}
+
+// Atomically replaces the .man file of var with its manifest. Caller must hold var->lock.
+static int dlgr_store_manifest(dlgr_var_t* var){
+    dlgr_update_head(var);
+    var->manifest_dirty = 0;
+    return dlgr_write_manifest(var, var->segments, var->num_segments, var->durability.mode != DLGR_SYNC_NONE, ++var->manifest_gen);
+}
+
+// Same as dlgr_store_manifest(), from a copy of the manifest, so var->lock is not held while it is written and synced.
+static int dlgr_persist_manifest(dlgr_var_t* var){
+    pthread_mutex_lock(&var->lock);
+    dlgr_update_head(var);
+    var->manifest_dirty = 0;
+    const int num_segments = var->num_segments;
+    const int sync = var->durability.mode != DLGR_SYNC_NONE;
+    const unsigned long long gen = ++var->manifest_gen;
+    dlgr_segment_info_t* segments = malloc(num_segments * sizeof(dlgr_segment_info_t));
+    if(segments != NULL){
+        memcpy(segments, var->segments, num_segments * sizeof(dlgr_segment_info_t));
+    }
+    pthread_mutex_unlock(&var->lock);
+
+    if(segments == NULL){
+        eprintf("Could not copy the manifest of %s.", var->var_name);
+        DLGR_COUNT(var, errors[DLGR_ERROR_MANIFEST], 1);
+        return -1;
+    }
+    const int retval = dlgr_write_manifest(var, segments, num_segments, sync, gen);
+    free(segments);
+    return retval;
+}
+
+// Loads the manifest of var from its .man file, or builds it from an older .idx file and the segments on disk.
+static int dlgr_load_manifest(dlgr_var_t* var){
+    char fname_buf[MAX_FNAME_SIZE];
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s.man", var->var_name);
+
+    var->num_segments = 0;
+    FILE* manifest_f = dlgr_fopen_log(fname_buf, "r");
+    if(manifest_f != NULL){
+        dlgr_segment_info_t segment;
+        char line[256];
+        while(fgets(line, sizeof(line), manifest_f) != NULL){
+            const int fields = sscanf(line, "%d %d %lld %lld %lld %lld %lld", &segment.var_index, &segment.records, &segment.bytes, &segment.first_seq, &segment.closed_ms, &segment.first_ts, &segment.last_ts);
+            if(fields == EOF){
+                continue;
+            }
+            if(((fields != 5) && (fields != 7)) || (segment.var_index < 0) || (segment.records < 0) || (segment.first_seq < 0)
+                || ((var->num_segments > 0) && (segment.var_index <= var->segments[var->num_segments - 1].var_index))){
+                eprintf("Manifest %s is corrupt at line %d.", fname_buf, var->num_segments + 1);
+                fclose(manifest_f);
+                return -1;
+            }
+            if(dlgr_push_segment(var, segment.var_index, segment.first_seq) < 0){
+                fclose(manifest_f);
+                return -1;
+            }
+            // Older manifests don't hold timestamps, read them from the segment once.
+            if(fields == 5){
+                segment.first_ts = segment.last_ts = 0;
+                dlgr_segment_times(var, &segment);
+            }
+            var->segments[var->num_segments - 1] = segment;
+        }
+        fclose(manifest_f);
+
+        if(var->num_segments == 0){
+            eprintf("Manifest %s is empty.", fname_buf);
+            return -1;
+        }
+
+        // A rotation leaves storing the manifest to the background thread, so segments written since it was last
+        // stored may follow the last one it lists. The one after a segment is opened ahead empty, and starts no records.
+        int recovered = 0;
+        for(;;){
+            dlgr_segment_info_t* head = &var->segments[var->num_segments - 1];
+            if(dlgr_segment_size(var, head->var_index + 1) <= 0){
+                break;
+            }
+            struct stat stbuf;
+            head->records = dlgr_segment_size(var, head->var_index) / var->var_size;
+            head->bytes = (long long) head->records * var->var_size;
+            head->closed_ms = dlgr_stat_segment(var->var_name, head->var_index, &stbuf) > 0 ? (stbuf.st_mtim.tv_sec * 1000LL) + (stbuf.st_mtim.tv_nsec / 1000000) : dlgr_realtime_ms();
+            dlgr_segment_times(var, head);
+            if(dlgr_push_segment(var, head->var_index + 1, head->first_seq + head->records) < 0){
+                return -1;
+            }
+            recovered = 1;
+        }
+        var->var_index = var->segments[var->num_segments - 1].var_index;
+
+        if(recovered){
+            eprintf("Manifest %s was behind its segments, recovered up to segment %d.", fname_buf, var->var_index);
+            var->seg_fill = dlgr_segment_size(var, var->var_index);
+            return dlgr_read_only ? 1 : dlgr_store_manifest(var);
+        }
+        return 1;
+    }
+
+    // No manifest yet: the current log index is in the index file.
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s.idx", var->var_name);
+    FILE* var_index_f = dlgr_fopen_log(fname_buf, "r");
+    if(var_index_f == NULL){
+        eprintf("Could not open %s for reading.", fname_buf);
+        return -1;
+    }
+
+    var->var_index = 0;
+    fscanf(var_index_f, "%d", &var->var_index);
+    fclose(var_index_f);
+    if(var->var_index < 0){
+        eprintf("Failed: log index invalid (%d).", var->var_index);
+        return -1;
+    }
+
+    // Find the live segments once, and count their records.
+    struct stat stbuf;
+    int oldest = var->var_index;
+    while((oldest > 0) && (dlgr_stat_segment(var->var_name, oldest - 1, &stbuf) > 0)){
+        oldest--;
+    }
+
+    long long next_seq = 0;
+    for(int var_index = oldest; var_index <= var->var_index; var_index++){
+        if(dlgr_push_segment(var, var_index, next_seq) < 0){
+            return -1;
+        }
+        if(var_index == var->var_index){
+            break;
+        }
+
+        dlgr_segment_info_t* segment = &var->segments[var->num_segments - 1];
+        int fd = dlgr_open_segment_read(var, var_index, "log");
+        if((fd >= 0) && (fstat(fd, &stbuf) == 0)){
+            segment->records = stbuf.st_size / var->var_size;
+        }
+        if(fd >= 0){
+            close(fd);
+        }
+        if(dlgr_stat_segment(var->var_name, var_index, &stbuf) > 0){
+            segment->bytes = stbuf.st_size;
+            segment->closed_ms = (stbuf.st_mtim.tv_sec * 1000LL) + (stbuf.st_mtim.tv_nsec / 1000000);
+        }
+        dlgr_segment_times(var, segment);
+        next_seq += segment->records;
+    }
+
+    // From now on the manifest is the only file read; a reader keeps it in memory.
+    return dlgr_read_only ? 1 : dlgr_store_manifest(var);
+}
+
+// Loads the persistent state of var->var_name from its .reg, .man, and current log segment.
+static int dlgr_load_var(dlgr_var_t* var){
+    char fname_buf[MAX_FNAME_SIZE];
+
+    // Get the variable size from the registration file.
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s.reg", var->var_name);
+    FILE* var_registration_f = dlgr_fopen_log(fname_buf, "r");
+    if(var_registration_f == NULL){
+        eprintf("Failed: %s has not been registered.", var->var_name);
+        return -1;
+    }
+
+    // Options were added after the size, older registrations only hold the size.
+    var->var_size = 0;
+    var->timestamped = 0;
+    var->codec = DLGR_CODEC_NONE;
+    var->element_size = 0;
+    var->type = DLGR_TYPE_NONE;
+    fscanf(var_registration_f, "%d %d %d %d %d", &var->var_size, &var->timestamped, (int*) &var->codec, &var->element_size, (int*) &var->type);
+    fclose(var_registration_f);
+    if((var->var_size <= 0) || (var->var_size > MAX_VAR_SIZE)){
+        eprintf("Failed: var_size invalid (%d).", var->var_size);
+        return -1;
+    }
+
+    // Frames and structs also have a member layout, which says whether records are stored in columns.
+    if(dlgr_load_frame(var) < 0){
+        return -1;
+    }
+
+    // Columns are compressed by the size and type of their members instead.
+    if(var->columnar){
+        if(dlgr_codec_element_size(var->codec, sizeof(long long), 0) < 0){
+            return -1;
+        }
+        var->element_size = 0;
+    } else if((var->element_size = dlgr_codec_element_size(var->codec, var->var_size, var->element_size)) < 0){
+        return -1;
+    }
+    const int type_size = dlgr_type_size(var->type);
+    if((type_size < 0) || ((type_size > 0) && ((var->var_size % type_size) != 0))){
+        eprintf("Failed: type %d invalid for var_size %d.", var->type, var->var_size);
+        return -1;
+    }
+
+    // Get the live segments and the current log index from the manifest.
+    if(dlgr_load_manifest(var) < 0){
+        return -1;
+    }
+
+    // Measure the current log segment once; from here on its fill is tracked in memory.
+    var->seg_fill = dlgr_segment_size(var, var->var_index);
+    var->seg_dirfd = dlgr_segment_dirfd(var);
+    dlgr_update_head(var);
+    dlgr_segment_times(var, &var->segments[var->num_segments - 1]);
+
+    return 1;
+}
+
+static int dlgr_valid_durability(dlgr_durability_t durability){
+    if((durability.mode < DLGR_SYNC_NONE) || (durability.mode > DLGR_SYNC_ROTATE)){
+        eprintf("Durability mode %d invalid.", durability.mode);
+        return 0;
+    }
+
+    if((durability.group_records < 0) || (durability.group_ms < 0)){
+        eprintf("Durability group limits (%d records, %d ms) invalid.", durability.group_records, durability.group_ms);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Syncs the data of the open log segment of var if it has unsynced records. Caller must hold var->lock.
+static int dlgr_sync_segment(dlgr_var_t* var){
+    if((var->seg_fd < 0) || (var->unsynced == 0)){
+        return 1;
+    }
+
+    // Counted, or batched and counted once complete, by the I/O backend.
+    if(dlgr_io_sync(var) < 0){
+        eprintf("Could not sync log segment %d of %s.", var->var_index, var->var_name);
+        DLGR_COUNT(var, errors[DLGR_ERROR_SYNC], 1);
+        return -1;
+    }
+
+    var->unsynced = 0;
+    if(var->durability.mode == DLGR_SYNC_GROUP){
+        var->last_sync_ms = dlgr_monotonic_ms();
+    }
+
+    return 1;
+}
+
+// Syncs the open log segment of var if its durability policy calls for it after a write. Caller must hold var->lock.
+static int dlgr_sync_after_write(dlgr_var_t* var){
+    switch(var->durability.mode){
+        case DLGR_SYNC_EVERY:
+            return dlgr_sync_segment(var);
+        case DLGR_SYNC_GROUP:
+            if((var->durability.group_records > 0) && (var->unsynced >= var->durability.group_records)){
+                return dlgr_sync_segment(var);
+            }
+            if((var->durability.group_ms > 0) && ((dlgr_monotonic_ms() - var->last_sync_ms) >= var->durability.group_ms)){
+                return dlgr_sync_segment(var);
+            }
+            return 1;
+        default:
+            return 1;
+    }
+}
+
+// Syncs the time trigger of DLGR_SYNC_GROUP for variables that have stopped being written, which dlgr_sync_after_write()
+// never sees again. Started by the first policy with a group_ms, and runs for the life of the process.
+static pthread_mutex_t dlgr_group_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dlgr_group_work = PTHREAD_COND_INITIALIZER; // Signalled when a policy with a group_ms is set.
+static int dlgr_group_started = 0;
+
+static void* dlgr_group_main(void* arg){
+    (void) arg;
+
+    pthread_mutex_lock(&dlgr_group_lock);
+    for(;;){
+        pthread_mutex_unlock(&dlgr_group_lock);
+
+        pthread_mutex_lock(&dlgr_registry_lock);
+        const int num_vars = dlgr_num_vars;
+        pthread_mutex_unlock(&dlgr_registry_lock);
+
+        // Sync every variable that is due, and sleep until the next one may be. A record written while a variable
+        // is clean comes due no later than group_ms after the check, so that long is the most to sleep.
+        long long wait_ms = -1;
+        for(int handle = 0; handle < num_vars; handle++){
+            dlgr_var_t* var = dlgr_vars[handle];
+            pthread_mutex_lock(&var->lock);
+            if((var->durability.mode == DLGR_SYNC_GROUP) && (var->durability.group_ms > 0)){
+                long long until_due = var->durability.group_ms;
+                if((var->seg_fd >= 0) && (var->unsynced > 0)){
+                    until_due = (var->last_sync_ms + var->durability.group_ms) - dlgr_monotonic_ms();
+                    if(until_due <= 0){
+                        // A failed sync is counted, and retried once another group_ms has passed.
+                        dlgr_sync_segment(var);
+                        until_due = var->durability.group_ms;
+                    }
+                }
+                until_due = until_due > 0 ? until_due : 1;
+                wait_ms = ((wait_ms < 0) || (until_due < wait_ms)) ? until_due : wait_ms;
+            }
+            pthread_mutex_unlock(&var->lock);
+        }
+
+        pthread_mutex_lock(&dlgr_group_lock);
+        if(wait_ms < 0){
+            pthread_cond_wait(&dlgr_group_work, &dlgr_group_lock);
+            continue;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wait_ms / 1000;
+        deadline.tv_nsec += (wait_ms % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&dlgr_group_work, &dlgr_group_lock, &deadline);
+    }
+
+    return NULL;
+}
+
+// Starts the group sync thread if durability has a time trigger, or wakes it to pick the policy up.
+static int dlgr_group_sync_start(dlgr_durability_t durability){
+    if((durability.mode != DLGR_SYNC_GROUP) || (durability.group_ms == 0)){
+        return 1;
+    }
+
+    pthread_mutex_lock(&dlgr_group_lock);
+    if(!dlgr_group_started){
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, dlgr_group_main, NULL) != 0){
+            pthread_mutex_unlock(&dlgr_group_lock);
+            eprintf("Could not start the group sync thread.");
+            return -1;
+        }
+        pthread_detach(thread);
+        dlgr_group_started = 1;
+    }
+    pthread_cond_signal(&dlgr_group_work);
+    pthread_mutex_unlock(&dlgr_group_lock);
+
+    return 1;
+}
+
+// Makes the reads of records of several segments, at once where the I/O backend can, and closes their files. The tag of
+// each read is its segment, and its variable vars[owners[i]], or vars[0] if owners is NULL.
+static int dlgr_read_segments(dlgr_var_t* const* vars, const int* owners, dlgr_io_read_t* reads, int num_reads){
+    const int retval = dlgr_io_read(reads, num_reads);
+    for(int i = 0; i < num_reads; i++){
+        dlgr_var_t* var = vars[owners != NULL ? owners[i] : 0];
+        if(reads[i].result != (ssize_t) reads[i].bytes){
+            eprintf("Failed to read %zu records of segment %d of %s.", reads[i].bytes / var->var_size, reads[i].tag, var->var_name);
+            DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+        }
+        close(reads[i].fd);
+    }
+
+    return retval < 0 ? -1 : 1;
+}
+
+// Reverses the order of count records of var_size bytes in place.
+static void dlgr_reverse_records(unsigned char* records, int count, int var_size){
+    unsigned char tmp[0x100];
+    for(int lo = 0, hi = count - 1; lo < hi; lo++, hi--){
+        unsigned char* a = &records[(size_t) lo * var_size];
+        unsigned char* b = &records[(size_t) hi * var_size];
+        for(int done = 0; done < var_size; done += sizeof(tmp)){
+            const int chunk = (var_size - done) < (int) sizeof(tmp) ? (var_size - done) : (int) sizeof(tmp);
+            memcpy(tmp, &a[done], chunk);
+            memcpy(&a[done], &b[done], chunk);
+            memcpy(&b[done], tmp, chunk);
+        }
+    }
+}
+
+// Closes the open log segment of var, if any. Caller must hold var->lock.
+static void dlgr_close_segment(dlgr_var_t* var){
+    // Writes batched to its files land first.
+    dlgr_io_flush();
+
+    if(var->column_fds != NULL){
+        // seg_fd is the first column.
+        for(int i = 0; i < var->num_members; i++){
+            if(var->column_fds[i] >= 0){
+                close(var->column_fds[i]);
+            }
+        }
+        free(var->column_fds);
+        var->column_fds = NULL;
+        var->seg_fd = -1;
+    }
+    if(var->seg_fd >= 0){
+        close(var->seg_fd);
+        var->seg_fd = -1;
+    }
+    if(var->ts_fd >= 0){
+        close(var->ts_fd);
+        var->ts_fd = -1;
+    }
+    if(var->tsi_fd >= 0){
+        close(var->tsi_fd);
+        var->tsi_fd = -1;
+    }
+    var->unsynced = 0;
+}
+
+// Opens one file of log segment var_index of var for writing in dirfd, creating it if necessary.
+static int dlgr_open_segment_file(dlgr_var_t* var, int var_index, int dirfd, const char* ext){
+    char fname_buf[MAX_FNAME_SIZE];
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.%s", var->var_name, var_index, ext);
+
+    int fd = openat(dirfd, fname_buf, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0){
+        eprintf("Could not open %s.", fname_buf);
+        DLGR_COUNT(var, errors[DLGR_ERROR_OPEN], 1);
+    }
+
+    return fd;
+}
+
+// Bytes of records a log segment of var holds: as many whole records as fit in its segment size, but at least one.
+static int dlgr_segment_capacity(const dlgr_var_t* var){
+    const int records = (var->storage.segment_size > 0 ? var->storage.segment_size : MAX_FILE_SIZE) / var->var_size;
+    return (records < 1 ? 1 : records) * var->var_size;
+}
+
+// Cleared once the filesystem has refused to preallocate.
+static atomic_int dlgr_fallocate_supported = 1;
+
+// Opens every file of log segment var_index of var for writing in dirfd, creating them if necessary, and preallocates
+// them past the first records already written for capacity_records. *fds gets each column, or just the log; *ts_fd and
+// *tsi_fd are -1 unless var is timestamped.
+static int dlgr_open_segment_files(dlgr_var_t* var, int var_index, int dirfd, int records, int capacity_records, int** fds, int* ts_fd, int* tsi_fd){
+    // Reserve the whole segment up front so appends never allocate blocks, and it isn't fragmented.
+    // The file size stays at the records written, so readers and dlgr_load_var() see only real data.
+    const int num_fds = var->columnar ? var->num_members : 1;
+    *ts_fd = -1;
+    *tsi_fd = -1;
+    if((*fds = malloc(num_fds * sizeof(int))) == NULL){
+        eprintf("Could not allocate the files of segment %d of %s.", var_index, var->var_name);
+        return -1;
+    }
+
+    // A column holds the same records as the segment, at the size of its member.
+    char column_ext[0x10];
+    int opened = 0;
+    for(; opened < num_fds; opened++){
+        const char* ext = "log";
+        if(var->columnar){
+            snprintf(column_ext, sizeof(column_ext), "c%d", opened);
+            ext = column_ext;
+        }
+        const int fd = dlgr_open_segment_file(var, var_index, dirfd, ext);
+        if(fd < 0){
+            break;
+        }
+        (*fds)[opened] = fd;
+
+        const int size = var->columnar ? var->members[opened].size : var->var_size;
+        if(atomic_load_explicit(&dlgr_fallocate_supported, memory_order_relaxed) && (records < capacity_records)){
+            if((fallocate(fd, FALLOC_FL_KEEP_SIZE, (off_t) records * size, (off_t) (capacity_records - records) * size) != 0) && (errno == EOPNOTSUPP)){
+                atomic_store_explicit(&dlgr_fallocate_supported, 0, memory_order_relaxed);
+            }
+        }
+    }
+
+    if((opened == num_fds) && var->timestamped && ((*ts_fd = dlgr_open_segment_file(var, var_index, dirfd, "ts")) >= 0)){
+        *tsi_fd = dlgr_open_segment_file(var, var_index, dirfd, "tsi");
+    }
+    if((opened == num_fds) && (!var->timestamped || (*tsi_fd >= 0))){
+        return 1;
+    }
+
+    for(int i = 0; i < opened; i++){
+        close((*fds)[i]);
+    }
+    free(*fds);
+    *fds = NULL;
+    if(*ts_fd >= 0){
+        close(*ts_fd);
+        *ts_fd = -1;
+    }
+    return -1;
+}
+
+// Makes files from dlgr_open_segment_files() those of the current log segment of var. Caller must hold var->lock.
+static void dlgr_use_segment_files(dlgr_var_t* var, int* fds, int ts_fd, int tsi_fd){
+    // seg_fd is the first column.
+    var->seg_fd = fds[0];
+    if(var->columnar){
+        var->column_fds = fds;
+    } else {
+        free(fds);
+    }
+    var->ts_fd = ts_fd;
+    var->tsi_fd = tsi_fd;
+}
+
+// Opens the current log segment of var for writing at var->seg_fill, creating it if necessary, and preallocates its remaining capacity. Caller must hold var->lock.
+static int dlgr_open_segment(dlgr_var_t* var){
+    var->seg_dirfd = dlgr_segment_dirfd(var);
+
+    int* fds;
+    int ts_fd, tsi_fd;
+    if(dlgr_open_segment_files(var, var->var_index, var->seg_dirfd, var->seg_fill / var->var_size, dlgr_segment_capacity(var) / var->var_size, &fds, &ts_fd, &tsi_fd) < 0){
+        return -1;
+    }
+    dlgr_use_segment_files(var, fds, ts_fd, tsi_fd);
+
+    return 1;
+}
+
+// Removes every file of a log segment from both directories, including the columns of any layout it was written with.
+// Returns 1 if there were any, 0 if not.
+static int dlgr_remove_segment(const char* var_name, int var_index){
+    static const char* exts[] = {"log", "ts", "tsi", "log.z", "ts.z"};
+    char fname_buf[MAX_FNAME_SIZE];
+    int found = 0;
+    for(int i = 0; i < (int) (sizeof(exts) / sizeof(exts[0])); i++){
+        snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.%s", var_name, var_index, exts[i]);
+        found |= dlgr_remove_file(fname_buf) > 0;
+    }
+    for(int i = 0; ; i++){
+        snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.c%d", var_name, var_index, i);
+        const int removed = dlgr_remove_file(fname_buf) > 0;
+        snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.c%d.z", var_name, var_index, i);
+        if(!removed && (dlgr_remove_file(fname_buf) < 0)){
+            break;
+        }
+        found = 1;
+    }
+    return found;
+}
+
+// Closes the next segment of var opened ahead, if any, and removes its files. Caller must hold var->lock.
+static void dlgr_drop_spare(dlgr_var_t* var){
+    // The background thread may be opening one.
+    while(var->spare_busy){
+        pthread_cond_wait(&var->spare_done, &var->lock);
+    }
+    if(var->spare_fds == NULL){
+        return;
+    }
+
+    for(int i = 0; i < (var->columnar ? var->num_members : 1); i++){
+        close(var->spare_fds[i]);
+    }
+    free(var->spare_fds);
+    var->spare_fds = NULL;
+    if(var->spare_ts_fd >= 0){
+        close(var->spare_ts_fd);
+        close(var->spare_tsi_fd);
+    }
+    var->spare_ts_fd = -1;
+    var->spare_tsi_fd = -1;
+    dlgr_remove_segment(var->var_name, var->spare_index);
+}
+
+int dlgr_open_segment_read(const dlgr_var_t* var, int var_index, const char* ext){
+    if(var->columnar && (strcmp(ext, "log") == 0)){
+        return dlgr_open_columns(var, var_index, 0, -1);
+    }
+
+    char fname_buf[MAX_FNAME_SIZE];
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.%s", var->var_name, var_index, ext);
+
+    // The hot directory first: a segment moving out is put in place in the log directory before it is removed from the hot one.
+    const int hot_fd = dlgr_hot_dir_fd();
+    const int dirfds[2] = {hot_fd, dlgr_log_dir_fd()};
+    int fd = -1;
+    for(int i = (hot_fd >= 0) ? 0 : 1; (i < 2) && (fd < 0); i++){
+        fd = openat(dirfds[i], fname_buf, O_RDONLY | O_CLOEXEC);
+        if((fd < 0) && (errno == ENOENT)){
+            fd = dlgr_open_compressed(dirfds[i], fname_buf);
+        }
+    }
+
+    return fd;
+}
+
+int dlgr_open_segment_rows(const dlgr_var_t* var, int var_index, int first_record, int count){
+    return var->columnar ? dlgr_open_columns(var, var_index, first_record, count) : dlgr_open_segment_read(var, var_index, "log");
+}
+
+// A file of a segment to compress, and how.
+typedef struct
+{
+    char fname[MAX_FNAME_SIZE];
+    dlgr_codec_t codec;
+    int element_size;
+    int record_size;
+    int compressed;
+} dlgr_compress_job_t;
+
+// Checks if segment var_index of var is closed and still in its manifest. Caller must hold var->lock.
+static int dlgr_segment_closed(const dlgr_var_t* var, int var_index){
+    for(int i = 0; i < (var->num_segments - 1); i++){
+        if(var->segments[i].var_index == var_index){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int dlgr_compress_segment(dlgr_var_t* var, int var_index){
+    // Decide what to compress, and where the segment is, under the lock.
+    pthread_mutex_lock(&var->lock);
+    if((var->codec == DLGR_CODEC_NONE) || !dlgr_segment_closed(var, var_index)){
+        pthread_mutex_unlock(&var->lock);
+        return 0;
+    }
+    const int sync = var->durability.mode != DLGR_SYNC_NONE;
+    dlgr_compress_job_t* jobs = malloc((var->num_members + 2) * sizeof(dlgr_compress_job_t));
+    if(jobs == NULL){
+        pthread_mutex_unlock(&var->lock);
+        eprintf("Could not allocate the compression of segment %d of %s.", var_index, var->var_name);
+        DLGR_COUNT(var, errors[DLGR_ERROR_COMPRESS], 1);
+        return -1;
+    }
+    int num_jobs = 0;
+    if(!var->columnar){
+        jobs[num_jobs++] = (dlgr_compress_job_t){.codec = var->codec, .element_size = var->element_size, .record_size = var->var_size};
+        snprintf(jobs[num_jobs - 1].fname, MAX_FNAME_SIZE, "%s_%d.log", var->var_name, var_index);
+    }
+
+    // Each column is compressed on its own, by its type, or whole if it is a plain integer or float. Others stay raw.
+    for(int i = 0; var->columnar && (i < var->num_members); i++){
+        const int size = var->members[i].size;
+        int element_size = dlgr_type_size(var->members[i].type);
+        if(element_size <= 0){
+            element_size = size;
+        }
+        const int valid = (var->codec == DLGR_CODEC_XOR) ? ((element_size == 4) || (element_size == 8))
+                                                         : ((element_size == 1) || (element_size == 2) || (element_size == 4) || (element_size == 8));
+        if(!valid || ((size % element_size) != 0)){
+            continue;
+        }
+        jobs[num_jobs++] = (dlgr_compress_job_t){.codec = var->codec, .element_size = element_size, .record_size = size};
+        snprintf(jobs[num_jobs - 1].fname, MAX_FNAME_SIZE, "%s_%d.c%d", var->var_name, var_index, i);
+    }
+
+    // Timestamps are mostly evenly spaced, exactly what delta-of-delta is for.
+    if(var->timestamped){
+        jobs[num_jobs++] = (dlgr_compress_job_t){.codec = DLGR_CODEC_DELTA, .element_size = sizeof(long long), .record_size = sizeof(long long)};
+        snprintf(jobs[num_jobs - 1].fname, MAX_FNAME_SIZE, "%s_%d.ts", var->var_name, var_index);
+    }
+
+    // Closed segments are compressed before they move, so the files are in the hot directory if there is one.
+    struct stat stbuf;
+    const int hot_fd = dlgr_hot_dir_fd();
+    const int dirfd = ((num_jobs > 0) && (hot_fd >= 0) && (fstatat(hot_fd, jobs[0].fname, &stbuf, 0) == 0)) ? hot_fd : dlgr_log_dir_fd();
+    pthread_mutex_unlock(&var->lock);
+
+    // Encode without the lock; the files of a closed segment don't change.
+    int retval = 0;
+    for(int i = 0; (i < num_jobs) && (retval >= 0); i++){
+        jobs[i].compressed = dlgr_compress_file(dirfd, jobs[i].fname, jobs[i].codec, jobs[i].element_size, jobs[i].record_size, sync);
+        retval = jobs[i].compressed < 0 ? -1 : retval;
+    }
+
+    // Put the compressed files in place only while the segment is still live, and none if any failed to encode.
+    pthread_mutex_lock(&var->lock);
+    const int live = dlgr_segment_closed(var, var_index);
+    int published = 0;
+    for(int i = 0; i < num_jobs; i++){
+        if(jobs[i].compressed <= 0){
+            continue;
+        }
+        if(!live || (retval < 0)){
+            char tmp_buf[MAX_FNAME_SIZE + 6];
+            snprintf(tmp_buf, sizeof(tmp_buf), "%s.z.tmp", jobs[i].fname);
+            unlinkat(dirfd, tmp_buf, 0);
+        } else if(dlgr_publish_compressed(dirfd, jobs[i].fname, sync) > 0){
+            published = 1;
+        } else {
+            retval = -1;
+        }
+    }
+    if(published){
+        for(int i = 0; i < (var->num_segments - 1); i++){
+            if(var->segments[i].var_index == var_index){
+                const long long bytes = dlgr_segment_stored_bytes(var, var_index);
+                var->segments[i].bytes = bytes >= 0 ? bytes : var->segments[i].bytes;
+                break;
+            }
+        }
+        dlgr_store_manifest(var);
+    }
+    if(retval < 0){
+        eprintf("Could not compress segment %d of %s.", var_index, var->var_name);
+        DLGR_COUNT(var, errors[DLGR_ERROR_COMPRESS], 1);
+    }
+    pthread_mutex_unlock(&var->lock);
+
+    free(jobs);
+    return retval < 0 ? -1 : published;
+}
+
+// Takes the oldest closed segments of var that are beyond its retention limits out of its manifest, in memory, and
+// returns how many, copied to *removed for dlgr_remove_retained(). Caller must hold var->lock.
+static int dlgr_retain_select(dlgr_var_t* var, dlgr_segment_info_t** removed){
+    const dlgr_storage_t storage = var->storage;
+    if((storage.max_bytes <= 0) && (storage.max_segments <= 0) && (storage.max_age_ms <= 0)){
+        return 0;
+    }
+
+    // Walk back from the newest closed segment to the first one over a limit. Compressed segments count at their stored size.
+    const long long now_ms = dlgr_realtime_ms();
+    long long total_bytes = dlgr_segment_capacity(var);
+    int kept = 1;
+    int last_removed = var->num_segments - 2;
+    for(; last_removed >= 0; last_removed--){
+        const dlgr_segment_info_t* segment = &var->segments[last_removed];
+        total_bytes += segment->bytes;
+        kept++;
+        if(((storage.max_bytes > 0) && (total_bytes > storage.max_bytes))
+            || ((storage.max_segments > 0) && (kept > storage.max_segments))
+            || ((storage.max_age_ms > 0) && ((now_ms - segment->closed_ms) > storage.max_age_ms))){
+            break;
+        }
+    }
+    if(last_removed < 0){
+        return 0;
+    }
+
+    // Everything from there back goes.
+    const int number_removed = last_removed + 1;
+    if((*removed = malloc(number_removed * sizeof(dlgr_segment_info_t))) == NULL){
+        eprintf("Could not allocate retention of %s.", var->var_name);
+        return 0;
+    }
+    memcpy(*removed, var->segments, number_removed * sizeof(dlgr_segment_info_t));
+    memmove(var->segments, &var->segments[number_removed], (var->num_segments - number_removed) * sizeof(dlgr_segment_info_t));
+    var->num_segments -= number_removed;
+
+    return number_removed;
+}
+
+// Removes the files of segments dlgr_retain_select() took out of the manifest of var, once stored is set, and frees removed.
+// The manifest is stored first, so a crash can leave unlisted files behind but never lists missing ones.
+static void dlgr_remove_retained(dlgr_var_t* var, dlgr_segment_info_t* removed, int number_removed, int stored){
+    if(stored > 0){
+        for(int i = 0; i < number_removed; i++){
+            dlgr_remove_segment(var->var_name, removed[i].var_index);
+        }
+        DLGR_COUNT(var, retention_deletions, number_removed);
+    }
+    free(removed);
+}
+
+// Removes the oldest closed segments of var that are beyond its retention limits. Caller must hold var->lock.
+static void dlgr_retain(dlgr_var_t* var){
+    dlgr_segment_info_t* removed;
+    const int number_removed = dlgr_retain_select(var, &removed);
+    if(number_removed > 0){
+        dlgr_remove_retained(var, removed, number_removed, dlgr_store_manifest(var));
+    }
+}
+
+long long dlgr_time_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+// Writes the timestamps of count records starting at record first_record of the current segment, and the sparse time index entries among them. Caller must hold var->lock.
+static int dlgr_append_timestamps(dlgr_var_t* var, int first_record, const long long* timestamps, long long now, int count){
+    long long ts_buf[DLGR_TIME_INDEX_STRIDE];
+    dlgr_time_index_entry_t index_buf[DLGR_TIME_INDEX_STRIDE];
+
+    for(int done = 0; done < count; ){
+        const int chunk = (count - done) < DLGR_TIME_INDEX_STRIDE ? (count - done) : DLGR_TIME_INDEX_STRIDE;
+        const long long* chunk_ts = &timestamps[done];
+        if(timestamps == NULL){
+            for(int i = 0; i < chunk; i++){
+                ts_buf[i] = now;
+            }
+            chunk_ts = ts_buf;
+        }
+
+        if(dlgr_io_pwrite(var, first_record + done, var->ts_fd, chunk_ts, chunk * sizeof(long long), (off_t) (first_record + done) * sizeof(long long)) != (ssize_t) (chunk * sizeof(long long))){
+            eprintf("Failed to write timestamps to segment %d of %s.", var->var_index, var->var_name);
+            DLGR_COUNT(var, errors[DLGR_ERROR_WRITE], 1);
+            return -1;
+        }
+
+        // Index every DLGR_TIME_INDEX_STRIDE-th record of the segment.
+        int number_indexed = 0;
+        for(int i = 0; i < chunk; i++){
+            const int record = first_record + done + i;
+            if((record % DLGR_TIME_INDEX_STRIDE) == 0){
+                index_buf[number_indexed].timestamp = chunk_ts[i];
+                index_buf[number_indexed].record = record;
+                index_buf[number_indexed].reserved = 0;
+                number_indexed++;
+            }
+        }
+        if(number_indexed > 0){
+            const off_t offset = (off_t) (index_buf[0].record / DLGR_TIME_INDEX_STRIDE) * sizeof(dlgr_time_index_entry_t);
+            if(dlgr_io_pwrite(var, first_record + done, var->tsi_fd, index_buf, number_indexed * sizeof(dlgr_time_index_entry_t), offset) != (ssize_t) (number_indexed * sizeof(dlgr_time_index_entry_t))){
+                eprintf("Failed to write time index of segment %d of %s.", var->var_index, var->var_name);
+                DLGR_COUNT(var, errors[DLGR_ERROR_WRITE], 1);
+                return -1;
+            }
+        }
+
+        done += chunk;
+    }
+
+    return 1;
+}
+
+// Applies the retention limits of var and stores its manifest now, if a rotation left that to the background thread.
+// Caller must hold var->lock.
+static int dlgr_settle_manifest(dlgr_var_t* var){
+    if(!var->manifest_dirty){
+        return 1;
+    }
+    dlgr_retain(var);
+    return var->manifest_dirty ? dlgr_store_manifest(var) : 1;
+}
+
+// Switches var to the next log segment, normally opened and preallocated ahead by the background thread, which also
+// stores the new manifest and applies retention after. Caller must hold var->lock.
+static int dlgr_rotate(dlgr_var_t* var){
+    // Make the outgoing segment durable before leaving it.
+    if((var->durability.mode != DLGR_SYNC_NONE) && (dlgr_sync_segment(var) < 0)){
+        return -1;
+    }
+    dlgr_close_segment(var);
+
+    dlgr_segment_info_t* head = &var->segments[var->num_segments - 1];
+    dlgr_update_head(var);
+    head->closed_ms = dlgr_realtime_ms();
+
+    const int closed_index = var->var_index;
+    const int closed_hot = dlgr_segment_hot(var);
+    DLGR_COUNT(var, rotations, 1);
+
+    if(dlgr_push_segment(var, var->var_index + 1, head->first_seq + head->records) < 0){
+        return -1;
+    }
+    var->var_index++;
+    var->seg_fill = 0;
+    var->manifest_dirty = 1;
+
+    // Switch to the segment opened ahead, or open it now if the background thread hasn't kept up.
+    while(var->spare_busy){
+        pthread_cond_wait(&var->spare_done, &var->lock);
+    }
+    if((var->spare_fds != NULL) && (var->spare_index == var->var_index)){
+        var->seg_dirfd = var->spare_dirfd;
+        dlgr_use_segment_files(var, var->spare_fds, var->spare_ts_fd, var->spare_tsi_fd);
+        var->spare_fds = NULL;
+        var->spare_ts_fd = -1;
+        var->spare_tsi_fd = -1;
+    } else {
+        dlgr_drop_spare(var);
+        // Files a previous run left under the next index are not in the manifest, so none of their records are this variable's.
+        dlgr_remove_segment(var->var_name, var->var_index);
+        if(dlgr_open_segment(var) < 0){
+            return -1;
+        }
+    }
+
+    // The rest is left to the background thread, the new segment first: the manifest, retention, and the next segment.
+    // Then the closed one is compressed, and moved out of the hot directory, so the next write doesn't wait on either.
+    dlgr_prepare(var, var->var_index);
+    if((var->codec != DLGR_CODEC_NONE) || closed_hot){
+        dlgr_migrate(var, closed_index);
+    }
+
+    return 1;
+}
+
+int dlgr_prepare_segment(dlgr_var_t* var, int var_index){
+    pthread_mutex_lock(&var->lock);
+    if(var->var_index != var_index){
+        pthread_mutex_unlock(&var->lock);
+        return 0;
+    }
+    const int rotated = var->manifest_dirty;
+    const int closed_index = var->num_segments > 1 ? var->segments[var->num_segments - 2].var_index : -1;
+    dlgr_segment_info_t* removed = NULL;
+    const int number_removed = rotated ? dlgr_retain_select(var, &removed) : 0;
+    pthread_mutex_unlock(&var->lock);
+
+    int retval = 1;
+    if(rotated){
+        // A columnar segment takes up the sum of its columns; the files of a closed segment don't change.
+        if(var->columnar && (closed_index >= 0)){
+            const long long bytes = dlgr_segment_stored_bytes(var, closed_index);
+            pthread_mutex_lock(&var->lock);
+            for(int i = 0; (bytes >= 0) && (i < (var->num_segments - 1)); i++){
+                if(var->segments[i].var_index == closed_index){
+                    var->segments[i].bytes = bytes;
+                    break;
+                }
+            }
+            pthread_mutex_unlock(&var->lock);
+        }
+        retval = dlgr_persist_manifest(var);
+        if(number_removed > 0){
+            dlgr_remove_retained(var, removed, number_removed, retval);
+        }
+    }
+
+    // Open the next segment unless it already is.
+    pthread_mutex_lock(&var->lock);
+    if((var->var_index != var_index) || (var->seg_fd < 0) || var->spare_busy || ((var->spare_fds != NULL) && (var->spare_index == (var_index + 1)))){
+        pthread_mutex_unlock(&var->lock);
+        return retval;
+    }
+    dlgr_drop_spare(var);
+    var->spare_busy = 1;
+    const int capacity_records = dlgr_segment_capacity(var) / var->var_size;
+    const int sync = var->durability.mode != DLGR_SYNC_NONE;
+    pthread_mutex_unlock(&var->lock);
+
+    // Files a previous run left under the next index are not in the manifest, so none of their records are this
+    // variable's. New segments start in the hot directory if there is one.
+    dlgr_remove_segment(var->var_name, var_index + 1);
+    const int hot_fd = dlgr_hot_dir_fd();
+    const int dirfd = hot_fd >= 0 ? hot_fd : dlgr_log_dir_fd();
+    int* fds;
+    int ts_fd, tsi_fd;
+    const int opened = dlgr_open_segment_files(var, var_index + 1, dirfd, 0, capacity_records, &fds, &ts_fd, &tsi_fd);
+    // Records synced to it are only durable once its directory entries are.
+    if((opened > 0) && sync && (fsync(dirfd) != 0)){
+        eprintf("Could not sync the directory of segment %d of %s.", var_index + 1, var->var_name);
+        DLGR_COUNT(var, errors[DLGR_ERROR_SYNC], 1);
+    }
+
+    pthread_mutex_lock(&var->lock);
+    var->spare_busy = 0;
+    pthread_cond_broadcast(&var->spare_done);
+    if(opened > 0){
+        var->spare_fds = fds;
+        var->spare_ts_fd = ts_fd;
+        var->spare_tsi_fd = tsi_fd;
+        var->spare_index = var_index + 1;
+        var->spare_dirfd = dirfd;
+        // Closed meanwhile, so nothing will rotate into it.
+        if(var->seg_fd < 0){
+            dlgr_drop_spare(var);
+        }
+    } else {
+        retval = -1;
+    }
+    pthread_mutex_unlock(&var->lock);
+
+    return retval;
+}
+
+// Removes every segment of the registration of var_name on disk, as listed by its manifest or, before there was one,
+// up to the current segment of its index file, and any written after the manifest was last stored.
+static void dlgr_remove_old_segments(const char* var_name){
+    // Queued moves must not put a removed segment back.
+    dlgr_migrate_flush();
+
+    char fname_buf[MAX_FNAME_SIZE];
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s.man", var_name);
+    FILE* manifest_f = dlgr_fopen_log(fname_buf, "r");
+    if(manifest_f != NULL){
+        char line[256];
+        int last = -1;
+        while(fgets(line, sizeof(line), manifest_f) != NULL){
+            int var_index;
+            if((sscanf(line, "%d", &var_index) == 1) && (var_index >= 0)){
+                dlgr_remove_segment(var_name, var_index);
+                last = var_index;
+            }
+        }
+        fclose(manifest_f);
+        while((last >= 0) && (dlgr_remove_segment(var_name, ++last) > 0));
+        return;
+    }
+
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s.idx", var_name);
+    FILE* var_index_f = dlgr_fopen_log(fname_buf, "r");
+    if(var_index_f != NULL){
+        int var_index = -1;
+        fscanf(var_index_f, "%d", &var_index);
+        fclose(var_index_f);
+        for(; var_index >= 0; var_index--){
+            dlgr_remove_segment(var_name, var_index);
+        }
+    }
+}
+
+int dlgr_register(const char* var_name, int var_size){
+    return dlgr_register_opts(var_name, var_size, (dlgr_options_t){0});
+}
+
+int dlgr_register_opts(const char* var_name, int var_size, dlgr_options_t options){
+    // Columns need a layout to split records by.
+    if (options.columnar){
+        eprintf("%s needs a layout to be columnar, see dlgr_register_struct().", var_name ? var_name : "(null)");
+        return -1;
+    }
+
+    // Registering again at boot keeps the history.
+    int handle = dlgr_find_registration(var_name, var_size, options);
+    if (handle >= 0){
+        return handle;
+    }
+
+    return dlgr_register_columns(var_name, var_size, options);
+}
+
+int dlgr_find_registration(const char* var_name, int var_size, dlgr_options_t options){
+    if (var_name == NULL){
+        return -1;
+    }
+
+    // Only look for registrations on disk, quietly.
+    char fname_buf[MAX_FNAME_SIZE];
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s.reg", var_name);
+    if ((strlen(var_name) >= MAX_VAR_NAME_SIZE) || (faccessat(dlgr_log_dir_fd(), fname_buf, F_OK, 0) != 0)){
+        return -1;
+    }
+
+    int handle = dlgr_get_handle(var_name);
+    if (handle < 0){
+        return -1;
+    }
+
+    // Frames and structs compare their layouts too, see dlgr_register_struct().
+    dlgr_var_t* var = dlgr_vars[handle];
+    pthread_mutex_lock(&var->lock);
+    const int same = (var->var_size == var_size)
+        && (var->timestamped == (options.timestamped ? 1 : 0))
+        && (var->codec == options.codec)
+        && (var->type == options.type)
+        && (var->columnar == (options.columnar ? 1 : 0))
+        && ((options.element_size == 0) || (var->element_size == options.element_size));
+    pthread_mutex_unlock(&var->lock);
+
+    return same ? handle : -1;
+}
+
+int dlgr_register_columns(const char* var_name, int var_size, dlgr_options_t options){
+    // Check if var_name is NULL.
+    if (var_name == NULL){
+        eprintf("Variable name is NULL.");
+        return -1;
+    }
+
+    // Check if the log directory may be written.
+    if (dlgr_read_only){
+        eprintf("Log directory is open read-only, %s not registered.", var_name);
+        return -1;
+    }
+
+    // Check if var_name fits in the registry.
+    if (strlen(var_name) >= MAX_VAR_NAME_SIZE){
+        eprintf("Variable name %s is too long.", var_name);
+        return -1;
+    }
+
+    // Check if var_size is valid.
+    if ((var_size < 1) || (var_size > MAX_VAR_SIZE)){
+        eprintf("Variable size %d invalid.", var_size);
+        return -1;
+    }
+
+    // Check if the type suits var_size.
+    const int type_size = dlgr_type_size(options.type);
+    if ((type_size < 0) || ((type_size > 0) && ((var_size % type_size) != 0))){
+        eprintf("Type %d invalid for variable size %d.", options.type, var_size);
+        return -1;
+    }
+
+    // Check if the codec suits var_size. The codec of a typed array works on its elements by default.
+    // Columns are compressed by the size and type of their members instead.
+    int element_size = 0;
+    if (options.columnar){
+        if (dlgr_codec_element_size(options.codec, sizeof(long long), 0) < 0){
+            return -1;
+        }
+    } else if ((element_size = dlgr_codec_element_size(options.codec, var_size, options.element_size ? options.element_size : type_size)) < 0){
+        return -1;
+    }
+
+    // Calculate filename buffer size, create it.
+    const int fname_buf_size = strlen(var_name) + 9; // 9 == sizeof("_0.log.z")
+    char fname_buf[fname_buf_size];
+
+    // var_name should actually be modulename_variablename
+    // Registration files take the form module_variable.reg, ie acs_x.reg
+    // Construct the registration file's name.
+    snprintf(fname_buf, fname_buf_size, "%s.reg", var_name); 
+
+    // Check if the registration file exists.
+    if ((faccessat(dlgr_log_dir_fd(), fname_buf, F_OK | R_OK, 0)) == 0)
+    {
+        // File exists.
+        eprintf("WARNING: Variable name %s was previously registered in %s. Overwriting old registration.", var_name, fname_buf);
+    }
+    else
+    {
+        // File does not exist.
+        eprintf("Registering new variable name %s in %s.", var_name, fname_buf);
+    }
+
+    // Open the registration file.
+    FILE* var_registration_f = dlgr_fopen_log(fname_buf, "w");
+    if(var_registration_f == NULL){
+        eprintf("Registration failed: Could not open %s for writing.", fname_buf);
+        return -1;
+    }
+
+    // Write the variable size and options to the registration file.
+    int retval = fprintf(var_registration_f, "%d %d %d %d %d", var_size, options.timestamped ? 1 : 0, options.codec, element_size, options.type);
+    if(retval <= 0) {
+        eprintf("Registration failed: Writing to registration file failed with value %d.", retval);
+        fclose(var_registration_f);
+        return -1;
+    }
+
+    // Close the registration file.
+    fclose(var_registration_f);
+
+    // Drop every segment of the old registration, which may hold records of another size, and any files of an old _0.
+    dlgr_remove_old_segments(var_name);
+    dlgr_remove_segment(var_name, 0);
+
+    // The manifest replaces the index file of older registrations.
+    snprintf(fname_buf, fname_buf_size, "%s.idx", var_name);
+    unlinkat(dlgr_log_dir_fd(), fname_buf, 0);
+
+    // Create an initial _0.log file.
+    snprintf(fname_buf, fname_buf_size, "%s_%d.log", var_name, 0);
+
+    // Create the log file, in the hot directory if there is one.
+    const int hot_fd = dlgr_hot_dir_fd();
+    int var_log_fd = openat(hot_fd >= 0 ? hot_fd : dlgr_log_dir_fd(), fname_buf, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(var_log_fd < 0){
+        eprintf("Registration failed: Could not open %s for writing.", fname_buf);
+        return -1;
+    }
+
+    close(var_log_fd);
+
+    // A plain variable has no member layout; dlgr_register_frame() writes a new one afterwards.
+    snprintf(fname_buf, fname_buf_size, "%s.frm", var_name);
+    unlinkat(dlgr_log_dir_fd(), fname_buf, 0);
+
+    // Track the new registration in memory.
+    pthread_mutex_lock(&dlgr_registry_lock);
+    int handle = dlgr_find_handle(var_name);
+    if(handle < 0){
+        dlgr_var_t* new_var = dlgr_new_var(var_name);
+        if((new_var != NULL) && ((handle = dlgr_insert_var(new_var)) < 0)){
+            dlgr_free_var(new_var);
+        }
+    }
+    pthread_mutex_unlock(&dlgr_registry_lock);
+
+    if(handle < 0){
+        eprintf("Registration failed: Could not add %s to the registry.", var_name);
+        return -1;
+    }
+
+    dlgr_var_t* var = dlgr_vars[handle];
+    pthread_mutex_lock(&var->lock);
+    dlgr_close_segment(var);
+    dlgr_drop_spare(var);
+    var->manifest_dirty = 0;
+    var->var_size = var_size;
+    var->timestamped = options.timestamped ? 1 : 0;
+    var->codec = options.codec;
+    var->element_size = element_size;
+    var->type = options.type;
+    var->var_index = 0;
+    var->seg_fill = 0;
+    free(var->members);
+    var->members = NULL;
+    var->num_members = 0;
+    var->columnar = 0;
+
+    // Start a manifest holding just the new _0.log.
+    var->num_segments = 0;
+    retval = dlgr_push_segment(var, 0, 0) < 0 ? -1 : dlgr_store_manifest(var);
+    pthread_mutex_unlock(&var->lock);
+
+    if(retval < 0){
+        eprintf("Registration failed: Could not store the manifest of %s.", var_name);
+        return -1;
+    }
+
+    return handle;
+}
+
+int dlgr_get_handle(const char* var_name){
+    // Check if var_name is NULL.
+    if (var_name == NULL){
+        eprintf("Variable name is NULL.");
+        return -1;
+    }
+
+    if (strlen(var_name) >= MAX_VAR_NAME_SIZE){
+        eprintf("Variable name %s is too long.", var_name);
+        return -1;
+    }
+
+    pthread_mutex_lock(&dlgr_registry_lock);
+
+    int handle = dlgr_find_handle(var_name);
+    if(handle < 0){
+        // Not yet seen by this process, load it from its registration files.
+        dlgr_var_t* loaded = dlgr_new_var(var_name);
+        if((loaded != NULL) && ((dlgr_load_var(loaded) < 0) || ((handle = dlgr_insert_var(loaded)) < 0))){
+            dlgr_free_var(loaded);
+        }
+    }
+
+    pthread_mutex_unlock(&dlgr_registry_lock);
+
+    return handle;
+}
+
+static int dlgr_compare_names(const void* a, const void* b){
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// Checks if fname is in a sorted directory listing.
+static int dlgr_listed(char** names, int num_names, const char* fname){
+    return bsearch(&fname, names, num_names, sizeof(char*), dlgr_compare_names) != NULL;
+}
+
+// Checks if fname is in the hot or the log directory, in the order a segment moves out of them.
+static int dlgr_segment_exists(const char* fname){
+    const int hot_fd = dlgr_hot_dir_fd();
+    return ((hot_fd >= 0) && (faccessat(hot_fd, fname, F_OK, 0) == 0)) || (faccessat(dlgr_log_dir_fd(), fname, F_OK, 0) == 0);
+}
+
+// Drops the oldest closed segments of var whose files are gone from its manifest, checked against a directory listing
+// and then on disk, as a segment may have moved since it was listed. Missing segments after one that is present stay,
+// so the sequence has no gaps; reads end at them. Caller must hold var->lock.
+static void dlgr_verify_segments(dlgr_var_t* var, char** names, int num_names){
+    char fname_buf[MAX_FNAME_SIZE], z_buf[MAX_FNAME_SIZE];
+    const char* ext = var->columnar ? "c0" : "log";
+    int kept = 0;
+    for(int i = 0; i < var->num_segments; i++){
+        const dlgr_segment_info_t* segment = &var->segments[i];
+        snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.%s", var->var_name, segment->var_index, ext);
+        snprintf(z_buf, MAX_FNAME_SIZE, "%s_%d.%s.z", var->var_name, segment->var_index, ext);
+
+        // The current segment is created on the next write if it is missing.
+        if((i < (var->num_segments - 1)) && !dlgr_listed(names, num_names, fname_buf) && !dlgr_listed(names, num_names, z_buf)
+           && !dlgr_segment_exists(fname_buf) && !dlgr_segment_exists(z_buf)){
+            if(kept == 0){
+                eprintf("Segment %d of %s is missing, %s.", segment->var_index, var->var_name, dlgr_read_only ? "skipping it" : "dropping it from the manifest");
+                continue;
+            }
+            eprintf("Segment %d of %s is missing.", segment->var_index, var->var_name);
+        }
+        var->segments[kept++] = *segment;
+    }
+
+    if(kept != var->num_segments){
+        var->num_segments = kept;
+        if(!dlgr_read_only){
+            dlgr_store_manifest(var);
+        }
+    }
+}
+
+// Adds the names in directory dirfd to a listing, skipping hidden files. Negative if they could not all be added.
+static int dlgr_list_dir(int dirfd, char*** names, int* num_names, int* names_capacity){
+    // A fresh descriptor, so the listing starts at the beginning however often the directory is listed.
+    int list_fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* dir = list_fd >= 0 ? fdopendir(list_fd) : NULL;
+    if(dir == NULL){
+        if(list_fd >= 0){
+            close(list_fd);
+        }
+        return -1;
+    }
+
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL){
+        if(entry->d_name[0] == '.'){
+            continue;
+        }
+        if(*num_names == *names_capacity){
+            const int new_capacity = *names_capacity ? *names_capacity * 2 : 256;
+            char** new_names = realloc(*names, new_capacity * sizeof(char*));
+            if(new_names == NULL){
+                break;
+            }
+            *names = new_names;
+            *names_capacity = new_capacity;
+        }
+        if(((*names)[*num_names] = strdup(entry->d_name)) == NULL){
+            break;
+        }
+        (*num_names)++;
+    }
+    const int complete = entry == NULL;
+    closedir(dir);
+
+    return complete ? 1 : -1;
+}
+
+// Queues the closed segments in a sorted listing of the hot directory, left there by a crash, for the log directory.
+static void dlgr_migrate_leftovers(char** hot_names, int num_hot_names){
+    char last_buf[MAX_FNAME_SIZE] = "";
+    for(int i = 0; i < num_hot_names; i++){
+        // var_name_N.ext, where var_name may hold underscores of its own.
+        const char* dot = strchr(hot_names[i], '.');
+        const int length = dot ? dot - hot_names[i] : 0;
+        const char* underscore = length ? memrchr(hot_names[i], '_', length) : NULL;
+        if((underscore == NULL) || (underscore == hot_names[i]) || (length >= MAX_FNAME_SIZE) || (strspn(underscore + 1, "0123456789") != (size_t) (dot - underscore - 1))){
+            continue;
+        }
+
+        // The files of a segment are adjacent; queue it once.
+        if((strncmp(last_buf, hot_names[i], length) == 0) && (last_buf[length] == '\0')){
+            continue;
+        }
+        memcpy(last_buf, hot_names[i], length);
+        last_buf[length] = '\0';
+
+        char var_name[MAX_VAR_NAME_SIZE];
+        const int var_name_length = underscore - hot_names[i];
+        if(var_name_length >= MAX_VAR_NAME_SIZE){
+            continue;
+        }
+        memcpy(var_name, hot_names[i], var_name_length);
+        var_name[var_name_length] = '\0';
+
+        pthread_mutex_lock(&dlgr_registry_lock);
+        const int handle = dlgr_find_handle(var_name);
+        pthread_mutex_unlock(&dlgr_registry_lock);
+        dlgr_var_t* var = dlgr_get_var(handle);
+        if(var == NULL){
+            continue;
+        }
+
+        const int var_index = atoi(underscore + 1);
+        pthread_mutex_lock(&var->lock);
+        if(var_index != var->var_index){
+            dlgr_migrate(var, var_index);
+        }
+        pthread_mutex_unlock(&var->lock);
+    }
+}
+
+int dlgr_open(const char* dir){
+    if((dir != NULL) && (dlgr_set_log_dir(dir) < 0)){
+        return -1;
+    }
+
+    // List the directories once; every registration and segment file is in one of them. The hot one goes first: a
+    // segment moving meanwhile is put in place in the log directory before it is removed from the hot one, so it is in
+    // one listing or the other.
+    char** names = NULL;
+    int num_names = 0, names_capacity = 0;
+    const int hot_fd = dlgr_hot_dir_fd();
+    int listed = hot_fd >= 0 ? dlgr_list_dir(hot_fd, &names, &num_names, &names_capacity) : 1;
+    const int num_hot = num_names;
+    if(listed > 0){
+        listed = dlgr_list_dir(dlgr_log_dir_fd(), &names, &num_names, &names_capacity);
+    }
+
+    if(listed < 0){
+        eprintf("Could not list log directory %s.", dir ? dir : ".");
+        for(int i = 0; i < num_names; i++){
+            free(names[i]);
+        }
+        free(names);
+        return -1;
+    }
+
+    // Move on what a crash left in the hot directory, then look for files in either.
+    qsort(names, num_hot, sizeof(char*), dlgr_compare_names);
+    char** hot_names = malloc((num_hot + 1) * sizeof(char*));
+    if(hot_names != NULL){
+        memcpy(hot_names, names, num_hot * sizeof(char*));
+    }
+    qsort(names, num_names, sizeof(char*), dlgr_compare_names);
+
+    // Load every registered variable not already known to this process.
+    int number_loaded = 0;
+    for(int i = 0; i < num_names; i++){
+        const size_t length = strlen(names[i]);
+        if((length <= 4) || (length >= (MAX_VAR_NAME_SIZE + 4)) || (strcmp(&names[i][length - 4], ".reg") != 0)){
+            continue;
+        }
+        char var_name[MAX_VAR_NAME_SIZE];
+        memcpy(var_name, names[i], length - 4);
+        var_name[length - 4] = '\0';
+
+        dlgr_var_t* loaded = NULL;
+        pthread_mutex_lock(&dlgr_registry_lock);
+        if(dlgr_find_handle(var_name) < 0){
+            loaded = dlgr_new_var(var_name);
+            if((loaded != NULL) && ((dlgr_load_var(loaded) < 0) || (dlgr_insert_var(loaded) < 0))){
+                eprintf("Could not load %s.", var_name);
+                dlgr_free_var(loaded);
+                loaded = NULL;
+            }
+        }
+        pthread_mutex_unlock(&dlgr_registry_lock);
+
+        if(loaded != NULL){
+            pthread_mutex_lock(&loaded->lock);
+            dlgr_verify_segments(loaded, names, num_names);
+            pthread_mutex_unlock(&loaded->lock);
+            number_loaded++;
+        }
+    }
+
+    if(hot_names != NULL){
+        if(!dlgr_read_only){
+            dlgr_migrate_leftovers(hot_names, num_hot);
+        }
+        free(hot_names);
+    }
+
+    for(int i = 0; i < num_names; i++){
+        free(names[i]);
+    }
+    free(names);
+
+    return number_loaded;
+}
+
+int dlgr_open_read_only(const char* dir){
+    // Variables already loaded may have written.
+    if(dlgr_get_var(0) != NULL){
+        eprintf("Open read-only before registering or loading variables.");
+        return -1;
+    }
+
+    dlgr_read_only = 1;
+    return dlgr_open(dir);
+}
+
+dlgr_var_t* dlgr_get_var(int handle){
+    if((handle < 0) || (handle >= DLGR_MAX_VARS)){
+        return NULL;
+    }
+    return dlgr_vars[handle];
+}
+
+int dlgr_write(const char* var_name, void* data){
+    // Check if var_name is NULL.
+    if (var_name == NULL){
+        eprintf("Variable name is NULL.");
+        return -1;
+    }
+
+    int handle = dlgr_get_handle(var_name);
+    if(handle < 0){
+        eprintf("Write failed: %s has not been registered.", var_name);
+        return -1;
+    }
+
+    return dlgr_write_handle(handle, data);
+}
+
+// Splits count records into the columns of the current segment, from record first_record on. Returns the bytes of whole records written to every column. Caller must hold var->lock.
+static ssize_t dlgr_write_columns(dlgr_var_t* var, const unsigned char* records, int first_record, int count){
+    unsigned char column_buf[0x1000];
+    const int var_size = var->var_size;
+    int written = count;
+    for(int i = 0; i < var->num_members; i++){
+        const int offset = var->members[i].offset;
+        const int size = var->members[i].size;
+        const int chunk_records = size < (int) sizeof(column_buf) ? (int) sizeof(column_buf) / size : 1;
+
+        // Gather a chunk of the column, or write a member too big to gather straight from its record.
+        for(int done = 0; done < count; ){
+            const int chunk = (count - done) < chunk_records ? (count - done) : chunk_records;
+            const unsigned char* src = &records[(size_t) done * var_size + offset];
+            if(size <= (int) sizeof(column_buf)){
+                for(int record = 0; record < chunk; record++){
+                    memcpy(&column_buf[record * size], &src[(size_t) record * var_size], size);
+                }
+                src = column_buf;
+            }
+            const ssize_t bytes = (ssize_t) chunk * size;
+            const ssize_t retval = dlgr_io_pwrite(var, first_record + done, var->column_fds[i], src, bytes, (off_t) (first_record + done) * size);
+            if(retval != bytes){
+                const int column_records = done + (retval > 0 ? retval / size : 0);
+                written = column_records < written ? column_records : written;
+                break;
+            }
+            done += chunk;
+        }
+    }
+
+    return (ssize_t) written * var_size;
+}
+
+// Rotates segments as they fill, with one write per segment touched.
+int dlgr_append(dlgr_var_t* var, const void* data, const long long* timestamps, int count){
+    const unsigned char* data_ptr = (const unsigned char*) data;
+    const int var_size = var->var_size;
+    const int capacity = dlgr_segment_capacity(var);
+    const long long now = (var->timestamped && (timestamps == NULL)) ? dlgr_time_now() : 0;
+
+    if(dlgr_read_only){
+        eprintf("Write failed: Log directory is open read-only.");
+        return -1;
+    }
+
+    int number_written = 0;
+    while(number_written < count){
+        // If the file will exceed its capacity, iterate to next file.
+        if((var->seg_fill > 0) && ((var->seg_fill + var_size) > capacity)){
+            if(dlgr_rotate(var) < 0){
+                eprintf("Write failed: Could not rotate log of %s.", var->var_name);
+                return -1;
+            }
+        }
+
+        // Open the log file if it is not already, creating it if this is a new segment, and have the next one opened ahead.
+        if(var->seg_fd < 0){
+            if(dlgr_open_segment(var) < 0){
+                eprintf("Write failed: Could not open log segment %d of %s.", var->var_index, var->var_name);
+                return -1;
+            }
+            dlgr_prepare(var, var->var_index);
+        }
+
+        // As many records as fit in this segment.
+        int number_this_file = (capacity - var->seg_fill) / var_size;
+        if(number_this_file > (count - number_written)){
+            number_this_file = count - number_written;
+        }
+
+        // Write our data to the log file at the tracked offset.
+        const ssize_t bytes = (ssize_t) number_this_file * var_size;
+        ssize_t retval = var->columnar ? dlgr_write_columns(var, &data_ptr[(size_t) number_written * var_size], var->seg_fill / var_size, number_this_file)
+                                       : dlgr_io_pwrite(var, var->seg_fill / var_size, var->seg_fd, &data_ptr[(size_t) number_written * var_size], bytes, var->seg_fill);
+        if(retval != bytes){
+            eprintf("Write failed: Failed to write to segment %d of %s: wrote %zd of %zd bytes.", var->var_index, var->var_name, retval, bytes);
+            DLGR_COUNT(var, errors[DLGR_ERROR_WRITE], 1);
+            // Keep any whole records, the next write overwrites a partial one.
+            if(retval > 0){
+                var->seg_fill += (retval / var_size) * var_size;
+                var->unsynced += retval / var_size;
+                DLGR_COUNT(var, records_written, retval / var_size);
+                DLGR_COUNT(var, bytes_written, (retval / var_size) * var_size);
+            }
+            dlgr_close_segment(var);
+            return -1;
+        }
+
+        if(var->timestamped){
+            if(dlgr_append_timestamps(var, var->seg_fill / var_size, timestamps ? &timestamps[number_written] : NULL, now, number_this_file) < 0){
+                dlgr_close_segment(var);
+                return -1;
+            }
+            // The manifest keeps the first and last timestamp of each segment, for time-range queries to search.
+            dlgr_segment_info_t* head = &var->segments[var->num_segments - 1];
+            if(var->seg_fill == 0){
+                head->first_ts = timestamps ? timestamps[number_written] : now;
+            }
+            head->last_ts = timestamps ? timestamps[number_written + number_this_file - 1] : now;
+        }
+
+        var->seg_fill += bytes;
+        var->unsynced += number_this_file;
+        number_written += number_this_file;
+    }
+    DLGR_COUNT(var, records_written, number_written);
+    DLGR_COUNT(var, bytes_written, (unsigned long long) number_written * var_size);
+
+    if(dlgr_sync_after_write(var) < 0){
+        eprintf("Write failed: Could not sync segment %d of %s.", var->var_index, var->var_name);
+        return -1;
+    }
+
+    return number_written;
+}
+
+int dlgr_write_handle(int handle, void* data){
+    return dlgr_write_timed_handle(handle, data, NULL, 1);
+}
+
+int dlgr_write_batch(const char* var_name, void* data, int count){
+    // Check if var_name is NULL.
+    if (var_name == NULL){
+        eprintf("Variable name is NULL.");
+        return -1;
+    }
+
+    int handle = dlgr_get_handle(var_name);
+    if(handle < 0){
+        eprintf("Write failed: %s has not been registered.", var_name);
+        return -1;
+    }
+
+    return dlgr_write_batch_handle(handle, data, count);
+}
+
+int dlgr_write_batch_handle(int handle, void* data, int count){
+    return dlgr_write_timed_handle(handle, data, NULL, count);
+}
+
+int dlgr_write_timed_handle(int handle, void* data, const long long* timestamps, int count){
+    // eprintf("Write started.");
+
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+    
+    // Check if data is NULL.
+    if (data == NULL){
+        eprintf("Data is NULL.");
+        return -1;
+    }
+
+    // Check if count is invalid.
+    if (count <= 0){
+        eprintf("Count %d is invalid.", count);
+        return -1;
+    }
+
+    // Hand the records to the writer thread if asynchronous logging is running.
+    int retval = dlgr_async_enqueue(handle, data, timestamps, count, var->var_size, var->timestamped);
+    if(retval != 0){
+        return retval;
+    }
+
+    pthread_mutex_lock(&var->lock);
+    retval = dlgr_append(var, data, timestamps, count);
+    pthread_mutex_unlock(&var->lock);
+
+    // eprintf("Write finished.");
+    return retval < 0 ? -1 : 1;
+}
+
+int dlgr_prime_read(const char* var_name, int number){
+    // Check if var_name is NULL.
+    if (var_name == NULL){
+        eprintf("Variable name is NULL.");
+        return -1;
+    }
+
+    int handle = dlgr_get_handle(var_name);
+    if(handle < 0){
+        eprintf("Failed: %s has not been registered.", var_name);
+        return -1;
+    }
+
+    return dlgr_prime_read_handle(handle, number);
+}
+
+int dlgr_prime_read_handle(int handle, int number){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    // Check if number is invalid.
+    if (number <= 0){
+        eprintf("Number is invalid.");
+        return -1;
+    }
+
+    pthread_mutex_lock(&var->lock);
+    int required_bytes = var->var_size * number;
+    pthread_mutex_unlock(&var->lock);
+
+    // Remember the read for this thread's next dlgr_perform_read().
+    dlgr_primed_read.handle = handle;
+    dlgr_primed_read.number = number;
+    dlgr_primed_read.required_bytes = required_bytes;
+
+    return required_bytes;
+}
+
+int dlgr_perform_read(void* storage, int allocated_bytes){
+    if(storage == NULL){
+        eprintf("Storage is NULL.");
+        return -1;
+    }
+
+    if(allocated_bytes <= 0){
+        eprintf("Allocated bytes is invalid.");
+        return -1;
+    }
+
+    if(dlgr_primed_read.handle < 0){
+        eprintf("No read is primed! Call DLGR_PRIME_READ(varname, number)");
+        return -1;
+    }
+
+    // Get our primed handle and required bytes, and clear them.
+    const int handle = dlgr_primed_read.handle;
+    const int number_requested = dlgr_primed_read.number;
+    const int required_bytes = dlgr_primed_read.required_bytes;
+    dlgr_primed_read.handle = -1;
+
+    // Compare it to what we calculate now.
+    if(allocated_bytes != required_bytes){
+        eprintf("Cannot continue, descrepancy found between primed byte value (%d) and passed byte value (%d).", required_bytes, allocated_bytes);
+        return -1;
+    }
+
+    if(dlgr_read_latest_handle(handle, storage, number_requested) < 0){
+        return -1;
+    }
+
+    return 1;
+}
+
+// Copies the segments of var holding its newest_records newest records, or all of them if negative. Caller must hold var->lock.
+static int dlgr_snapshot_locked(dlgr_var_t* var, long long newest_records, dlgr_snapshot_t* snapshot){
+    memset(snapshot, 0x0, sizeof(dlgr_snapshot_t));
+    dlgr_update_head(var);
+
+    // Just enough of the newest segments to hold newest_records.
+    int first = var->num_segments - 1;
+    long long records = var->segments[first].records;
+    while((first > 0) && ((newest_records < 0) || (records < newest_records))){
+        first--;
+        records += var->segments[first].records;
+    }
+
+    snapshot->var_size = var->var_size;
+    snapshot->timestamped = var->timestamped;
+    snapshot->segments = malloc((var->num_segments - first) * sizeof(dlgr_segment_info_t));
+    if(snapshot->segments == NULL){
+        eprintf("Could not allocate a snapshot of %s.", var->var_name);
+        return -1;
+    }
+    snapshot->num_segments = var->num_segments - first;
+    memcpy(snapshot->segments, &var->segments[first], snapshot->num_segments * sizeof(dlgr_segment_info_t));
+
+    return snapshot->num_segments;
+}
+
+int dlgr_snapshot(int handle, long long newest_records, dlgr_snapshot_t* snapshot){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
 
-#include "datalogger.h"
-#include "datalogger_extern.h"
+    pthread_mutex_lock(&var->lock);
+    const int retval = dlgr_snapshot_locked(var, newest_records, snapshot);
+    pthread_mutex_unlock(&var->lock);
 
-#define FILE_EXISTS ({snprintf(fname_buf, fname_buf_size, "%s_%d.log", var_name, var_index--); access(fname_buf, F_OK | R_OK);}) == 0
+    return retval;
+}
 
-// Example Directory (NEW)
-/* datalogger/
- * read_primer.tmp      <-- Holds info from last prime_read if read hasnt been called yet (read clears it).
- * acs_settings.cfg     <-- Holds module-specific logging settings.
- * acs_VAR1.idx         <-- Holds current log index of this variable.
- * acs_VAR1_0.log       <-- MODULE_VARIABLE_LOGNUMBER.dat
- * acs_VAR1_1.log
- * acs_VAR2.idx
- * acs_VAR2_0.log
- * <Other Modules>
- */
+void dlgr_snapshot_free(dlgr_snapshot_t* snapshot){
+    free(snapshot->segments);
+    snapshot->segments = NULL;
+    snapshot->num_segments = 0;
+}
 
-// settings.cfg file format (index moved to index.inf)
-/* 1. max file size (Bytes)
- * 2. max dir size (Bytes)
- */
+// Reads the newest counts[v] records of each vars[v] in snapshots[v] into storages[v], newest first, and stores how many
+// in number_read[v]. The newest records of each segment are read straight into storage, with the reads of every variable
+// going to the I/O backend together, DLGR_IO_READS segments at a time.
+static int dlgr_read_newest(dlgr_var_t* const* vars, const dlgr_snapshot_t* snapshots, const int* counts, void* const* storages, int* number_read, int num_vars){
+    dlgr_io_read_t reads[DLGR_IO_READS];
+    int owners[DLGR_IO_READS];
+    int num_reads = 0;
+
+    // Segment i of variable v is next, newest first.
+    int v = 0;
+    int i = snapshots[0].num_segments - 1;
+    while(v < num_vars){
+        // A missing segment is the end of the available data; older ones have been removed.
+        int var_log_fd = -1;
+        int records = 0, number_this_file = 0;
+        if((i >= 0) && (number_read[v] < counts[v])){
+            records = snapshots[v].segments[i].records;
+            number_this_file = records < (counts[v] - number_read[v]) ? records : (counts[v] - number_read[v]);
+            var_log_fd = dlgr_open_segment_rows(vars[v], snapshots[v].segments[i].var_index, records - number_this_file, number_this_file);
+        }
 
-// char* moduleName is just a placeholder. Later, we will get the
-// module names from somewhere else.
+        if(var_log_fd >= 0){
+            const int var_size = snapshots[v].var_size;
+            const size_t bytes = (size_t) number_this_file * var_size;
+            reads[num_reads] = (dlgr_io_read_t){var_log_fd, &((unsigned char*) storages[v])[(size_t) number_read[v] * var_size], bytes, (off_t) (records - number_this_file) * var_size, snapshots[v].segments[i].var_index, 0};
+            owners[num_reads++] = v;
+            number_read[v] += number_this_file;
+            i--;
+        } else if(++v < num_vars){
+            i = snapshots[v].num_segments - 1;
+        }
 
-int dlgr_register(const char* var_name, int var_size){
+        if((num_reads == DLGR_IO_READS) || ((num_reads > 0) && (v == num_vars))){
+            if(dlgr_read_segments(vars, owners, reads, num_reads) < 0){
+                return -1;
+            }
+            // Then put them newest first.
+            for(int j = 0; j < num_reads; j++){
+                const int var_size = snapshots[owners[j]].var_size;
+                dlgr_reverse_records(reads[j].buf, reads[j].bytes / var_size, var_size);
+            }
+            num_reads = 0;
+        }
+    }
+
+    for(int v = 0; v < num_vars; v++){
+        DLGR_COUNT(vars[v], reads, 1);
+        DLGR_COUNT(vars[v], bytes_read, (unsigned long long) number_read[v] * snapshots[v].var_size);
+    }
+    return 1;
+}
+
+int dlgr_read_latest(const char* var_name, void* storage, int count){
     // Check if var_name is NULL.
     if (var_name == NULL){
         eprintf("Variable name is NULL.");
         return -1;
     }
 
-    // Check if var_size is valid.
-    if ((var_size < 1) || (var_size > MAX_VAR_SIZE)){
-        eprintf("Variable size %d invalid.", var_size);
+    int handle = dlgr_get_handle(var_name);
+    if(handle < 0){
+        eprintf("Failed: %s has not been registered.", var_name);
         return -1;
     }
 
-    // Calculate filename buffer size, create it.
-    const int fname_buf_size = strlen(var_name) + 7; // 7 == sizeof("_0.reg") + '\0'
-    char fname_buf[fname_buf_size];
-
-    // var_name should actually be modulename_variablename
-    // Registration files take the form module_variable.reg, ie acs_x.reg
-    // Construct the registration file's name.
-    snprintf(fname_buf, fname_buf_size, "%s.reg", var_name); 
+    return dlgr_read_latest_handle(handle, storage, count);
+}
 
-    // Check if the registration file exists.
-    if ((access(fname_buf, F_OK | R_OK)) == 0)
-    {
-        // File exists.
-        eprintf("WARNING: Variable name %s was previously registered in %s. Overwriting old registration.", var_name, fname_buf);
+int dlgr_read_latest_handle(int handle, void* storage, int count){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
     }
-    else
-    {
-        // File does not exist.
-        eprintf("Registering new variable name %s in %s.", var_name, fname_buf);
+
+    if(storage == NULL){
+        eprintf("Storage is NULL.");
+        return -1;
     }
 
-    // Open the registration file.
-    FILE* var_registration_f = fopen(fname_buf, "w");
-    if(var_registration_f == NULL){
-        eprintf("Registration failed: Could not open %s for writing.", fname_buf);
+    if(count <= 0){
+        eprintf("Count %d is invalid.", count);
         return -1;
     }
 
-    // Write the variable size to the registration file.
-    int retval = fprintf(var_registration_f, "%d", var_size);
-    if(retval <= 0) {
-        eprintf("Registration failed: Writing to registration file failed with value %d.", retval);
-        fclose(var_registration_f);
+    // Snapshot the segments holding the newest records. Records written while we read are not ours to return.
+    dlgr_snapshot_t snapshot;
+    if(dlgr_snapshot(handle, count, &snapshot) < 0){
         return -1;
     }
 
-    // Close the registration file.
-    fclose(var_registration_f);
+    int number_read = 0;
+    const int retval = dlgr_read_newest(&var, &snapshot, &count, &storage, &number_read, 1);
+    dlgr_snapshot_free(&snapshot);
 
-    // Zero-out filename buffer, construct index file name.
-    // memset(fname_buf, 0x0, fname_buf_size);
-    snprintf(fname_buf, fname_buf_size, "%s.idx", var_name);
+    return retval < 0 ? -1 : number_read;
+}
 
-    // Create index file.
-    FILE* var_index_f = fopen(fname_buf, "w");
-    if(var_index_f == NULL){
-        eprintf("Registration failed: Could not open %s for writing.", fname_buf);
+int dlgr_read_multi(const char* const* var_names, const int* counts, void* const* storages, int* number_read, int num_vars){
+    if((var_names == NULL) || (num_vars <= 0) || (num_vars > DLGR_MAX_VARS)){
+        eprintf("Variables are invalid.");
         return -1;
     }
 
-    // Write the initial index '0' to the idx file.
-    retval = fprintf(var_index_f, "%d", 0);
-    if((fprintf(var_index_f, "%d", 0)) <= 0){
-        eprintf("Registration failed: Writing to index file failed with value %d.", retval);
-        fclose(var_index_f);
+    int* handles = malloc(num_vars * sizeof(int));
+    if(handles == NULL){
+        eprintf("Could not allocate the handles of %d variables.", num_vars);
         return -1;
     }
 
-    fclose(var_index_f);
+    int retval = 1;
+    for(int v = 0; (retval > 0) && (v < num_vars); v++){
+        // Check if var_names[v] is NULL.
+        if(var_names[v] == NULL){
+            eprintf("Variable name is NULL.");
+            retval = -1;
+        } else if((handles[v] = dlgr_get_handle(var_names[v])) < 0){
+            eprintf("Failed: %s has not been registered.", var_names[v]);
+            retval = -1;
+        }
+    }
 
-    // Create an initial _0.log file.
-    snprintf(fname_buf, fname_buf_size, "%s_%d.log", var_name, 0);
+    if(retval > 0){
+        retval = dlgr_read_multi_handle(handles, counts, storages, number_read, num_vars);
+    }
 
-    // Create the log file.
-    FILE* var_log_f = fopen(fname_buf, "w");
-    if(var_log_f == NULL){
-        eprintf("Registration failed: Could not open %s for writing.", fname_buf);
+    free(handles);
+    return retval;
+}
+
+int dlgr_read_multi_handle(const int* handles, const int* counts, void* const* storages, int* number_read, int num_vars){
+    if((handles == NULL) || (counts == NULL) || (storages == NULL) || (number_read == NULL) || (num_vars <= 0) || (num_vars > DLGR_MAX_VARS)){
+        eprintf("Variables are invalid.");
         return -1;
     }
 
-    fclose(var_log_f);
+    dlgr_var_t** vars = malloc(num_vars * sizeof(dlgr_var_t*));
+    dlgr_snapshot_t* snapshots = calloc(num_vars, sizeof(dlgr_snapshot_t));
+    int* order = malloc(num_vars * sizeof(int));
+    if((vars == NULL) || (snapshots == NULL) || (order == NULL)){
+        eprintf("Could not allocate a read of %d variables.", num_vars);
+        free(vars);
+        free(snapshots);
+        free(order);
+        return -1;
+    }
 
-    return 1;
-}
+    int retval = 1;
+    for(int v = 0; (retval > 0) && (v < num_vars); v++){
+        number_read[v] = 0;
+        if((vars[v] = dlgr_get_var(handles[v])) == NULL){
+            eprintf("Invalid handle %d.", handles[v]);
+            retval = -1;
+        } else if(storages[v] == NULL){
+            eprintf("Storage is NULL.");
+            retval = -1;
+        } else if(counts[v] <= 0){
+            eprintf("Count %d is invalid.", counts[v]);
+            retval = -1;
+        }
 
-int dlgr_write(const char* var_name, void* data){
-    // eprintf("Write started.");
+        // Lock in handle order, as the asynchronous writer does.
+        int j = v;
+        for(; (j > 0) && (handles[order[j - 1]] > handles[v]); j--){
+            order[j] = order[j - 1];
+        }
+        order[j] = v;
+    }
+
+    // Snapshot every variable with all of them locked, so no write lands between one head and the next.
+    if(retval > 0){
+        for(int k = 0; k < num_vars; k++){
+            if((k == 0) || (handles[order[k]] != handles[order[k - 1]])){
+                pthread_mutex_lock(&vars[order[k]]->lock);
+            }
+        }
+        for(int v = 0; v < num_vars; v++){
+            if(dlgr_snapshot_locked(vars[v], counts[v], &snapshots[v]) < 0){
+                retval = -1;
+            }
+        }
+        for(int k = num_vars - 1; k >= 0; k--){
+            if((k == 0) || (handles[order[k]] != handles[order[k - 1]])){
+                pthread_mutex_unlock(&vars[order[k]]->lock);
+            }
+        }
+    }
+
+    if(retval > 0){
+        retval = dlgr_read_newest(vars, snapshots, counts, storages, number_read, num_vars);
+    }
+
+    for(int v = 0; v < num_vars; v++){
+        dlgr_snapshot_free(&snapshots[v]);
+    }
+    free(vars);
+    free(snapshots);
+    free(order);
+    return retval;
+}
 
+int dlgr_read_range(const char* var_name, long long first_seq, int count, void* storage){
     // Check if var_name is NULL.
     if (var_name == NULL){
         eprintf("Variable name is NULL.");
         return -1;
     }
-    
-    // Check if data is NULL.
-    if (data == NULL){
-        eprintf("Data is NULL.");
+
+    int handle = dlgr_get_handle(var_name);
+    if(handle < 0){
+        eprintf("Failed: %s has not been registered.", var_name);
         return -1;
     }
 
-    const int fname_buf_size = strlen(var_name) + 17; // 16 == sizeof("_nnnnnnnnnn.log") + '\0'
-    // eprintf("Size of strlen(%s) + 5 = %d", var_name, fname_buf_size);
-    int var_size = dlgr_check_registration(var_name, fname_buf_size);
+    return dlgr_read_range_handle(handle, first_seq, count, storage);
+}
 
-    char fname_buf[fname_buf_size];
+int dlgr_read_range_handle(int handle, long long first_seq, int count, void* storage){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
 
-    // Get this variable's current log file index.
-    int var_index = dlgr_get_log_index(var_name);
-    if(var_index < 0){
-        eprintf("Write failed: Index acquisition failed with value %d.", var_index);
+    if(storage == NULL){
+        eprintf("Storage is NULL.");
         return -1;
     }
 
-    // Create the full log file name.
-    snprintf(fname_buf, fname_buf_size, "%s_%d.log", var_name, var_index);
+    if((count <= 0) || (first_seq < 0)){
+        eprintf("Range of %d records from %lld is invalid.", count, first_seq);
+        return -1;
+    }
 
-    // Check if this log file exists.
-    if ((access(fname_buf, F_OK | R_OK)) != 0){
-        eprintf("Log file %s does not exist.", fname_buf);
+    dlgr_snapshot_t snapshot;
+    if(dlgr_snapshot(handle, -1, &snapshot) < 0){
         return -1;
     }
+    const int var_size = snapshot.var_size;
+    const dlgr_segment_info_t* segments = snapshot.segments;
 
-    // Open the log file.
-    FILE* var_log_f = fopen(fname_buf, "ab");
-    if(var_log_f == NULL){
-        eprintf("Write failed: Could not open %s.", fname_buf);
+    if(first_seq < segments[0].first_seq){
+        eprintf("Record %lld of %s has been removed, the oldest is %lld.", first_seq, var->var_name, segments[0].first_seq);
+        DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+        dlgr_snapshot_free(&snapshot);
         return -1;
     }
 
-    // If the file will exceed MAX, iterate to next file.
-    // If the next file exists, measure its size.
+    // Binary-search for the segment holding first_seq: the last one starting at or before it.
+    int lo = 0, hi = snapshot.num_segments - 1;
+    while(lo < hi){
+        const int mid = lo + ((hi - lo + 1) / 2);
+        if(segments[mid].first_seq <= first_seq){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
 
-    // Find the size of the log file.
-    fseek(var_log_f, 0, SEEK_END);
-    int log_file_size = ftell(var_log_f);
-    fseek(var_log_f, 0, SEEK_SET);
+    // Read forward, straight into storage, one read per segment and DLGR_IO_READS segments at a time.
+    unsigned char* storage_ptr = (unsigned char*) storage;
+    dlgr_io_read_t reads[DLGR_IO_READS];
+    int num_reads = 0;
+    int number_read = 0;
+    int gap = 0;
+    for(int i = lo; (i < snapshot.num_segments) && (number_read < count); i++){
+        const long long seq = first_seq + number_read;
+        // Segments dropped from an older manifest leave a gap in the sequence, where the read ends.
+        if(seq < segments[i].first_seq){
+            gap = 1;
+            break;
+        }
+        const int offset = seq - segments[i].first_seq;
+        int number_this_file = segments[i].records - offset;
+        if(number_this_file > (count - number_read)){
+            number_this_file = count - number_read;
+        }
 
-    if((log_file_size + var_size) > MAX_FILE_SIZE){
-        fclose(var_log_f);
-        do {
-            // Create the full log file name and iterate the index.
-            snprintf(fname_buf, fname_buf_size, "%s_%d.log", var_name, var_index = dlgr_iterate_log_index(var_name));
-            // eprintf("File name: %s", fname_buf);
-            // While the log file of the next index exists and its size plus our variable's size is greater than the maximum allowable file size.
-            // Until the log file of the next index does not exist or the log file of the next index's size plus our variable's size is less than the maximum allowable file size.
-        } while ((var_log_f = fopen(fname_buf, "rb")) != NULL && CALCULATE_NEXT_FILE_SIZE > MAX_FILE_SIZE);
-        
-        // When we get here, var_log_f is CLOSED and the index indicates either
-        // A) a log file that does not yet exist, because the previous one is full, or
-        // B) a non-full log file.
-        // Here we open to append if it exists, or write if it doesn't.
-        if ((access(fname_buf, F_OK | R_OK)) == 0){
-            // File exists.
-            if((var_log_f = fopen(fname_buf, "ab")) == NULL){
-                eprintf("Failed to open %s.", fname_buf);
+        if(number_this_file > 0){
+            int var_log_fd = dlgr_open_segment_rows(var, segments[i].var_index, offset, number_this_file);
+            if(var_log_fd < 0){
+                // Past the first record, a missing segment is a gap like any other.
+                eprintf("Segment %d of %s has been removed.", segments[i].var_index, var->var_name);
+                DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+                if(number_read > 0){
+                    break;
+                }
+                dlgr_snapshot_free(&snapshot);
                 return -1;
             }
-        } else {
-            // File does not exist.
-            if((var_log_f = fopen(fname_buf, "wb")) == NULL){
-                eprintf("Failed to create %s.", fname_buf);
+            const size_t bytes = (size_t) number_this_file * var_size;
+            reads[num_reads++] = (dlgr_io_read_t){var_log_fd, &storage_ptr[(size_t) number_read * var_size], bytes, (off_t) offset * var_size, segments[i].var_index, 0};
+            number_read += number_this_file;
+        }
+
+        if(num_reads == DLGR_IO_READS){
+            if(dlgr_read_segments(&var, NULL, reads, num_reads) < 0){
+                dlgr_snapshot_free(&snapshot);
                 return -1;
             }
+            num_reads = 0;
         }
     }
-
-    // Write our data to the log file.
-    // int retval = fwrite(data, var_size, 1, var_log_f);
-    int retval = write(fileno(var_log_f), data, var_size);
-    if(retval <= 0){
-        eprintf("Write failed: Failed to write to %s: wrote %d bytes.", fname_buf, retval);
-        fclose(var_log_f);
+    if((num_reads > 0) && (dlgr_read_segments(&var, NULL, reads, num_reads) < 0)){
+        dlgr_snapshot_free(&snapshot);
+        return -1;
+    }
+    if(gap && (number_read == 0)){
+        eprintf("Record %lld of %s is missing.", first_seq, var->var_name);
+        DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+        dlgr_snapshot_free(&snapshot);
         return -1;
     }
 
-    // eprintf("Wrote %d bytes.", retval);
+    dlgr_snapshot_free(&snapshot);
+    DLGR_COUNT(var, reads, 1);
+    DLGR_COUNT(var, bytes_read, (unsigned long long) number_read * var_size);
+    return number_read;
+}
 
-    // Close the log file.
-    fclose(var_log_f);
-    sync();
+int dlgr_get_seq_range(int handle, long long* first_seq, long long* next_seq){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
 
-    // Check if we need to delete an old file and do so.
-    const int max_logs = MAX_LOG_SET_SIZE / MAX_FILE_SIZE;
-    snprintf(fname_buf, fname_buf_size, "%s_%d.log", var_name, var_index - max_logs);
-    // eprintf("Checking #%d.", var_index - max_logs);
-    if ((var_index >= max_logs) && (access(fname_buf, F_OK | R_OK) == 0)) {
-        // eprintf("DELETING #%d.", var_index - max_logs);
-        remove(fname_buf);
+    pthread_mutex_lock(&var->lock);
+    dlgr_update_head(var);
+    const dlgr_segment_info_t* head = &var->segments[var->num_segments - 1];
+    if(first_seq != NULL){
+        *first_seq = var->segments[0].first_seq;
+    }
+    if(next_seq != NULL){
+        *next_seq = head->first_seq + head->records;
     }
+    pthread_mutex_unlock(&var->lock);
 
-    // eprintf("Write finished.");
     return 1;
 }
 
-int dlgr_prime_read(const char* var_name, int number){
-    // Check if var_name is NULL.
-    if (var_name == NULL){
-        eprintf("Variable name is NULL.");
+int dlgr_find_segment(int handle, long long seq, dlgr_segment_info_t* segment, int* next_index){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
         return -1;
     }
 
-    // Check if number is invalid.
-    if (number <= 0){
-        eprintf("Number is invalid.");
-        return -1;
+    pthread_mutex_lock(&var->lock);
+    dlgr_update_head(var);
+    const dlgr_segment_info_t* head = &var->segments[var->num_segments - 1];
+    if(seq >= (head->first_seq + head->records)){
+        pthread_mutex_unlock(&var->lock);
+        return 0;
     }
 
-    const int fname_buf_size = strlen(var_name) + 17; // 16 == sizeof("_nnnnnnnnnn.log") + '\0'
-    int var_size = dlgr_check_registration(var_name, fname_buf_size);
-
-    char fname_buf[fname_buf_size];
-
-    int required_bytes = var_size * number;
+    // The last segment starting at or before seq.
+    int lo = 0, hi = var->num_segments - 1;
+    while(lo < hi){
+        const int mid = lo + ((hi - lo + 1) / 2);
+        if(var->segments[mid].first_seq <= seq){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    *segment = var->segments[lo];
+    *next_index = (lo + 1) < var->num_segments ? var->segments[lo + 1].var_index : -1;
+    pthread_mutex_unlock(&var->lock);
 
-    // Create the full read primer file name.
-    snprintf(fname_buf, fname_buf_size, "read_primer.tmp", var_name);
+    return 1;
+}
 
-    // Open the primer file.
-    FILE* var_primer_f = fopen(fname_buf, "w");
-    if(var_primer_f == NULL){
-        eprintf("Could not open %s.", fname_buf);
+int dlgr_check_registration(const char* var_name, const int fname_buf_size){
+    dlgr_var_t* var = dlgr_get_var(dlgr_get_handle(var_name));
+    if(var == NULL){
+        eprintf("Failed: %s has not been registered.", var_name);
         return -1;
     }
 
-    // Write the number of required bytes we calculated.
-    fprintf(var_primer_f, "%d\n%d\n%s", number, required_bytes, var_name);
+    pthread_mutex_lock(&var->lock);
+    int var_size = var->var_size;
+    pthread_mutex_unlock(&var->lock);
 
-    fclose(var_primer_f);
-    sync();
-    return required_bytes;
+    return var_size;
 }
 
-int dlgr_perform_read(void* storage, int allocated_bytes){
-    if(storage == NULL){
-        eprintf("Storage is NULL.");
+int dlgr_get_log_index(const char* var_name){
+    dlgr_var_t* var = dlgr_get_var(dlgr_get_handle(var_name));
+    if(var == NULL){
+        eprintf("Could not find the log index of %s.", var_name);
         return -1;
     }
 
-    unsigned char* storage_ptr = (unsigned char *) storage;
+    pthread_mutex_lock(&var->lock);
+    int var_index = var->var_index;
+    pthread_mutex_unlock(&var->lock);
 
-    if(allocated_bytes <= 0){
-        eprintf("Allocated bytes is invalid.");
+    return var_index;
+}
+
+// Returns new log index
+int dlgr_iterate_log_index(const char* var_name){
+    dlgr_var_t* var = dlgr_get_var(dlgr_get_handle(var_name));
+    if(var == NULL){
+        eprintf("Could not find the log index of %s.", var_name);
         return -1;
     }
 
-    const char* primer_fname_buf = "read_primer.tmp";
+    pthread_mutex_lock(&var->lock);
+    int retval = dlgr_rotate(var);
+    int var_index = var->var_index;
+    pthread_mutex_unlock(&var->lock);
 
-    if((access(primer_fname_buf, F_OK | R_OK)) != 0){
-        eprintf("No read is primed! Call DLGR_PRIME_READ(varname, number)");
+    if(retval < 0){
         return -1;
     }
 
-    FILE* var_primer_f = fopen(primer_fname_buf, "r");
-    if(var_primer_f == NULL){
-        eprintf("Could not open %s.", primer_fname_buf);
+    return var_index;
+}
+
+int dlgr_count_logs(const char* var_name){
+    dlgr_var_t* var = dlgr_get_var(dlgr_get_handle(var_name));
+    if(var == NULL){
+        eprintf("Could not find the logs of %s.", var_name);
         return -1;
     }
 
-    // Get our primed var_name and required bytes.
-    int number_requested = 0, required_bytes = 0;
-    char var_name[128];
-    fscanf(var_primer_f, "%d %d %s", &number_requested, &required_bytes, &var_name);
+    pthread_mutex_lock(&var->lock);
+    int log_count = var->num_segments;
+    pthread_mutex_unlock(&var->lock);
 
-    // Compare it to what we calculate now.
-    if(allocated_bytes != required_bytes){
-        eprintf("Cannot continue, descrepancy found between primed byte value (%d) and passed byte value (%d).", required_bytes, allocated_bytes);
+    return log_count;
+}
+
+int dlgr_set_default_durability(dlgr_durability_t durability){
+    if(!dlgr_valid_durability(durability)){
         return -1;
     }
-    
-    // Clean up.
-    fclose(var_primer_f);
-    remove(primer_fname_buf);
 
-    // At this point we are now ready to read from the logs.
+    pthread_mutex_lock(&dlgr_registry_lock);
+    dlgr_default_durability = durability;
+    const int num_vars = dlgr_num_vars;
+    pthread_mutex_unlock(&dlgr_registry_lock);
+
+    // Hand the new policy to every variable that inherits it.
+    for(int handle = 0; handle < num_vars; handle++){
+        dlgr_var_t* var = dlgr_vars[handle];
+        pthread_mutex_lock(&var->lock);
+        if(!var->durability_override){
+            var->durability = durability;
+            var->last_sync_ms = dlgr_monotonic_ms();
+        }
+        pthread_mutex_unlock(&var->lock);
+    }
 
-    // Establish the buffer size, get the variable size, check if the variable was registered, and create a filename buffer.
-    const int fname_buf_size = strlen(var_name) + 17; // 16 == sizeof("_nnnnnnnnnn.log") + '\0'
-    int var_size = dlgr_check_registration(var_name, fname_buf_size);
+    return dlgr_group_sync_start(durability);
+}
 
-    if((var_size * number_requested) != required_bytes){
-        eprintf("Variable size (%d) times the number requested (%d) does not equal the primed required bytes (%d).", var_size, number_requested, required_bytes);
+int dlgr_set_durability(int handle, dlgr_durability_t durability){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
         return -1;
     }
 
-    char fname_buf[fname_buf_size];
+    if(!dlgr_valid_durability(durability)){
+        return -1;
+    }
 
-    // Get current log index.
-    int var_index = dlgr_get_log_index(var_name);
+    pthread_mutex_lock(&var->lock);
+    var->durability = durability;
+    var->durability_override = 1;
+    var->last_sync_ms = dlgr_monotonic_ms();
+    pthread_mutex_unlock(&var->lock);
 
-    // Construct the log file name.
-    snprintf(fname_buf, fname_buf_size, "%s_%d.log", var_name, var_index);
+    return dlgr_group_sync_start(durability);
+}
 
-    // Read from logs.
+static int dlgr_valid_storage(dlgr_storage_t storage){
+    if((storage.segment_size < 0) || (storage.max_bytes < 0) || (storage.max_segments < 0) || (storage.max_age_ms < 0)){
+        eprintf("Storage limits (%d byte segments, %lld bytes, %d segments, %lld ms) invalid.", storage.segment_size, storage.max_bytes, storage.max_segments, storage.max_age_ms);
+        return 0;
+    }
+    return 1;
+}
 
-    FILE* var_log_f = fopen(fname_buf, "rb");
-    if(var_log_f == NULL){
-        eprintf("Cannot open %s.", fname_buf);
+int dlgr_set_default_storage(dlgr_storage_t storage){
+    if(!dlgr_valid_storage(storage)){
         return -1;
     }
 
-    // Go to end of file, pull back var_size bytes, read var_size bytes.
-    // Pull back 2*var_size bytes, read var_size bytes.
-    // etc
-    int number_read = 0, number_read_this_file = 0/*, retval = 0*/;
-    while(number_read < number_requested){
-        // eprintf("%d %d", number_read, number_read_this_file);
+    pthread_mutex_lock(&dlgr_registry_lock);
+    dlgr_default_storage = storage;
+    const int num_vars = dlgr_num_vars;
+    pthread_mutex_unlock(&dlgr_registry_lock);
+
+    // Hand the new limits to every variable that inherits them.
+    for(int handle = 0; handle < num_vars; handle++){
+        dlgr_var_t* var = dlgr_vars[handle];
+        pthread_mutex_lock(&var->lock);
+        if(!var->storage_override){
+            var->storage = storage;
+            dlgr_retain(var);
+        }
+        pthread_mutex_unlock(&var->lock);
+    }
 
-        fseek(var_log_f, -((number_read_this_file + 1) * var_size), SEEK_END);
-        /*retval = */ fread(&storage_ptr[number_read * var_size], var_size, 0x1, var_log_f);
-        // retval = read(fileno(var_log_f), &storage_ptr[number_read * var_size], var_size);
+    return 1;
+}
 
-        // eprintf("retval: %d", retval);
-        // eprintf("read: 0x%02x", storage_ptr[number_read * var_size]);
+int dlgr_set_storage(int handle, dlgr_storage_t storage){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
 
-        number_read++;
-        number_read_this_file++;
+    if(!dlgr_valid_storage(storage)){
+        return -1;
+    }
 
-        // If we just read the first variable in the file, seamlessly iterate back a log index.
-        // eprintf("ftell(var_log_f) - var_size: %d - %d = %d", ftell(var_log_f), var_size, ftell(var_log_f) - var_size);
-        if(((ftell(var_log_f) - var_size) == 0) /* && (var_index > 0)*/){
+    pthread_mutex_lock(&var->lock);
+    var->storage = storage;
+    var->storage_override = 1;
+    dlgr_retain(var);
+    pthread_mutex_unlock(&var->lock);
 
-            // If this then we're done, no more we can read.
-            if (var_index == 0){
-                // eprintf("Reached end of available data to read.");
-                break;
-            }
+    return 1;
+}
 
-            fclose(var_log_f);
-            var_index--;
-            snprintf(fname_buf, fname_buf_size, "%s_%d.log", var_name, var_index);
-            if((var_log_f = fopen(fname_buf, "rb")) == NULL){
-                eprintf("Failed to open %s.", fname_buf);
-                return -1;
-            }
-            number_read_this_file = 0;
+// Records the storage of var_name for when it is registered, and applies it now if it already is.
+static int dlgr_set_storage_by_name(const char* var_name, dlgr_storage_t storage){
+    pthread_mutex_lock(&dlgr_registry_lock);
+    int i = 0;
+    while((i < dlgr_num_settings) && (strcmp(dlgr_settings[i].var_name, var_name) != 0)){
+        i++;
+    }
+    if(i == dlgr_num_settings){
+        dlgr_setting_t* settings = realloc(dlgr_settings, (dlgr_num_settings + 1) * sizeof(dlgr_setting_t));
+        if(settings == NULL){
+            pthread_mutex_unlock(&dlgr_registry_lock);
+            eprintf("Could not allocate settings of %s.", var_name);
+            return -1;
         }
+        dlgr_settings = settings;
+        memset(&dlgr_settings[i], 0x0, sizeof(dlgr_setting_t));
+        snprintf(dlgr_settings[i].var_name, MAX_VAR_NAME_SIZE, "%s", var_name);
+        dlgr_num_settings++;
     }
+    dlgr_settings[i].storage = storage;
+    const int handle = dlgr_find_handle(var_name);
+    pthread_mutex_unlock(&dlgr_registry_lock);
 
-    fclose(var_log_f);
-    
-    return 1;
+    return handle >= 0 ? dlgr_set_storage(handle, storage) : 1;
 }
 
-int dlgr_check_registration(const char* var_name, const int fname_buf_size){
-    // Establish filename buffer and its size.
-    char fname_buf[fname_buf_size];
-
-    // Create the full registration file name, and check for registration.
-    snprintf(fname_buf, fname_buf_size, "%s.reg", var_name);
-    if((access(fname_buf, F_OK || R_OK)) != 0){
-        eprintf("Failed: %s has not been registered.", var_name);
+int dlgr_load_settings(const char* fname){
+    if(fname == NULL){
+        eprintf("Settings file name is NULL.");
         return -1;
     }
 
-    // Open the registration file.
-    FILE* var_registration_f = fopen(fname_buf, "r");
-    if(var_registration_f == NULL){
-        eprintf("Failed: Could not open %s.", fname_buf);
+    FILE* settings_f = fopen(fname, "r");
+    if(settings_f == NULL){
+        eprintf("Could not open %s for reading.", fname);
         return -1;
     }
 
-    // Get the variable size from the registration file.
-    int var_size = 0;
-    fscanf(var_registration_f, "%d", &var_size);
-    if(var_size <= 0){
-        eprintf("Failed: var_size invalid (%d).", var_size);
-        fclose(var_registration_f);
-        return -1;
-    }
+    char format[0x40];
+    snprintf(format, sizeof(format), "%%%ds %%i %%lli %%i %%lli", MAX_VAR_NAME_SIZE - 1);
 
-    // Close the registration file.
-    fclose(var_registration_f);
-    return var_size;
-}
+    char line[0x200];
+    int line_number = 0, number_applied = 0;
+    while(fgets(line, sizeof(line), settings_f) != NULL){
+        line_number++;
 
-int dlgr_get_log_index(const char* var_name){
-    const int fname_buf_size = strlen(var_name) + 5; // 5 == sizeof(".idx") + '\0'
-    char fname_buf[fname_buf_size];
+        // Skip blank lines and comments.
+        const char* start = line + strspn(line, " \t\r\n");
+        if((*start == '\0') || (*start == '#')){
+            continue;
+        }
 
-    snprintf(fname_buf, fname_buf_size, "%s.idx", var_name);
+        char var_name[MAX_VAR_NAME_SIZE];
+        dlgr_storage_t storage = {0};
+        if(sscanf(start, format, var_name, &storage.segment_size, &storage.max_bytes, &storage.max_segments, &storage.max_age_ms) < 3){
+            eprintf("%s, line %d: expected \"name segment_size max_bytes [max_segments [max_age_ms]]\".", fname, line_number);
+            fclose(settings_f);
+            return -1;
+        }
 
-    // Open index file.
-    FILE* var_index_f = fopen(fname_buf, "r");
-    if(var_index_f == NULL){
-        eprintf("Could not open %s for reading.", fname_buf);
+        const int retval = strcmp(var_name, "*") == 0 ? dlgr_set_default_storage(storage) : dlgr_set_storage_by_name(var_name, storage);
+        if(retval < 0){
+            eprintf("%s, line %d: could not apply settings of %s.", fname, line_number, var_name);
+            fclose(settings_f);
+            return -1;
+        }
+        number_applied++;
+    }
+
+    fclose(settings_f);
+    return number_applied;
+}
+
+int dlgr_flush(int handle){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
         return -1;
     }
 
-    // Read the index.
-    int var_index = 0;
-    fscanf(var_index_f, "%d", &var_index);
+    dlgr_async_flush();
 
-    fclose(var_index_f);
+    pthread_mutex_lock(&var->lock);
+    int retval = dlgr_sync_segment(var);
+    if(dlgr_settle_manifest(var) < 0){
+        retval = -1;
+    }
+    pthread_mutex_unlock(&var->lock);
 
-    return var_index;
+    return retval;
 }
 
-// Returns new log index
-int dlgr_iterate_log_index(const char* var_name){
-    const int fname_buf_size = strlen(var_name) + 5; // 5 == sizeof(".idx") + '\0'
-    char fname_buf[fname_buf_size];
+int dlgr_flush_all(void){
+    pthread_mutex_lock(&dlgr_registry_lock);
+    const int num_vars = dlgr_num_vars;
+    pthread_mutex_unlock(&dlgr_registry_lock);
 
-    snprintf(fname_buf, fname_buf_size, "%s.idx", var_name);
+    int retval = 1;
+    for(int handle = 0; handle < num_vars; handle++){
+        if(dlgr_flush(handle) < 0){
+            retval = -1;
+        }
+    }
 
-    // Open index file.
-    FILE* var_index_f = fopen(fname_buf, "r");
-    if(var_index_f == NULL){
-        eprintf("Could not open %s for reading.", fname_buf);
+    return retval;
+}
+
+int dlgr_close(int handle){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
         return -1;
     }
 
-    // Read the index.
-    int var_index = 0;
-    fscanf(var_index_f, "%d", &var_index);
+    pthread_mutex_lock(&var->lock);
+    int retval = dlgr_sync_segment(var);
+    dlgr_close_segment(var);
+    dlgr_drop_spare(var);
+    if(dlgr_settle_manifest(var) < 0){
+        retval = -1;
+    }
+    pthread_mutex_unlock(&var->lock);
 
-    fclose(var_index_f);
+    return retval;
+}
 
-    var_index++;
+int dlgr_shutdown(void){
+    dlgr_async_stop();
 
-    var_index_f = fopen(fname_buf, "w");
-    if(var_index_f == NULL){
-        eprintf("Could not open %s for writing.", fname_buf);
-        return -1;
-    }
+    pthread_mutex_lock(&dlgr_registry_lock);
+    const int num_vars = dlgr_num_vars;
+    pthread_mutex_unlock(&dlgr_registry_lock);
 
-    // Write the iterated index to the idx file.
-    int retval = fprintf(var_index_f, "%d", var_index);
-    if(retval <= 0){
-        eprintf("Writing to index file failed with value %d.", retval);
-        fclose(var_index_f);
-        return -1;
+    int retval = 1;
+    for(int handle = 0; handle < num_vars; handle++){
+        if(dlgr_close(handle) < 0){
+            retval = -1;
+        }
     }
 
-    fclose(var_index_f);
+    // Move everything out of the hot directory, the closed current segments last.
+    if(dlgr_migrate_flush() > 0){
+        for(int handle = 0; handle < num_vars; handle++){
+            dlgr_var_t* var = dlgr_vars[handle];
+            pthread_mutex_lock(&var->lock);
+            const int var_index = var->var_index;
+            const int hot = dlgr_segment_hot(var);
+            pthread_mutex_unlock(&var->lock);
+            if(hot && (dlgr_migrate_segment(var, var_index) < 0)){
+                retval = -1;
+            }
+        }
+    }
 
-    return var_index;
+    return retval;
 }
-
-int dlgr_count_logs(const char* var_name){
-    const int fname_buf_size = strlen(var_name) + 17; // 16 == sizeof("_nnnnnnnnnn.log") + '\0'
-    char fname_buf[fname_buf_size];
-    int log_count = 0;
-    for(int var_index = dlgr_get_log_index(var_name); FILE_EXISTS; log_count++);
-
-    return log_count;
-}
\ No newline at end of file
@@ -0,0 +1,538 @@
+/**
+ * @file datalogger_async.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Asynchronous logging: a lock-free ring buffer drained by a background writer thread.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#define _GNU_SOURCE // qsort_r()
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Ring layout
+/* The ring is a bounded multi-producer multi-consumer queue (D. Vyukov) of fixed-size slots.
+ * Each slot carries up to slot_size bytes of records of a single variable, tagged with its handle, followed by their timestamps if the variable is timestamped.
+ * Producers claim a slot by advancing enqueue_pos, the writer thread claims one by advancing dequeue_pos.
+ * A slot's seq tells whose turn it is, so neither side ever takes a lock.
+ * Producers also dequeue, and discard, the oldest slot under DLGR_OVERFLOW_DROP_OLDEST.
+ */
+
+#define DLGR_ASYNC_DRAIN_MAX 0x100 // Slots the writer drains per pass.
+#define DLGR_ASYNC_IDLE_MS 100 // Longest the writer sleeps when the ring is empty.
+
+typedef struct
+{
+    atomic_size_t seq;
+    int handle;
+    int count; // Records in data.
+    int bytes; // Bytes of records in data, the timestamps follow them.
+    int timestamped; // Set if data holds count timestamps after the records.
+    unsigned char data[];
+} dlgr_slot_t;
+
+typedef struct
+{
+    dlgr_async_config_t config;
+    size_t slot_stride;
+    size_t mask;
+    unsigned char* slots;
+
+    _Alignas(64) atomic_size_t enqueue_pos;
+    _Alignas(64) atomic_size_t dequeue_pos;
+    _Alignas(64) atomic_size_t written_pos; // Every slot before this position has been written or dropped, for flush barriers.
+
+    atomic_int writer_sleeping;
+    sem_t wakeup;
+    atomic_int stopping;
+
+    pthread_t writer;
+
+    // Flush barriers wait here for the writer to finish a pass.
+    pthread_mutex_t barrier_lock;
+    pthread_cond_t barrier_cond;
+
+    // Writer thread scratch space.
+    unsigned char* staging;
+    unsigned char* coalesce;
+    long long* coalesce_ts;
+    int* order;
+    dlgr_var_t** locked; // Variables held until the writes of a batched pass complete.
+
+    atomic_ullong enqueued;
+    atomic_ullong written;
+    atomic_ullong dropped_oldest;
+    atomic_ullong dropped_newest;
+    atomic_ullong blocked;
+    atomic_ullong write_errors;
+} dlgr_ring_t;
+
+// The running ring, NULL when logging is synchronous.
+static _Atomic(dlgr_ring_t*) dlgr_ring = NULL;
+
+// Producers currently inside dlgr_async_enqueue(); dlgr_async_stop() waits for them before freeing the ring.
+static atomic_int dlgr_ring_users = 0;
+
+// Serializes dlgr_async_start() and dlgr_async_stop().
+static pthread_mutex_t dlgr_async_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline dlgr_slot_t* dlgr_ring_slot(dlgr_ring_t* ring, size_t pos){
+    return (dlgr_slot_t*) &ring->slots[(pos & ring->mask) * ring->slot_stride];
+}
+
+// Claims the next free slot, returns NULL if the ring is full.
+static dlgr_slot_t* dlgr_ring_claim(dlgr_ring_t* ring, size_t* pos_out){
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    for(;;){
+        dlgr_slot_t* slot = dlgr_ring_slot(ring, pos);
+        intptr_t diff = (intptr_t) atomic_load_explicit(&slot->seq, memory_order_acquire) - (intptr_t) pos;
+        if(diff == 0){
+            if(atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)){
+                *pos_out = pos;
+                return slot;
+            }
+        } else if(diff < 0){
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// Hands a claimed slot to the consumers.
+static inline void dlgr_ring_publish(dlgr_slot_t* slot, size_t pos){
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+// Takes the oldest published slot, returns NULL if there is none.
+static dlgr_slot_t* dlgr_ring_take(dlgr_ring_t* ring, size_t* pos_out){
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    for(;;){
+        dlgr_slot_t* slot = dlgr_ring_slot(ring, pos);
+        intptr_t diff = (intptr_t) atomic_load_explicit(&slot->seq, memory_order_acquire) - (intptr_t) (pos + 1);
+        if(diff == 0){
+            if(atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)){
+                *pos_out = pos;
+                return slot;
+            }
+        } else if(diff < 0){
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// Returns a taken slot to the producers.
+static inline void dlgr_ring_release(dlgr_ring_t* ring, dlgr_slot_t* slot, size_t pos){
+    atomic_store_explicit(&slot->seq, pos + ring->mask + 1, memory_order_release);
+}
+
+// Pairs with the fence of the writer going to sleep: either it sees the slot published, or this sees it sleeping.
+static void dlgr_ring_wake_writer(dlgr_ring_t* ring){
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&ring->writer_sleeping, memory_order_relaxed) && atomic_exchange(&ring->writer_sleeping, 0)){
+        sem_post(&ring->wakeup);
+    }
+}
+
+// Copies up to count records into one slot, applying the overflow policy if the ring is full. Returns the number of records consumed (possibly dropped).
+static int dlgr_ring_put(dlgr_ring_t* ring, int handle, const unsigned char* data, const long long* timestamps, long long now, int count, int var_size, int timestamped){
+    const int per_slot = ring->config.slot_size / (var_size + (timestamped ? (int) sizeof(long long) : 0));
+    const int number = count < per_slot ? count : per_slot;
+
+    size_t pos;
+    dlgr_slot_t* slot;
+    int blocked = 0;
+    while((slot = dlgr_ring_claim(ring, &pos)) == NULL){
+        switch(ring->config.overflow){
+            case DLGR_OVERFLOW_DROP_NEWEST:
+                atomic_fetch_add_explicit(&ring->dropped_newest, number, memory_order_relaxed);
+                dlgr_ring_wake_writer(ring);
+                return number;
+            case DLGR_OVERFLOW_DROP_OLDEST: {
+                size_t old_pos;
+                dlgr_slot_t* old_slot = dlgr_ring_take(ring, &old_pos);
+                if(old_slot != NULL){
+                    atomic_fetch_add_explicit(&ring->dropped_oldest, old_slot->count, memory_order_relaxed);
+                    dlgr_ring_release(ring, old_slot, old_pos);
+                }
+                break;
+            }
+            default:
+                if(!blocked){
+                    blocked = 1;
+                    atomic_fetch_add_explicit(&ring->blocked, 1, memory_order_relaxed);
+                }
+                dlgr_ring_wake_writer(ring);
+                sched_yield();
+                break;
+        }
+    }
+
+    slot->handle = handle;
+    slot->count = number;
+    slot->bytes = number * var_size;
+    slot->timestamped = timestamped;
+    memcpy(slot->data, data, slot->bytes);
+    if(timestamped){
+        unsigned char* slot_ts = &slot->data[slot->bytes];
+        for(int i = 0; i < number; i++){
+            memcpy(&slot_ts[i * sizeof(long long)], timestamps ? &timestamps[i] : &now, sizeof(long long));
+        }
+    }
+    dlgr_ring_publish(slot, pos);
+
+    atomic_fetch_add_explicit(&ring->enqueued, number, memory_order_relaxed);
+    dlgr_ring_wake_writer(ring);
+    return number;
+}
+
+// Orders drained slots of ring by handle, keeping arrival order within a handle.
+static int dlgr_compare_slots(const void* a, const void* b, void* arg){
+    const dlgr_ring_t* ring = (const dlgr_ring_t*) arg;
+    const int ia = *(const int*) a, ib = *(const int*) b;
+    const dlgr_slot_t* sa = (const dlgr_slot_t*) &ring->staging[ia * ring->slot_stride];
+    const dlgr_slot_t* sb = (const dlgr_slot_t*) &ring->staging[ib * ring->slot_stride];
+    if(sa->handle != sb->handle){
+        return sa->handle < sb->handle ? -1 : 1;
+    }
+    return ia - ib;
+}
+
+// Writes drained slots to their logs, coalescing all records of a handle into one append.
+// Under DLGR_IO_URING the appends of the pass are batched, see datalogger_io.c, and each variable stays locked until
+// its records are written; in handle order, as dlgr_read_multi() locks them, and no other thread holds more than one.
+// Their syncs are waited on after the locks are released.
+static void dlgr_ring_write_out(dlgr_ring_t* ring, int number_drained){
+    for(int i = 0; i < number_drained; i++){
+        ring->order[i] = i;
+    }
+    qsort_r(ring->order, number_drained, sizeof(int), dlgr_compare_slots, ring);
+
+    const int batched = dlgr_io_batch_begin() > 0;
+    int num_locked = 0;
+
+    int i = 0;
+    while(i < number_drained){
+        const dlgr_slot_t* first = (const dlgr_slot_t*) &ring->staging[ring->order[i] * ring->slot_stride];
+        const int handle = first->handle;
+
+        size_t bytes = 0;
+        int count = 0;
+        int timestamped = 0;
+        for(; i < number_drained; i++){
+            const dlgr_slot_t* slot = (const dlgr_slot_t*) &ring->staging[ring->order[i] * ring->slot_stride];
+            if(slot->handle != handle){
+                break;
+            }
+            memcpy(&ring->coalesce[bytes], slot->data, slot->bytes);
+            if(slot->timestamped){
+                memcpy(&ring->coalesce_ts[count], &slot->data[slot->bytes], slot->count * sizeof(long long));
+                timestamped = 1;
+            }
+            bytes += slot->bytes;
+            count += slot->count;
+        }
+
+        dlgr_var_t* var = dlgr_get_var(handle);
+        int retval = -1;
+        if(var != NULL){
+            pthread_mutex_lock(&var->lock);
+            retval = dlgr_append(var, ring->coalesce, timestamped ? ring->coalesce_ts : NULL, count);
+            if(batched){
+                ring->locked[num_locked++] = var;
+            } else {
+                pthread_mutex_unlock(&var->lock);
+            }
+        }
+
+        if(retval < 0){
+            eprintf("Asynchronous write of %d records to handle %d failed.", count, handle);
+            atomic_fetch_add_explicit(&ring->write_errors, 1, memory_order_relaxed);
+        } else {
+            atomic_fetch_add_explicit(&ring->written, count, memory_order_relaxed);
+        }
+    }
+
+    // Failed writes are counted against their variables.
+    if(batched && (dlgr_io_batch_end() < 0)){
+        atomic_fetch_add_explicit(&ring->write_errors, 1, memory_order_relaxed);
+    }
+    for(int j = 0; j < num_locked; j++){
+        pthread_mutex_unlock(&ring->locked[j]->lock);
+    }
+    if(batched && (dlgr_io_batch_sync() < 0)){
+        atomic_fetch_add_explicit(&ring->write_errors, 1, memory_order_relaxed);
+    }
+}
+
+static void* dlgr_writer_thread(void* arg){
+    dlgr_ring_t* ring = (dlgr_ring_t*) arg;
+
+    for(;;){
+        // Drain a pass worth of slots into staging, freeing them for producers right away.
+        int number_drained = 0;
+        size_t pos;
+        dlgr_slot_t* slot;
+        while((number_drained < DLGR_ASYNC_DRAIN_MAX) && ((slot = dlgr_ring_take(ring, &pos)) != NULL)){
+            memcpy(&ring->staging[number_drained * ring->slot_stride], slot, sizeof(dlgr_slot_t) + slot->bytes + (slot->timestamped ? slot->count * sizeof(long long) : 0));
+            dlgr_ring_release(ring, slot, pos);
+            number_drained++;
+        }
+        // Slots before here were either drained above or dropped by a producer.
+        const size_t drained_pos = atomic_load(&ring->dequeue_pos);
+
+        if(number_drained > 0){
+            dlgr_ring_write_out(ring, number_drained);
+        }
+
+        if(atomic_load(&ring->written_pos) != drained_pos){
+            atomic_store_explicit(&ring->written_pos, drained_pos, memory_order_release);
+
+            pthread_mutex_lock(&ring->barrier_lock);
+            pthread_cond_broadcast(&ring->barrier_cond);
+            pthread_mutex_unlock(&ring->barrier_lock);
+        }
+
+        if(number_drained > 0){
+            continue;
+        }
+
+        // Nothing to do. Exit once stopping and every claimed slot has been written.
+        if(atomic_load(&ring->stopping) && (drained_pos == atomic_load(&ring->enqueue_pos))){
+            break;
+        }
+
+        // Sleep until a producer posts, re-checking the ring after announcing ourselves to avoid a lost wakeup.
+        atomic_store(&ring->writer_sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if(atomic_load_explicit(&dlgr_ring_slot(ring, atomic_load(&ring->dequeue_pos))->seq, memory_order_acquire) == (atomic_load(&ring->dequeue_pos) + 1)){
+            atomic_store(&ring->writer_sleeping, 0);
+            continue;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += DLGR_ASYNC_IDLE_MS * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while((sem_timedwait(&ring->wakeup, &deadline) != 0) && (errno == EINTR));
+        atomic_store(&ring->writer_sleeping, 0);
+    }
+
+    return NULL;
+}
+
+// Waits until every slot claimed before the call has been written or dropped.
+static void dlgr_ring_barrier(dlgr_ring_t* ring){
+    const size_t target = atomic_load(&ring->enqueue_pos);
+
+    pthread_mutex_lock(&ring->barrier_lock);
+    while(atomic_load_explicit(&ring->written_pos, memory_order_acquire) < target){
+        dlgr_ring_wake_writer(ring);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 10 * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&ring->barrier_cond, &ring->barrier_lock, &deadline);
+    }
+    pthread_mutex_unlock(&ring->barrier_lock);
+}
+
+static void dlgr_ring_free(dlgr_ring_t* ring){
+    sem_destroy(&ring->wakeup);
+    pthread_mutex_destroy(&ring->barrier_lock);
+    pthread_cond_destroy(&ring->barrier_cond);
+    free(ring->slots);
+    free(ring->staging);
+    free(ring->coalesce);
+    free(ring->coalesce_ts);
+    free(ring->order);
+    free(ring->locked);
+    free(ring);
+}
+
+int dlgr_async_start(dlgr_async_config_t config){
+    // Check if capacity is a power of two.
+    if((config.capacity < 2) || ((config.capacity & (config.capacity - 1)) != 0)){
+        eprintf("Ring capacity %d invalid, must be a power of two.", config.capacity);
+        return -1;
+    }
+
+    if((config.slot_size < 1) || (config.slot_size > MAX_VAR_SIZE)){
+        eprintf("Slot size %d invalid.", config.slot_size);
+        return -1;
+    }
+
+    if((config.overflow < DLGR_OVERFLOW_BLOCK) || (config.overflow > DLGR_OVERFLOW_DROP_NEWEST)){
+        eprintf("Overflow policy %d invalid.", config.overflow);
+        return -1;
+    }
+
+    pthread_mutex_lock(&dlgr_async_lock);
+
+    if(atomic_load(&dlgr_ring) != NULL){
+        eprintf("Asynchronous logging is already running.");
+        pthread_mutex_unlock(&dlgr_async_lock);
+        return -1;
+    }
+
+    dlgr_ring_t* ring = calloc(1, sizeof(dlgr_ring_t));
+    if(ring == NULL){
+        eprintf("Could not allocate ring.");
+        pthread_mutex_unlock(&dlgr_async_lock);
+        return -1;
+    }
+
+    ring->config = config;
+    ring->slot_stride = (sizeof(dlgr_slot_t) + config.slot_size + 63) & ~(size_t) 63;
+    ring->mask = config.capacity - 1;
+    ring->slots = aligned_alloc(64, ring->slot_stride * config.capacity);
+    ring->staging = malloc(ring->slot_stride * DLGR_ASYNC_DRAIN_MAX);
+    ring->coalesce = malloc((size_t) config.slot_size * DLGR_ASYNC_DRAIN_MAX);
+    ring->coalesce_ts = malloc((size_t) config.slot_size * DLGR_ASYNC_DRAIN_MAX);
+    ring->order = malloc(sizeof(int) * DLGR_ASYNC_DRAIN_MAX);
+    ring->locked = malloc(sizeof(dlgr_var_t*) * DLGR_ASYNC_DRAIN_MAX);
+    if((ring->slots == NULL) || (ring->staging == NULL) || (ring->coalesce == NULL) || (ring->coalesce_ts == NULL) || (ring->order == NULL) || (ring->locked == NULL)){
+        eprintf("Could not allocate a ring of %d slots of %d bytes.", config.capacity, config.slot_size);
+        free(ring->slots);
+        free(ring->staging);
+        free(ring->coalesce);
+        free(ring->coalesce_ts);
+        free(ring->order);
+        free(ring->locked);
+        free(ring);
+        pthread_mutex_unlock(&dlgr_async_lock);
+        return -1;
+    }
+
+    for(size_t pos = 0; pos < (size_t) config.capacity; pos++){
+        atomic_init(&dlgr_ring_slot(ring, pos)->seq, pos);
+    }
+
+    sem_init(&ring->wakeup, 0, 0);
+    pthread_mutex_init(&ring->barrier_lock, NULL);
+    pthread_cond_init(&ring->barrier_cond, NULL);
+
+    if(pthread_create(&ring->writer, NULL, dlgr_writer_thread, ring) != 0){
+        eprintf("Could not start the writer thread.");
+        dlgr_ring_free(ring);
+        pthread_mutex_unlock(&dlgr_async_lock);
+        return -1;
+    }
+
+    atomic_store(&dlgr_ring, ring);
+
+    pthread_mutex_unlock(&dlgr_async_lock);
+    return 1;
+}
+
+int dlgr_async_stop(void){
+    pthread_mutex_lock(&dlgr_async_lock);
+
+    dlgr_ring_t* ring = atomic_exchange(&dlgr_ring, NULL);
+    if(ring == NULL){
+        pthread_mutex_unlock(&dlgr_async_lock);
+        return 1;
+    }
+
+    // New writes now go straight to disk. Wait for producers still inside the ring.
+    while(atomic_load(&dlgr_ring_users) > 0){
+        sched_yield();
+    }
+
+    atomic_store(&ring->stopping, 1);
+    sem_post(&ring->wakeup);
+    pthread_join(ring->writer, NULL);
+
+    dlgr_ring_free(ring);
+
+    pthread_mutex_unlock(&dlgr_async_lock);
+    return 1;
+}
+
+int dlgr_async_flush(void){
+    atomic_fetch_add(&dlgr_ring_users, 1);
+    dlgr_ring_t* ring = atomic_load(&dlgr_ring);
+    if(ring != NULL){
+        dlgr_ring_barrier(ring);
+    }
+    atomic_fetch_sub(&dlgr_ring_users, 1);
+
+    return 1;
+}
+
+int dlgr_async_enqueue(int handle, const void* data, const long long* timestamps, int count, int var_size, int timestamped){
+    atomic_fetch_add(&dlgr_ring_users, 1);
+
+    dlgr_ring_t* ring = atomic_load(&dlgr_ring);
+    if(ring == NULL){
+        atomic_fetch_sub(&dlgr_ring_users, 1);
+        return 0;
+    }
+
+    // Records too large for a slot are written synchronously, after everything queued before them.
+    if((var_size + (timestamped ? (int) sizeof(long long) : 0)) > ring->config.slot_size){
+        dlgr_ring_barrier(ring);
+        atomic_fetch_sub(&dlgr_ring_users, 1);
+        return 0;
+    }
+
+    // Stamp records now, not when the writer gets to them.
+    const long long now = (timestamped && (timestamps == NULL)) ? dlgr_time_now() : 0;
+
+    const unsigned char* data_ptr = (const unsigned char*) data;
+    int number_queued = 0;
+    while(number_queued < count){
+        number_queued += dlgr_ring_put(ring, handle, &data_ptr[(size_t) number_queued * var_size], timestamps ? &timestamps[number_queued] : NULL, now, count - number_queued, var_size, timestamped);
+    }
+
+    atomic_fetch_sub(&dlgr_ring_users, 1);
+    return 1;
+}
+
+int dlgr_async_stats(dlgr_async_stats_t* stats){
+    if(stats == NULL){
+        eprintf("Stats is NULL.");
+        return -1;
+    }
+
+    memset(stats, 0x0, sizeof(dlgr_async_stats_t));
+
+    atomic_fetch_add(&dlgr_ring_users, 1);
+    dlgr_ring_t* ring = atomic_load(&dlgr_ring);
+    if(ring != NULL){
+        stats->enqueued = atomic_load(&ring->enqueued);
+        stats->written = atomic_load(&ring->written);
+        stats->dropped_oldest = atomic_load(&ring->dropped_oldest);
+        stats->dropped_newest = atomic_load(&ring->dropped_newest);
+        stats->blocked = atomic_load(&ring->blocked);
+        stats->write_errors = atomic_load(&ring->write_errors);
+    }
+    atomic_fetch_sub(&dlgr_ring_users, 1);
+
+    return ring != NULL ? 1 : 0;
+}
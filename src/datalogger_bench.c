@@ -0,0 +1,479 @@
+/**
+ * @file datalogger_bench.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Write and read throughput and latency benchmark, built by make bench.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Usage: datalogger_bench.out [-j] [-q] [-a] [-U] [-d dir] [-H hot_dir] [-s var_sizes] [-g segment_sizes] [-n records] [-v vars] [-t threads] [-y durabilities]
+// Every dimension takes a comma-separated list and the benchmark runs each combination. Output is one CSV row (or
+// JSON object with -j) per operation per combination, on stdout; library messages go to stderr. With -H, current
+// segments are written to hot_dir, ie a tmpfs, see dlgr_set_hot_dir(). With -a, writes go through the ring of
+// dlgr_async_start(), write times include draining it, and rotations are not reported as the writer thread does them;
+// -U selects DLGR_IO_URING, see dlgr_set_io_backend().
+
+#define BENCH_MAX_LIST 0x10
+#define BENCH_READS 0x400 // Reads of each kind per combination.
+#define BENCH_LATEST_COUNT 0x40 // Records per newest-N read.
+#define BENCH_RANGE_COUNT 0x100 // Records per range read.
+#define BENCH_MAX_SEGMENTS 0x10 // Retention, so long sweeps don't fill the disk.
+#define BENCH_RING_CAPACITY 0x1000 // Slots of the ring with -a.
+#define BENCH_RING_SLOT_SIZE 0x1000 // Bytes per slot with -a, enough for the default var_sizes.
+
+typedef struct
+{
+    long long values[BENCH_MAX_LIST];
+    int count;
+} bench_list_t;
+
+typedef struct
+{
+    int var_size;
+    int segment_size;
+    long long records; // Per variable.
+    int vars;
+    int threads;
+    dlgr_sync_mode_t durability;
+} bench_config_t;
+
+// Latencies of one operation, in ns.
+typedef struct
+{
+    long long* samples;
+    long long count;
+    long long capacity;
+} bench_samples_t;
+
+typedef struct
+{
+    const bench_config_t* config;
+    const int* handles;
+    int first_var; // Variables first_var, first_var + threads, ... belong to this thread.
+    pthread_barrier_t* start;
+    bench_samples_t writes;
+    bench_samples_t rotations;
+    double seconds;
+} bench_writer_t;
+
+static int bench_json = 0;
+static int bench_async = 0;
+static const char* bench_dir = "bench_data";
+static const char* bench_hot_dir = NULL;
+static int bench_rows = 0;
+
+static long long bench_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static int bench_push(bench_samples_t* samples, long long ns){
+    if(samples->count == samples->capacity){
+        const long long new_capacity = samples->capacity ? samples->capacity * 2 : 0x400;
+        long long* new_samples = realloc(samples->samples, new_capacity * sizeof(long long));
+        if(new_samples == NULL){
+            return -1;
+        }
+        samples->samples = new_samples;
+        samples->capacity = new_capacity;
+    }
+    samples->samples[samples->count++] = ns;
+    return 1;
+}
+
+static int bench_compare(const void* a, const void* b){
+    const long long x = *(const long long*) a, y = *(const long long*) b;
+    return (x > y) - (x < y);
+}
+
+static long long bench_percentile(const bench_samples_t* samples, double p){
+    if(samples->count == 0){
+        return 0;
+    }
+    return samples->samples[(long long) ((samples->count - 1) * p)];
+}
+
+static const char* bench_durability_name(dlgr_sync_mode_t mode){
+    switch(mode){
+        case DLGR_SYNC_NONE:
+            return "none";
+        case DLGR_SYNC_EVERY:
+            return "every";
+        case DLGR_SYNC_GROUP:
+            return "group";
+        case DLGR_SYNC_ROTATE:
+            return "rotate";
+        default:
+            return "unknown";
+    }
+}
+
+// Prints one result row. operations may differ from the samples, ie a write of a batch.
+static void bench_report(const bench_config_t* config, const char* op, bench_samples_t* samples, long long operations, long long bytes, double seconds){
+    qsort(samples->samples, samples->count, sizeof(long long), bench_compare);
+    const double ops_per_s = seconds > 0 ? operations / seconds : 0;
+    const double mb_per_s = seconds > 0 ? (bytes / seconds) / 1e6 : 0;
+    const long long max = samples->count ? samples->samples[samples->count - 1] : 0;
+
+    if(bench_json){
+        printf("%s  {\"var_size\": %d, \"segment_size\": %d, \"records\": %lld, \"vars\": %d, \"threads\": %d, \"durability\": \"%s\", "
+            "\"op\": \"%s\", \"count\": %lld, \"seconds\": %.6f, \"ops_per_s\": %.1f, \"mb_per_s\": %.3f, "
+            "\"p50_ns\": %lld, \"p99_ns\": %lld, \"p999_ns\": %lld, \"max_ns\": %lld}",
+            bench_rows ? ",\n" : "", config->var_size, config->segment_size, config->records, config->vars, config->threads, bench_durability_name(config->durability),
+            op, operations, seconds, ops_per_s, mb_per_s,
+            bench_percentile(samples, 0.5), bench_percentile(samples, 0.99), bench_percentile(samples, 0.999), max);
+    } else {
+        printf("%d,%d,%lld,%d,%d,%s,%s,%lld,%.6f,%.1f,%.3f,%lld,%lld,%lld,%lld\n",
+            config->var_size, config->segment_size, config->records, config->vars, config->threads, bench_durability_name(config->durability),
+            op, operations, seconds, ops_per_s, mb_per_s,
+            bench_percentile(samples, 0.5), bench_percentile(samples, 0.99), bench_percentile(samples, 0.999), max);
+    }
+    fflush(stdout);
+    bench_rows++;
+}
+
+static void* bench_write_thread(void* arg){
+    bench_writer_t* writer = (bench_writer_t*) arg;
+    const bench_config_t* config = writer->config;
+    unsigned char* record = calloc(1, config->var_size);
+    if(record == NULL){
+        return NULL;
+    }
+
+    // Rotations are the writes that moved a variable to a new segment, as counted by dlgr_stats(). The counter is
+    // sampled after each write is timed, and the time spent sampling is taken out of the write time. Under -a the
+    // writer thread rotates, not the write, so there is nothing to attribute.
+    unsigned long long rotations[config->vars];
+    dlgr_stats_t stats;
+    for(int var = writer->first_var; !bench_async && (var < config->vars); var += config->threads){
+        dlgr_stats(writer->handles[var], &stats);
+        rotations[var] = stats.rotations;
+    }
+
+    pthread_barrier_wait(writer->start);
+    long long sampling_ns = 0;
+    const long long start = bench_now_ns();
+    for(long long r = 0; r < config->records; r++){
+        for(int var = writer->first_var; var < config->vars; var += config->threads){
+            memcpy(record, &r, config->var_size < (int) sizeof(r) ? config->var_size : (int) sizeof(r));
+            const long long t0 = bench_now_ns();
+            dlgr_write_handle(writer->handles[var], record);
+            const long long t1 = bench_now_ns();
+            bench_push(&writer->writes, t1 - t0);
+
+            if(!bench_async){
+                dlgr_stats(writer->handles[var], &stats);
+                if(stats.rotations != rotations[var]){
+                    rotations[var] = stats.rotations;
+                    bench_push(&writer->rotations, t1 - t0);
+                }
+                sampling_ns += bench_now_ns() - t1;
+            }
+        }
+    }
+    writer->seconds = (bench_now_ns() - start - sampling_ns) / 1e9;
+
+    free(record);
+    return NULL;
+}
+
+// Removes the files of variables whose names start with prefix.
+static void bench_clean(const char* dir_name, const char* prefix){
+    DIR* dir = opendir(dir_name);
+    if(dir == NULL){
+        return;
+    }
+    char fname_buf[0x400];
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL){
+        if(strncmp(entry->d_name, prefix, strlen(prefix)) == 0){
+            snprintf(fname_buf, sizeof(fname_buf), "%s/%s", dir_name, entry->d_name);
+            unlink(fname_buf);
+        }
+    }
+    closedir(dir);
+}
+
+// Runs one combination, on variables of its own: registering the same name again would keep its history.
+static int bench_run(const bench_config_t* config, int index){
+    char prefix[0x20];
+    snprintf(prefix, sizeof(prefix), "b%d_", index);
+
+    int handles[config->vars];
+    char names[config->vars][MAX_VAR_NAME_SIZE];
+    for(int var = 0; var < config->vars; var++){
+        snprintf(names[var], MAX_VAR_NAME_SIZE, "%sv%d", prefix, var);
+        if((handles[var] = dlgr_register(names[var], config->var_size)) < 0){
+            return -1;
+        }
+        dlgr_set_storage(handles[var], (dlgr_storage_t){.segment_size = config->segment_size, .max_segments = BENCH_MAX_SEGMENTS});
+        dlgr_set_durability(handles[var], (dlgr_durability_t){config->durability, 0x40, 0x10});
+    }
+
+    // Writes, by threads each owning some variables.
+    const int threads = config->threads < config->vars ? config->threads : config->vars;
+    bench_config_t run = *config;
+    run.threads = threads;
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, threads);
+    bench_writer_t writers[threads];
+    pthread_t tids[threads];
+    memset(writers, 0x0, sizeof(writers));
+    const long long write_start = bench_now_ns();
+    for(int i = 0; i < threads; i++){
+        writers[i].config = &run;
+        writers[i].handles = handles;
+        writers[i].first_var = i;
+        writers[i].start = &start;
+        pthread_create(&tids[i], NULL, bench_write_thread, &writers[i]);
+    }
+    double seconds = 0;
+    bench_samples_t writes = {0}, rotations = {0};
+    for(int i = 0; i < threads; i++){
+        pthread_join(tids[i], NULL);
+        seconds = writers[i].seconds > seconds ? writers[i].seconds : seconds;
+        for(long long j = 0; j < writers[i].writes.count; j++){
+            bench_push(&writes, writers[i].writes.samples[j]);
+        }
+        for(long long j = 0; j < writers[i].rotations.count; j++){
+            bench_push(&rotations, writers[i].rotations.samples[j]);
+        }
+        free(writers[i].writes.samples);
+        free(writers[i].rotations.samples);
+    }
+    pthread_barrier_destroy(&start);
+    if(bench_async){
+        dlgr_async_flush();
+        seconds = (bench_now_ns() - write_start) / 1e9;
+    }
+    for(int var = 0; var < config->vars; var++){
+        dlgr_flush(handles[var]);
+    }
+    bench_report(&run, "write", &writes, writes.count, writes.count * config->var_size, seconds);
+    if(!bench_async){
+        bench_report(&run, "rotation", &rotations, rotations.count, rotations.count * config->var_size, seconds);
+    }
+
+    // Reads, from one thread, cycling through the variables.
+    unsigned char* buf = malloc((size_t) BENCH_RANGE_COUNT * config->var_size);
+    if(buf == NULL){
+        free(writes.samples);
+        free(rotations.samples);
+        return -1;
+    }
+    bench_samples_t latest = {0}, range = {0};
+    long long latest_bytes = 0, range_bytes = 0;
+    long long begin = bench_now_ns();
+    for(int i = 0; i < BENCH_READS; i++){
+        const long long t0 = bench_now_ns();
+        const int number_read = dlgr_read_latest_handle(handles[i % config->vars], buf, BENCH_LATEST_COUNT);
+        bench_push(&latest, bench_now_ns() - t0);
+        latest_bytes += number_read > 0 ? (long long) number_read * config->var_size : 0;
+    }
+    const double latest_seconds = (bench_now_ns() - begin) / 1e9;
+
+    srand(1);
+    begin = bench_now_ns();
+    for(int i = 0; i < BENCH_READS; i++){
+        const int handle = handles[i % config->vars];
+        long long first_seq, next_seq;
+        dlgr_get_seq_range(handle, &first_seq, &next_seq);
+        const long long span = next_seq - first_seq - BENCH_RANGE_COUNT;
+        const long long from = first_seq + (span > 0 ? rand() % (span + 1) : 0);
+        const long long t0 = bench_now_ns();
+        const int number_read = dlgr_read_range_handle(handle, from, BENCH_RANGE_COUNT, buf);
+        bench_push(&range, bench_now_ns() - t0);
+        range_bytes += number_read > 0 ? (long long) number_read * config->var_size : 0;
+    }
+    const double range_seconds = (bench_now_ns() - begin) / 1e9;
+
+    bench_report(&run, "read_latest", &latest, latest.count, latest_bytes, latest_seconds);
+    bench_report(&run, "read_range", &range, range.count, range_bytes, range_seconds);
+
+    free(buf);
+    free(writes.samples);
+    free(rotations.samples);
+    free(latest.samples);
+    free(range.samples);
+
+    for(int var = 0; var < config->vars; var++){
+        dlgr_close(handles[var]);
+    }
+    dlgr_migrate_flush();
+    bench_clean(bench_dir, prefix);
+    if(bench_hot_dir != NULL){
+        bench_clean(bench_hot_dir, prefix);
+    }
+    return 1;
+}
+
+// Parses a comma-separated list of numbers, or of durability names if names is set.
+static int bench_parse_list(const char* arg, bench_list_t* list, int names){
+    static const char* durabilities[] = {"none", "every", "group", "rotate"};
+    char buf[0x100];
+    snprintf(buf, sizeof(buf), "%s", arg);
+    list->count = 0;
+    for(char* save = NULL, *token = strtok_r(buf, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)){
+        if(list->count == BENCH_MAX_LIST){
+            return -1;
+        }
+        long long value = -1;
+        if(names){
+            for(int i = 0; i < (int) (sizeof(durabilities) / sizeof(durabilities[0])); i++){
+                if(strcmp(token, durabilities[i]) == 0){
+                    value = i;
+                }
+            }
+        } else {
+            value = strtoll(token, NULL, 0);
+        }
+        if(value < (names ? 0 : 1)){
+            return -1;
+        }
+        list->values[list->count++] = value;
+    }
+    return list->count > 0 ? 1 : -1;
+}
+
+int main(int argc, char** argv){
+    bench_list_t var_sizes = {{8, 64, 1024}, 3};
+    bench_list_t segment_sizes = {{0x10000, 0x100000}, 2};
+    bench_list_t records = {{10000}, 1};
+    bench_list_t vars = {{1, 16}, 2};
+    bench_list_t threads = {{1, 4}, 2};
+    bench_list_t durabilities = {{DLGR_SYNC_NONE}, 1};
+
+    int opt;
+    while((opt = getopt(argc, argv, "jqaUd:H:s:g:n:v:t:y:")) != -1){
+        int retval = 1;
+        switch(opt){
+            case 'j':
+                bench_json = 1;
+                break;
+            case 'q':
+                // A quick smoke run.
+                var_sizes = (bench_list_t){{8}, 1};
+                segment_sizes = (bench_list_t){{0x10000}, 1};
+                records = (bench_list_t){{1000}, 1};
+                vars = (bench_list_t){{2}, 1};
+                threads = (bench_list_t){{2}, 1};
+                break;
+            case 'a':
+                bench_async = 1;
+                break;
+            case 'U':
+                if(dlgr_set_io_backend(DLGR_IO_URING) != DLGR_IO_URING){
+                    fprintf(stderr, "io_uring is not available, using POSIX calls.\n");
+                }
+                break;
+            case 'd':
+                bench_dir = optarg;
+                break;
+            case 'H':
+                bench_hot_dir = optarg;
+                break;
+            case 's':
+                retval = bench_parse_list(optarg, &var_sizes, 0);
+                break;
+            case 'g':
+                retval = bench_parse_list(optarg, &segment_sizes, 0);
+                break;
+            case 'n':
+                retval = bench_parse_list(optarg, &records, 0);
+                break;
+            case 'v':
+                retval = bench_parse_list(optarg, &vars, 0);
+                break;
+            case 't':
+                retval = bench_parse_list(optarg, &threads, 0);
+                break;
+            case 'y':
+                retval = bench_parse_list(optarg, &durabilities, 1);
+                break;
+            default:
+                retval = -1;
+                break;
+        }
+        if(retval < 0){
+            fprintf(stderr, "Usage: %s [-j] [-q] [-a] [-U] [-d dir] [-H hot_dir] [-s var_sizes] [-g segment_sizes] [-n records] [-v vars] [-t threads] [-y none,every,group,rotate]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(bench_hot_dir != NULL){
+        mkdir(bench_hot_dir, 0755);
+        if(dlgr_set_hot_dir(bench_hot_dir) < 0){
+            return 1;
+        }
+    }
+
+    mkdir(bench_dir, 0755);
+    if(dlgr_open(bench_dir) < 0){
+        return 1;
+    }
+
+    if(bench_async && (dlgr_async_start((dlgr_async_config_t){BENCH_RING_CAPACITY, BENCH_RING_SLOT_SIZE, DLGR_OVERFLOW_BLOCK}) < 0)){
+        return 1;
+    }
+
+    if(bench_json){
+        printf("[\n");
+    } else {
+        printf("var_size,segment_size,records,vars,threads,durability,op,count,seconds,ops_per_s,mb_per_s,p50_ns,p99_ns,p999_ns,max_ns\n");
+    }
+
+    // Every combination takes registry entries of its own.
+    long long total_vars = 0;
+    for(int v = 0; v < vars.count; v++){
+        total_vars += vars.values[v];
+    }
+    total_vars *= (long long) var_sizes.count * segment_sizes.count * records.count * threads.count * durabilities.count;
+    if(total_vars > DLGR_MAX_VARS){
+        fprintf(stderr, "The sweep needs %lld variables, more than the %d the registry holds.\n", total_vars, DLGR_MAX_VARS);
+        return 1;
+    }
+
+    int failed = 0;
+    int index = 0;
+    for(int s = 0; s < var_sizes.count; s++){
+        for(int g = 0; g < segment_sizes.count; g++){
+            for(int n = 0; n < records.count; n++){
+                for(int v = 0; v < vars.count; v++){
+                    for(int t = 0; t < threads.count; t++){
+                        for(int y = 0; y < durabilities.count; y++){
+                            const bench_config_t config = {var_sizes.values[s], segment_sizes.values[g], records.values[n], vars.values[v], threads.values[t], durabilities.values[y]};
+                            if(bench_run(&config, index++) < 0){
+                                fprintf(stderr, "Combination failed: var_size %d, segment_size %d, %lld records, %d vars, %d threads.\n",
+                                    config.var_size, config.segment_size, config.records, config.vars, config.threads);
+                                failed = 1;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if(bench_json){
+        printf("\n]\n");
+    }
+    dlgr_shutdown();
+
+    return failed;
+}
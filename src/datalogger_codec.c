@@ -0,0 +1,478 @@
+/**
+ * @file datalogger_codec.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Compression of closed log segments.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#define _GNU_SOURCE // memfd_create()
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Compressed segment layout
+/* acs_x_3.log.z        <-- A dlgr_codec_header_t, then the encoded records.
+ * acs_x_3.ts.z         <-- The same, for the timestamp column.
+ *
+ * Records are split into elements of element_size bytes, and each element position ("lane") is encoded as its own
+ * series across all records of the segment, since that is what changes slowly.
+ */
+
+#define DLGR_CODEC_MAGIC "DLGZ"
+
+typedef struct
+{
+    char magic[4]; // DLGR_CODEC_MAGIC
+    int codec; // dlgr_codec_t
+    int element_size; // Bytes per encoded element.
+    int record_size; // Bytes per record.
+    int records; // Records in the segment.
+    int encoded_bytes; // Bytes following the header.
+} dlgr_codec_header_t;
+
+// Decoded segments kept in memory, so repeated reads of a compressed segment (range reads, cursors, export chunks, time
+// searches) decode it once. Keyed by the identity of the .z file, so a segment that is moved or rewritten misses.
+#define DLGR_DECODE_CACHE 4
+
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    int fd; // Sealed memfd of the decoded records, -1 if the entry is empty.
+    unsigned long long used; // dlgr_decoded_clock at the last hit, for eviction.
+} dlgr_decoded_t;
+
+static pthread_mutex_t dlgr_decoded_lock = PTHREAD_MUTEX_INITIALIZER;
+static dlgr_decoded_t dlgr_decoded[DLGR_DECODE_CACHE] = {[0 ... DLGR_DECODE_CACHE - 1] = {.fd = -1}};
+static unsigned long long dlgr_decoded_clock = 0;
+
+// Worst case encoded size of one element, for either codec: a 10 byte varint, or 1 + 1 + 6 + 6 + 64 bits.
+#define DLGR_CODEC_MAX_ELEMENT_BYTES 10
+
+// MSB-first bit stream over a zeroed buffer.
+typedef struct
+{
+    unsigned char* buf;
+    size_t pos; // Bits consumed or produced.
+    size_t limit; // Bits available.
+    int overrun; // Set if a read ran past limit.
+} dlgr_bits_t;
+
+static void dlgr_bits_put(dlgr_bits_t* bits, uint64_t value, int n){
+    while(n > 0){
+        const int room = 8 - (bits->pos & 7);
+        const int take = n < room ? n : room;
+        const unsigned int chunk = (value >> (n - take)) & ((1u << take) - 1);
+        bits->buf[bits->pos >> 3] |= chunk << (room - take);
+        bits->pos += take;
+        n -= take;
+    }
+}
+
+static uint64_t dlgr_bits_get(dlgr_bits_t* bits, int n){
+    if((bits->pos + n) > bits->limit){
+        bits->overrun = 1;
+        return 0;
+    }
+
+    uint64_t value = 0;
+    while(n > 0){
+        const int room = 8 - (bits->pos & 7);
+        const int take = n < room ? n : room;
+        const unsigned int chunk = (bits->buf[bits->pos >> 3] >> (room - take)) & ((1u << take) - 1);
+        value = (value << take) | chunk;
+        bits->pos += take;
+        n -= take;
+    }
+    return value;
+}
+
+// Loads an element, sign-extended so integer deltas are small in both directions.
+static uint64_t dlgr_element_load(const unsigned char* src, int element_size){
+    switch(element_size){
+        case 1: { int8_t v; memcpy(&v, src, 1); return (uint64_t) (int64_t) v; }
+        case 2: { int16_t v; memcpy(&v, src, 2); return (uint64_t) (int64_t) v; }
+        case 4: { int32_t v; memcpy(&v, src, 4); return (uint64_t) (int64_t) v; }
+        default: { uint64_t v; memcpy(&v, src, 8); return v; }
+    }
+}
+
+static void dlgr_element_store(unsigned char* dest, uint64_t value, int element_size){
+    switch(element_size){
+        case 1: { int8_t v = (int8_t) value; memcpy(dest, &v, 1); break; }
+        case 2: { int16_t v = (int16_t) value; memcpy(dest, &v, 2); break; }
+        case 4: { int32_t v = (int32_t) value; memcpy(dest, &v, 4); break; }
+        default: memcpy(dest, &value, 8); break;
+    }
+}
+
+// Delta-of-delta, zigzag, LEB128 varint.
+static size_t dlgr_delta_encode(const unsigned char* raw, int records, int record_size, int element_size, unsigned char* out){
+    size_t out_pos = 0;
+    for(int lane = 0; lane < (record_size / element_size); lane++){
+        uint64_t prev = 0, prev_delta = 0;
+        for(int record = 0; record < records; record++){
+            const uint64_t value = dlgr_element_load(&raw[(size_t) record * record_size + (size_t) lane * element_size], element_size);
+            const uint64_t delta = value - prev;
+            const int64_t dod = (int64_t) (delta - prev_delta);
+            uint64_t zigzag = ((uint64_t) dod << 1) ^ (uint64_t) (dod >> 63);
+            while(zigzag >= 0x80){
+                out[out_pos++] = (zigzag & 0x7f) | 0x80;
+                zigzag >>= 7;
+            }
+            out[out_pos++] = zigzag;
+            prev = value;
+            prev_delta = delta;
+        }
+    }
+    return out_pos;
+}
+
+static int dlgr_delta_decode(const unsigned char* in, size_t in_bytes, int records, int record_size, int element_size, unsigned char* raw){
+    size_t in_pos = 0;
+    for(int lane = 0; lane < (record_size / element_size); lane++){
+        uint64_t prev = 0, prev_delta = 0;
+        for(int record = 0; record < records; record++){
+            uint64_t zigzag = 0;
+            int shift = 0;
+            do {
+                if((in_pos >= in_bytes) || (shift > 63)){
+                    return -1;
+                }
+                zigzag |= (uint64_t) (in[in_pos] & 0x7f) << shift;
+                shift += 7;
+            } while(in[in_pos++] & 0x80);
+
+            const uint64_t dod = (zigzag >> 1) ^ (0 - (zigzag & 1));
+            prev_delta += dod;
+            prev += prev_delta;
+            dlgr_element_store(&raw[(size_t) record * record_size + (size_t) lane * element_size], prev, element_size);
+        }
+    }
+    return 1;
+}
+
+// XOR with the previous value, storing only the meaningful bits (Gorilla).
+static size_t dlgr_xor_encode(const unsigned char* raw, int records, int record_size, int element_size, unsigned char* out){
+    const int width = element_size * 8;
+    dlgr_bits_t bits = {out, 0, 0, 0};
+    for(int lane = 0; lane < (record_size / element_size); lane++){
+        uint64_t prev = 0;
+        int prev_lead = -1, prev_trail = 0;
+        for(int record = 0; record < records; record++){
+            uint64_t value = 0;
+            memcpy(&value, &raw[(size_t) record * record_size + (size_t) lane * element_size], element_size);
+            if(record == 0){
+                dlgr_bits_put(&bits, value, width);
+                prev = value;
+                continue;
+            }
+
+            const uint64_t x = value ^ prev;
+            prev = value;
+            if(x == 0){
+                dlgr_bits_put(&bits, 0, 1);
+                continue;
+            }
+
+            const int lead = __builtin_clzll(x) - (64 - width);
+            const int trail = __builtin_ctzll(x);
+            if((prev_lead >= 0) && (lead >= prev_lead) && (trail >= prev_trail)){
+                // Fits in the previous window.
+                dlgr_bits_put(&bits, 0x2, 2);
+                dlgr_bits_put(&bits, x >> prev_trail, width - prev_lead - prev_trail);
+            } else {
+                const int length = width - lead - trail;
+                dlgr_bits_put(&bits, 0x3, 2);
+                dlgr_bits_put(&bits, lead, 6);
+                dlgr_bits_put(&bits, length - 1, 6);
+                dlgr_bits_put(&bits, x >> trail, length);
+                prev_lead = lead;
+                prev_trail = trail;
+            }
+        }
+    }
+    return (bits.pos + 7) / 8;
+}
+
+static int dlgr_xor_decode(const unsigned char* in, size_t in_bytes, int records, int record_size, int element_size, unsigned char* raw){
+    const int width = element_size * 8;
+    dlgr_bits_t bits = {(unsigned char*) in, 0, in_bytes * 8, 0};
+    for(int lane = 0; lane < (record_size / element_size); lane++){
+        uint64_t prev = 0;
+        int prev_lead = -1, prev_trail = 0;
+        for(int record = 0; record < records; record++){
+            if(record == 0){
+                prev = dlgr_bits_get(&bits, width);
+            } else if(dlgr_bits_get(&bits, 1)){
+                if(dlgr_bits_get(&bits, 1) == 0){
+                    if(prev_lead < 0){
+                        return -1;
+                    }
+                    prev ^= dlgr_bits_get(&bits, width - prev_lead - prev_trail) << prev_trail;
+                } else {
+                    const int lead = dlgr_bits_get(&bits, 6);
+                    const int length = dlgr_bits_get(&bits, 6) + 1;
+                    if((lead + length) > width){
+                        return -1;
+                    }
+                    prev_lead = lead;
+                    prev_trail = width - lead - length;
+                    prev ^= dlgr_bits_get(&bits, length) << prev_trail;
+                }
+            }
+            if(bits.overrun){
+                return -1;
+            }
+            memcpy(&raw[(size_t) record * record_size + (size_t) lane * element_size], &prev, element_size);
+        }
+    }
+    return 1;
+}
+
+int dlgr_codec_element_size(dlgr_codec_t codec, int record_size, int element_size){
+    if(codec == DLGR_CODEC_NONE){
+        return 0;
+    }
+
+    if((codec != DLGR_CODEC_DELTA) && (codec != DLGR_CODEC_XOR)){
+        eprintf("Codec %d invalid.", codec);
+        return -1;
+    }
+
+    // Scalars default to themselves.
+    if(element_size == 0){
+        element_size = record_size;
+    }
+
+    const int valid = (codec == DLGR_CODEC_XOR) ? ((element_size == 4) || (element_size == 8))
+                                                : ((element_size == 1) || (element_size == 2) || (element_size == 4) || (element_size == 8));
+    if(!valid || ((record_size % element_size) != 0)){
+        eprintf("Element size %d invalid for codec %d and record size %d.", element_size, codec, record_size);
+        return -1;
+    }
+
+    return element_size;
+}
+
+int dlgr_compress_file(int dirfd, const char* fname, dlgr_codec_t codec, int element_size, int record_size, int sync){
+    int fd = openat(dirfd, fname, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return -1;
+    }
+
+    struct stat stbuf;
+    if(fstat(fd, &stbuf) != 0){
+        close(fd);
+        return -1;
+    }
+
+    const int records = stbuf.st_size / record_size;
+    const size_t raw_bytes = (size_t) records * record_size;
+    const size_t elements = raw_bytes / element_size;
+    if(records == 0){
+        close(fd);
+        return 0;
+    }
+
+    unsigned char* raw = malloc(raw_bytes);
+    unsigned char* encoded = calloc(sizeof(dlgr_codec_header_t) + (elements * DLGR_CODEC_MAX_ELEMENT_BYTES), 1);
+    if((raw == NULL) || (encoded == NULL) || (pread(fd, raw, raw_bytes, 0) != (ssize_t) raw_bytes)){
+        eprintf("Could not read %s for compression.", fname);
+        free(raw);
+        free(encoded);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    unsigned char* payload = &encoded[sizeof(dlgr_codec_header_t)];
+    const size_t encoded_bytes = (codec == DLGR_CODEC_XOR) ? dlgr_xor_encode(raw, records, record_size, element_size, payload)
+                                                           : dlgr_delta_encode(raw, records, record_size, element_size, payload);
+    free(raw);
+
+    // Data that doesn't compress stays as it is.
+    const size_t file_bytes = sizeof(dlgr_codec_header_t) + encoded_bytes;
+    if(file_bytes >= raw_bytes){
+        free(encoded);
+        return 0;
+    }
+
+    dlgr_codec_header_t header = {DLGR_CODEC_MAGIC, codec, element_size, record_size, records, encoded_bytes};
+    memcpy(encoded, &header, sizeof(dlgr_codec_header_t));
+
+    // Written aside, and renamed into place by dlgr_publish_compressed(), so a reader finds either the raw or the whole compressed segment.
+    const int fname_buf_size = strlen(fname) + 7; // 7 == sizeof(".z.tmp")
+    char tmp_buf[fname_buf_size];
+    snprintf(tmp_buf, fname_buf_size, "%s.z.tmp", fname);
+
+    int z_fd = openat(dirfd, tmp_buf, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(z_fd < 0){
+        eprintf("Could not open %s.", tmp_buf);
+        free(encoded);
+        return -1;
+    }
+    int retval = (write(z_fd, encoded, file_bytes) == (ssize_t) file_bytes) ? 1 : -1;
+    if((retval > 0) && sync && (fdatasync(z_fd) != 0)){
+        retval = -1;
+    }
+    close(z_fd);
+    free(encoded);
+
+    if(retval < 0){
+        eprintf("Could not write %s.", tmp_buf);
+        unlinkat(dirfd, tmp_buf, 0);
+        return -1;
+    }
+
+    return 1;
+}
+
+int dlgr_publish_compressed(int dirfd, const char* fname, int sync){
+    const int fname_buf_size = strlen(fname) + 7; // 7 == sizeof(".z.tmp")
+    char tmp_buf[fname_buf_size], z_buf[fname_buf_size];
+    snprintf(tmp_buf, fname_buf_size, "%s.z.tmp", fname);
+    snprintf(z_buf, fname_buf_size, "%s.z", fname);
+
+    if(renameat(dirfd, tmp_buf, dirfd, z_buf) != 0){
+        eprintf("Could not put %s in place.", z_buf);
+        unlinkat(dirfd, tmp_buf, 0);
+        return -1;
+    }
+
+    unlinkat(dirfd, fname, 0);
+    if(sync && (fsync(dirfd) != 0)){
+        eprintf("Could not sync the directory of %s.", z_buf);
+        return -1;
+    }
+    return 1;
+}
+
+static int dlgr_decoded_match(const dlgr_decoded_t* entry, const struct stat* stbuf){
+    return (entry->fd >= 0) && (entry->dev == stbuf->st_dev) && (entry->ino == stbuf->st_ino) && (entry->size == stbuf->st_size)
+        && (entry->mtime.tv_sec == stbuf->st_mtim.tv_sec) && (entry->mtime.tv_nsec == stbuf->st_mtim.tv_nsec);
+}
+
+// Returns a new descriptor of the cached decoding of the .z file stbuf describes, or -1 if there is none.
+static int dlgr_decoded_find(const struct stat* stbuf){
+    int fd = -1;
+    pthread_mutex_lock(&dlgr_decoded_lock);
+    for(int i = 0; i < DLGR_DECODE_CACHE; i++){
+        if(dlgr_decoded_match(&dlgr_decoded[i], stbuf)){
+            dlgr_decoded[i].used = ++dlgr_decoded_clock;
+            fd = fcntl(dlgr_decoded[i].fd, F_DUPFD_CLOEXEC, 0);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dlgr_decoded_lock);
+    return fd;
+}
+
+// Caches a decoding of the .z file stbuf describes, in place of the least recently used one.
+static void dlgr_decoded_insert(const struct stat* stbuf, int fd){
+    pthread_mutex_lock(&dlgr_decoded_lock);
+    int victim = 0;
+    for(int i = 0; i < DLGR_DECODE_CACHE; i++){
+        if(dlgr_decoded_match(&dlgr_decoded[i], stbuf)){
+            // Decoded by another reader meanwhile.
+            victim = -1;
+            break;
+        }
+        if((dlgr_decoded[i].fd < 0) || ((dlgr_decoded[victim].fd >= 0) && (dlgr_decoded[i].used < dlgr_decoded[victim].used))){
+            victim = i;
+        }
+    }
+    const int cached_fd = victim >= 0 ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : -1;
+    if(cached_fd >= 0){
+        if(dlgr_decoded[victim].fd >= 0){
+            close(dlgr_decoded[victim].fd);
+        }
+        dlgr_decoded[victim] = (dlgr_decoded_t){stbuf->st_dev, stbuf->st_ino, stbuf->st_size, stbuf->st_mtim, cached_fd, ++dlgr_decoded_clock};
+    }
+    pthread_mutex_unlock(&dlgr_decoded_lock);
+}
+
+int dlgr_open_compressed(int dirfd, const char* fname){
+    const int fname_buf_size = strlen(fname) + 3; // 3 == sizeof(".z")
+    char z_buf[fname_buf_size];
+    snprintf(z_buf, fname_buf_size, "%s.z", fname);
+
+    int z_fd = openat(dirfd, z_buf, O_RDONLY | O_CLOEXEC);
+    if(z_fd < 0){
+        return -1;
+    }
+
+    struct stat stbuf;
+    if(fstat(z_fd, &stbuf) != 0){
+        close(z_fd);
+        return -1;
+    }
+    int fd = dlgr_decoded_find(&stbuf);
+    if(fd >= 0){
+        close(z_fd);
+        return fd;
+    }
+
+    dlgr_codec_header_t header;
+    if((pread(z_fd, &header, sizeof(header), 0) != sizeof(header))
+        || (memcmp(header.magic, DLGR_CODEC_MAGIC, 4) != 0) || (header.records < 0) || (header.record_size <= 0)
+        || (dlgr_codec_element_size(header.codec, header.record_size, header.element_size) <= 0)
+        || (stbuf.st_size != (off_t) (sizeof(header) + header.encoded_bytes))){
+        eprintf("Compressed segment %s is corrupt.", z_buf);
+        close(z_fd);
+        return -1;
+    }
+
+    const size_t raw_bytes = (size_t) header.records * header.record_size;
+    unsigned char* encoded = malloc(header.encoded_bytes + 1);
+    unsigned char* raw = malloc(raw_bytes + 1);
+    int retval = -1;
+    if((encoded != NULL) && (raw != NULL) && (pread(z_fd, encoded, header.encoded_bytes, sizeof(header)) == header.encoded_bytes)){
+        retval = (header.codec == DLGR_CODEC_XOR) ? dlgr_xor_decode(encoded, header.encoded_bytes, header.records, header.record_size, header.element_size, raw)
+                                                  : dlgr_delta_decode(encoded, header.encoded_bytes, header.records, header.record_size, header.element_size, raw);
+    }
+    close(z_fd);
+    free(encoded);
+
+    if(retval < 0){
+        eprintf("Could not decode %s.", z_buf);
+        free(raw);
+        return -1;
+    }
+
+    // Readers get an ordinary fd over the decoded records, which they can pread, fstat, and mmap like a raw segment. It
+    // is sealed, since every reader of the segment shares it.
+    fd = memfd_create(z_buf, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if((fd >= 0) && ((write(fd, raw, raw_bytes) != (ssize_t) raw_bytes)
+        || (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0))){
+        close(fd);
+        fd = -1;
+    }
+    free(raw);
+
+    if(fd < 0){
+        eprintf("Could not hold decoded %s in memory.", z_buf);
+        return -1;
+    }
+
+    dlgr_decoded_insert(&stbuf, fd);
+    return fd;
+}
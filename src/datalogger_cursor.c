@@ -0,0 +1,193 @@
+/**
+ * @file datalogger_cursor.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Forward streaming cursors for chronological replay.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// A cursor holds at most two segments: the one it reads, and the next, which the kernel reads ahead
+// (POSIX_FADV_WILLNEED) meanwhile. Compressed segments are decoded when opened, so the next one is decoded ahead too.
+
+int dlgr_cursor_open(int handle, long long from_seq, dlgr_cursor_t* cursor){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    if(cursor == NULL){
+        eprintf("Cursor is NULL.");
+        return -1;
+    }
+
+    if(from_seq < 0){
+        eprintf("Sequence number %lld is invalid.", from_seq);
+        return -1;
+    }
+
+    memset(cursor, 0x0, sizeof(dlgr_cursor_t));
+    cursor->handle = handle;
+    cursor->next_seq = from_seq;
+    cursor->fd = -1;
+    cursor->prefetch_fd = -1;
+    cursor->prefetch_index = -1;
+
+    pthread_mutex_lock(&var->lock);
+    cursor->var_size = var->var_size;
+    pthread_mutex_unlock(&var->lock);
+
+    return 1;
+}
+
+// Leaves the open segment, dropping what was read of it from the page cache.
+static void dlgr_cursor_release(dlgr_cursor_t* cursor){
+    if(cursor->fd >= 0){
+        posix_fadvise(cursor->fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(cursor->fd);
+        cursor->fd = -1;
+    }
+}
+
+// Opens the segment holding cursor->next_seq, or finds out it grew, and starts reading the one after it. 0 if caught up.
+static int dlgr_cursor_advance(dlgr_cursor_t* cursor, dlgr_var_t* var){
+    int failed_index = -1;
+    for(;;){
+        dlgr_segment_info_t segment;
+        int next_index;
+        int retval = dlgr_find_segment(cursor->handle, cursor->next_seq, &segment, &next_index);
+        if(retval <= 0){
+            return retval;
+        }
+
+        // Removed by retention before we got to it.
+        if(cursor->next_seq < segment.first_seq){
+            cursor->next_seq = segment.first_seq;
+        }
+
+        // Still the open segment, with more records written since. A segment reassembled from columns is a copy, reopened once outgrown.
+        struct stat stbuf;
+        if((cursor->fd >= 0) && (segment.var_index == cursor->segment.var_index)
+            && ((fstat(cursor->fd, &stbuf) != 0) || (stbuf.st_size >= ((off_t) segment.records * cursor->var_size)))){
+            cursor->segment = segment;
+            return 1;
+        }
+
+        dlgr_cursor_release(cursor);
+        if((cursor->prefetch_fd >= 0) && (cursor->prefetch_index == segment.var_index)){
+            cursor->fd = cursor->prefetch_fd;
+            cursor->prefetch_fd = -1;
+        } else {
+            if(cursor->prefetch_fd >= 0){
+                close(cursor->prefetch_fd);
+                cursor->prefetch_fd = -1;
+            }
+            cursor->fd = dlgr_open_segment_rows(var, segment.var_index, cursor->next_seq - segment.first_seq, -1);
+        }
+
+        if(cursor->fd < 0){
+            // Retention may have removed it since the lookup; look again, but only once for the same segment.
+            if(failed_index == segment.var_index){
+                eprintf("Could not open segment %d of %s.", segment.var_index, var->var_name);
+                return -1;
+            }
+            failed_index = segment.var_index;
+            continue;
+        }
+        posix_fadvise(cursor->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        cursor->segment = segment;
+
+        // Read the next segment ahead while this one is consumed.
+        if(next_index >= 0){
+            cursor->prefetch_fd = dlgr_open_segment_read(var, next_index, "log");
+            cursor->prefetch_index = next_index;
+            if(cursor->prefetch_fd >= 0){
+                posix_fadvise(cursor->prefetch_fd, 0, 0, POSIX_FADV_WILLNEED);
+            }
+        }
+
+        return 1;
+    }
+}
+
+int dlgr_cursor_next(dlgr_cursor_t* cursor, void* buf, int max){
+    if((cursor == NULL) || (buf == NULL)){
+        eprintf("Cursor or buffer is NULL.");
+        return -1;
+    }
+
+    if(max <= 0){
+        eprintf("Count %d is invalid.", max);
+        return -1;
+    }
+
+    dlgr_var_t* var = dlgr_get_var(cursor->handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", cursor->handle);
+        return -1;
+    }
+
+    unsigned char* buf_ptr = (unsigned char*) buf;
+    const int var_size = cursor->var_size;
+    int number_read = 0;
+    while(number_read < max){
+        // Move on once the open segment is used up, as far as we know it.
+        if((cursor->fd < 0) || (cursor->next_seq >= (cursor->segment.first_seq + cursor->segment.records))){
+            int retval = dlgr_cursor_advance(cursor, var);
+            if(retval < 0){
+                return -1;
+            }
+            if((retval == 0) || (cursor->next_seq >= (cursor->segment.first_seq + cursor->segment.records))){
+                break;
+            }
+        }
+
+        const int offset = cursor->next_seq - cursor->segment.first_seq;
+        int number_this_file = cursor->segment.records - offset;
+        if(number_this_file > (max - number_read)){
+            number_this_file = max - number_read;
+        }
+
+        const ssize_t bytes = (ssize_t) number_this_file * var_size;
+        if(pread(cursor->fd, &buf_ptr[(size_t) number_read * var_size], bytes, (off_t) offset * var_size) != bytes){
+            eprintf("Failed to read %d records of segment %d of %s.", number_this_file, cursor->segment.var_index, var->var_name);
+            DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+            return -1;
+        }
+        number_read += number_this_file;
+        cursor->next_seq += number_this_file;
+    }
+
+    DLGR_COUNT(var, reads, 1);
+    DLGR_COUNT(var, bytes_read, (unsigned long long) number_read * var_size);
+    return number_read;
+}
+
+int dlgr_cursor_close(dlgr_cursor_t* cursor){
+    if(cursor == NULL){
+        eprintf("Cursor is NULL.");
+        return -1;
+    }
+
+    dlgr_cursor_release(cursor);
+    if(cursor->prefetch_fd >= 0){
+        close(cursor->prefetch_fd);
+        cursor->prefetch_fd = -1;
+    }
+
+    return 1;
+}
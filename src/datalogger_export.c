@@ -0,0 +1,530 @@
+/**
+ * @file datalogger_export.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Streams the history of variables to CSV or packed binary, oldest first, built by make dlgr_export.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Usage: dlgr_export.out [-b] [-d dir] [-o out_dir] [-j workers] [-s first_seq] [-n count] [-t t0,t1] var_name...
+// Writes every record of each variable, or those within a sequence range (-s, -n) or a time range (-t, inclusive),
+// oldest first. CSV has a header row, then a row per record: its sequence number, its timestamp if the variable is
+// timestamped, and a column per value: each element of a typed variable, each member of a frame or field of a struct,
+// and opaque bytes in hex. With -b the records are written as stored, back to back. Variables go to stdout one after
+// another, or each to out_dir/var_name.csv (.bin) with -o; library messages go to stderr.
+// Workers read and format chunks of segments concurrently, while the main thread writes the finished ones out in order.
+
+#define EXPORT_CHUNK_BYTES 0x400000 // Output a worker makes of one chunk, at most, unless one record is bigger.
+#define EXPORT_VALUE_SIZE 0x20 // Longest formatted number and its comma, ie "-1.7976931348623157e+308,".
+#define EXPORT_MAX_WORKERS 0x40
+
+// A run of values in a record: an element array of one type, or opaque bytes.
+typedef struct
+{
+    char name[MAX_VAR_NAME_SIZE];
+    int offset;
+    int size;
+    dlgr_type_t type; // DLGR_TYPE_NONE if opaque.
+    int elements; // Values of type in size bytes, 0 if opaque.
+} export_column_t;
+
+typedef enum
+{
+    EXPORT_QUEUED = 0,
+    EXPORT_DONE,
+    EXPORT_FAILED
+} export_state_t;
+
+// Records first_seq to first_seq + count - 1, all in one segment.
+typedef struct
+{
+    long long first_seq;
+    int count;
+    char* out;
+    size_t out_len;
+    export_state_t state;
+} export_chunk_t;
+
+typedef struct
+{
+    const char* var_name;
+    int handle;
+    int var_size;
+    int timestamped;
+    int binary;
+    export_column_t* columns;
+    int num_columns;
+    size_t max_row; // Bytes of the longest CSV row.
+    int chunk_records;
+    export_chunk_t* chunks;
+    int num_chunks;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // Signalled when a chunk is done or written out.
+    int next_chunk; // Next for a worker to take.
+    int chunks_written; // Written out, in order.
+    int window; // Chunks taken but not written out, at most; bounds memory.
+    int failed;
+} export_job_t;
+
+// Writes a number, the way printf("%llu") would.
+static char* export_u64(char* p, unsigned long long value){
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while(value > 0);
+    while(n > 0){
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+static char* export_i64(char* p, long long value){
+    if(value < 0){
+        *p++ = '-';
+        return export_u64(p, -(unsigned long long) value);
+    }
+    return export_u64(p, value);
+}
+
+// Writes one value of type from src. Floats round-trip.
+static char* export_value(char* p, const unsigned char* src, dlgr_type_t type){
+    switch(type){
+        case DLGR_TYPE_I8: { signed char v; memcpy(&v, src, sizeof(v)); return export_i64(p, v); }
+        case DLGR_TYPE_I16: { short v; memcpy(&v, src, sizeof(v)); return export_i64(p, v); }
+        case DLGR_TYPE_I32: { int v; memcpy(&v, src, sizeof(v)); return export_i64(p, v); }
+        case DLGR_TYPE_I64: { long long v; memcpy(&v, src, sizeof(v)); return export_i64(p, v); }
+        case DLGR_TYPE_U8: { unsigned char v; memcpy(&v, src, sizeof(v)); return export_u64(p, v); }
+        case DLGR_TYPE_U16: { unsigned short v; memcpy(&v, src, sizeof(v)); return export_u64(p, v); }
+        case DLGR_TYPE_U32: { unsigned int v; memcpy(&v, src, sizeof(v)); return export_u64(p, v); }
+        case DLGR_TYPE_U64: { unsigned long long v; memcpy(&v, src, sizeof(v)); return export_u64(p, v); }
+        case DLGR_TYPE_F32: { float v; memcpy(&v, src, sizeof(v)); return p + sprintf(p, "%.9g", v); }
+        case DLGR_TYPE_F64: { double v; memcpy(&v, src, sizeof(v)); return p + sprintf(p, "%.17g", v); }
+        default: return p;
+    }
+}
+
+static char* export_hex(char* p, const unsigned char* src, int size){
+    static const char hex[] = "0123456789abcdef";
+    for(int i = 0; i < size; i++){
+        *p++ = hex[src[i] >> 4];
+        *p++ = hex[src[i] & 0xf];
+    }
+    return p;
+}
+
+// Formats count records, and their timestamps if any, as CSV rows. Returns the bytes written to out.
+static size_t export_format(const export_job_t* job, long long first_seq, const unsigned char* records, const long long* timestamps, int count, char* out){
+    char* p = out;
+    for(int i = 0; i < count; i++){
+        const unsigned char* record = &records[(size_t) i * job->var_size];
+        p = export_i64(p, first_seq + i);
+        if(timestamps != NULL){
+            *p++ = ',';
+            p = export_i64(p, timestamps[i]);
+        }
+        for(int c = 0; c < job->num_columns; c++){
+            const export_column_t* column = &job->columns[c];
+            if(column->elements == 0){
+                *p++ = ',';
+                p = export_hex(p, &record[column->offset], column->size);
+                continue;
+            }
+            const int element_size = column->size / column->elements;
+            for(int e = 0; e < column->elements; e++){
+                *p++ = ',';
+                p = export_value(p, &record[column->offset + (e * element_size)], column->type);
+            }
+        }
+        *p++ = '\n';
+    }
+    return p - out;
+}
+
+// Reads and formats chunk i.
+static int export_chunk(export_job_t* job, export_chunk_t* chunk, unsigned char* records, long long* timestamps){
+    const size_t bytes = (size_t) chunk->count * job->var_size;
+    if(job->binary){
+        // Read straight into what is written out.
+        chunk->out = malloc(bytes);
+        if((chunk->out == NULL) || (dlgr_read_range_handle(job->handle, chunk->first_seq, chunk->count, chunk->out) != chunk->count)){
+            return -1;
+        }
+        chunk->out_len = bytes;
+        return 1;
+    }
+
+    if(dlgr_read_range_handle(job->handle, chunk->first_seq, chunk->count, records) != chunk->count){
+        return -1;
+    }
+    if(job->timestamped && (dlgr_read_timestamps(job->handle, chunk->first_seq, chunk->count, timestamps) != chunk->count)){
+        return -1;
+    }
+
+    chunk->out = malloc((size_t) chunk->count * job->max_row);
+    if(chunk->out == NULL){
+        return -1;
+    }
+    chunk->out_len = export_format(job, chunk->first_seq, records, job->timestamped ? timestamps : NULL, chunk->count, chunk->out);
+    return 1;
+}
+
+static void* export_worker(void* arg){
+    export_job_t* job = (export_job_t*) arg;
+    unsigned char* records = job->binary ? NULL : malloc((size_t) job->chunk_records * job->var_size);
+    long long* timestamps = job->timestamped ? malloc((size_t) job->chunk_records * sizeof(long long)) : NULL;
+
+    pthread_mutex_lock(&job->lock);
+    for(;;){
+        // Stay within the window ahead of the writer.
+        while(!job->failed && (job->next_chunk < job->num_chunks) && (job->next_chunk >= (job->chunks_written + job->window))){
+            pthread_cond_wait(&job->cond, &job->lock);
+        }
+        if(job->failed || (job->next_chunk >= job->num_chunks)){
+            break;
+        }
+        export_chunk_t* chunk = &job->chunks[job->next_chunk++];
+        pthread_mutex_unlock(&job->lock);
+
+        int retval = -1;
+        if((job->binary || (records != NULL)) && (!job->timestamped || (timestamps != NULL))){
+            retval = export_chunk(job, chunk, records, timestamps);
+        }
+
+        pthread_mutex_lock(&job->lock);
+        chunk->state = retval > 0 ? EXPORT_DONE : EXPORT_FAILED;
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    free(records);
+    free(timestamps);
+    return NULL;
+}
+
+static int export_write_full(int fd, const char* buf, size_t bytes){
+    size_t number_written = 0;
+    while(number_written < bytes){
+        const ssize_t retval = write(fd, &buf[number_written], bytes - number_written);
+        if(retval < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        number_written += retval;
+    }
+    return 1;
+}
+
+// Describes the values of a record of the variable, one column per member, or one for the whole record.
+static int export_layout(export_job_t* job){
+    dlgr_var_t* var = dlgr_get_var(job->handle);
+    if(var == NULL){
+        return -1;
+    }
+
+    pthread_mutex_lock(&var->lock);
+    job->var_size = var->var_size;
+    job->timestamped = var->timestamped;
+    job->num_columns = var->num_members > 0 ? var->num_members : 1;
+    job->columns = calloc(job->num_columns, sizeof(export_column_t));
+    if(job->columns != NULL){
+        for(int c = 0; c < job->num_columns; c++){
+            export_column_t* column = &job->columns[c];
+            if(var->num_members > 0){
+                snprintf(column->name, sizeof(column->name), "%s", var->members[c].name);
+                column->offset = var->members[c].offset;
+                column->size = var->members[c].size;
+                column->type = var->members[c].type;
+            } else {
+                snprintf(column->name, sizeof(column->name), "value");
+                column->size = var->var_size;
+                column->type = var->type;
+            }
+        }
+    }
+    pthread_mutex_unlock(&var->lock);
+
+    if(job->columns == NULL){
+        return -1;
+    }
+
+    job->max_row = 2 * EXPORT_VALUE_SIZE;
+    for(int c = 0; c < job->num_columns; c++){
+        export_column_t* column = &job->columns[c];
+        const int type_size = dlgr_type_size(column->type);
+        column->elements = ((type_size > 0) && ((column->size % type_size) == 0)) ? column->size / type_size : 0;
+        job->max_row += column->elements > 0 ? (size_t) column->elements * EXPORT_VALUE_SIZE : (size_t) (2 * column->size) + 1;
+    }
+
+    return 1;
+}
+
+// Writes the header row, a column per value.
+static int export_header(const export_job_t* job, int fd){
+    size_t capacity = 0x100;
+    for(int c = 0; c < job->num_columns; c++){
+        capacity += (size_t) (job->columns[c].elements > 0 ? job->columns[c].elements : 1) * (MAX_VAR_NAME_SIZE + 0x10);
+    }
+    char* header = malloc(capacity);
+    if(header == NULL){
+        return -1;
+    }
+
+    char* p = header + sprintf(header, job->timestamped ? "seq,timestamp" : "seq");
+    for(int c = 0; c < job->num_columns; c++){
+        const export_column_t* column = &job->columns[c];
+        if(column->elements <= 1){
+            p += sprintf(p, ",%s", column->name);
+            continue;
+        }
+        for(int e = 0; e < column->elements; e++){
+            p += sprintf(p, ",%s[%d]", column->name, e);
+        }
+    }
+    *p++ = '\n';
+
+    const int retval = export_write_full(fd, header, p - header);
+    free(header);
+    return retval;
+}
+
+// Splits records first_seq to end_seq - 1 into chunks, none spanning segments.
+static int export_plan(export_job_t* job, long long first_seq, long long end_seq){
+    dlgr_snapshot_t snapshot;
+    if(dlgr_snapshot(job->handle, -1, &snapshot) < 0){
+        return -1;
+    }
+
+    int capacity = 0x10;
+    job->chunks = malloc(capacity * sizeof(export_chunk_t));
+    for(int i = 0; (job->chunks != NULL) && (i < snapshot.num_segments); i++){
+        const dlgr_segment_info_t* segment = &snapshot.segments[i];
+        long long seq = first_seq > segment->first_seq ? first_seq : segment->first_seq;
+        const long long segment_end = segment->first_seq + segment->records;
+        const long long end = end_seq < segment_end ? end_seq : segment_end;
+        while(seq < end){
+            if(job->num_chunks == capacity){
+                capacity *= 2;
+                export_chunk_t* chunks = realloc(job->chunks, capacity * sizeof(export_chunk_t));
+                if(chunks == NULL){
+                    free(job->chunks);
+                    job->chunks = NULL;
+                    break;
+                }
+                job->chunks = chunks;
+            }
+            const int count = (end - seq) < job->chunk_records ? (int) (end - seq) : job->chunk_records;
+            job->chunks[job->num_chunks++] = (export_chunk_t){seq, count, NULL, 0, EXPORT_QUEUED};
+            seq += count;
+        }
+    }
+
+    dlgr_snapshot_free(&snapshot);
+    return job->chunks != NULL ? 1 : -1;
+}
+
+// Exports one variable to fd. first_seq and count are -1 for all of it, t0 > t1 for no time range.
+static int export_var(const char* var_name, int fd, int binary, int workers, long long first_seq, long long count, long long t0, long long t1){
+    export_job_t job;
+    memset(&job, 0x0, sizeof(job));
+    job.var_name = var_name;
+    job.binary = binary;
+    job.window = workers * 2;
+
+    job.handle = dlgr_get_handle(var_name);
+    if((job.handle < 0) || (export_layout(&job) < 0)){
+        fprintf(stderr, "Could not load %s.\n", var_name);
+        return -1;
+    }
+
+    // Narrow the stored records down to the requested ones.
+    long long lo, hi;
+    if(dlgr_get_seq_range(job.handle, &lo, &hi) < 0){
+        free(job.columns);
+        return -1;
+    }
+    // The count runs from the requested first record, even if older ones have been removed.
+    const long long start = first_seq >= 0 ? first_seq : lo;
+    lo = start > lo ? start : lo;
+    if(count >= 0){
+        hi = (start + count) < hi ? (start + count) : hi;
+    }
+    if(t0 <= t1){
+        long long seq0, seq1;
+        if((dlgr_time_to_seq(job.handle, t0, 0, &seq0) < 0) || (dlgr_time_to_seq(job.handle, t1, 1, &seq1) < 0)){
+            fprintf(stderr, "Could not find the records of %s between %lld and %lld.\n", var_name, t0, t1);
+            free(job.columns);
+            return -1;
+        }
+        lo = seq0 > lo ? seq0 : lo;
+        hi = seq1 < hi ? seq1 : hi;
+    }
+
+    const size_t record_bytes = binary ? (size_t) job.var_size : job.max_row;
+    job.chunk_records = record_bytes < EXPORT_CHUNK_BYTES ? (int) (EXPORT_CHUNK_BYTES / record_bytes) : 1;
+    if(export_plan(&job, lo, hi) < 0){
+        fprintf(stderr, "Could not plan the export of %s.\n", var_name);
+        free(job.columns);
+        return -1;
+    }
+
+    int retval = binary ? 1 : export_header(&job, fd);
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+    pthread_t tids[EXPORT_MAX_WORKERS];
+    int number_started = 0;
+    for(int i = 0; (retval > 0) && (i < workers) && (i < job.num_chunks); i++){
+        if(pthread_create(&tids[number_started], NULL, export_worker, &job) == 0){
+            number_started++;
+        }
+    }
+    if((number_started == 0) && (job.num_chunks > 0)){
+        retval = -1;
+    }
+
+    // Write chunks out in order as they are done.
+    long long number_exported = 0;
+    for(int i = 0; (retval > 0) && (i < job.num_chunks); i++){
+        export_chunk_t* chunk = &job.chunks[i];
+        pthread_mutex_lock(&job.lock);
+        while(chunk->state == EXPORT_QUEUED){
+            pthread_cond_wait(&job.cond, &job.lock);
+        }
+        pthread_mutex_unlock(&job.lock);
+
+        if(chunk->state == EXPORT_FAILED){
+            fprintf(stderr, "Could not read records %lld to %lld of %s.\n", chunk->first_seq, chunk->first_seq + chunk->count - 1, var_name);
+            retval = -1;
+        } else if(export_write_full(fd, chunk->out, chunk->out_len) < 0){
+            fprintf(stderr, "Could not write out %s.\n", var_name);
+            retval = -1;
+        } else {
+            number_exported += chunk->count;
+        }
+        free(chunk->out);
+        chunk->out = NULL;
+
+        pthread_mutex_lock(&job.lock);
+        job.chunks_written++;
+        job.failed = retval < 0;
+        pthread_cond_broadcast(&job.cond);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    for(int i = 0; i < number_started; i++){
+        pthread_join(tids[i], NULL);
+    }
+    for(int i = 0; i < job.num_chunks; i++){
+        free(job.chunks[i].out);
+    }
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.cond);
+    free(job.chunks);
+    free(job.columns);
+
+    if(retval > 0){
+        fprintf(stderr, "Exported %lld records of %s.\n", number_exported, var_name);
+    }
+    return retval;
+}
+
+int main(int argc, char** argv){
+    const char* dir = NULL;
+    const char* out_dir = NULL;
+    int binary = 0;
+    int workers = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    long long first_seq = -1, count = -1;
+    long long t0 = 1, t1 = 0;
+
+    int opt;
+    int usage = 0;
+    while((opt = getopt(argc, argv, "bd:o:j:s:n:t:")) != -1){
+        switch(opt){
+            case 'b':
+                binary = 1;
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'j':
+                workers = atoi(optarg);
+                usage |= (workers < 1) || (workers > EXPORT_MAX_WORKERS);
+                break;
+            case 's':
+                first_seq = strtoll(optarg, NULL, 0);
+                usage |= first_seq < 0;
+                break;
+            case 'n':
+                count = strtoll(optarg, NULL, 0);
+                usage |= count < 0;
+                break;
+            case 't':
+                usage |= (sscanf(optarg, "%lli,%lli", &t0, &t1) != 2) || (t0 > t1);
+                break;
+            default:
+                usage = 1;
+                break;
+        }
+    }
+    if(usage || (optind >= argc)){
+        fprintf(stderr, "Usage: %s [-b] [-d dir] [-o out_dir] [-j workers] [-s first_seq] [-n count] [-t t0,t1] var_name...\n", argv[0]);
+        return 1;
+    }
+    if(workers > EXPORT_MAX_WORKERS){
+        workers = EXPORT_MAX_WORKERS;
+    }
+
+    if(out_dir != NULL){
+        mkdir(out_dir, 0755);
+    }
+
+    // The log may belong to a running process; leave its manifests to it.
+    if(dlgr_open_read_only(dir) < 0){
+        return 1;
+    }
+
+    int failed = 0;
+    for(int i = optind; i < argc; i++){
+        int fd = STDOUT_FILENO;
+        if(out_dir != NULL){
+            char fname_buf[0x400];
+            snprintf(fname_buf, sizeof(fname_buf), "%s/%s.%s", out_dir, argv[i], binary ? "bin" : "csv");
+            if((fd = open(fname_buf, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0){
+                fprintf(stderr, "Could not open %s.\n", fname_buf);
+                failed = 1;
+                continue;
+            }
+        }
+        if(export_var(argv[i], fd, binary, workers, first_seq, count, t0, t1) < 0){
+            failed = 1;
+        }
+        if(fd != STDOUT_FILENO){
+            close(fd);
+        }
+    }
+
+    return failed;
+}
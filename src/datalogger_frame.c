@@ -0,0 +1,623 @@
+/**
+ * @file datalogger_frame.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Frames: several variables logged together as one record.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#define _GNU_SOURCE // memfd_create()
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Frame layout file
+/* acs_frame.frm        <-- Number of members and whether they are columnar, then one "name offset size type" line per member.
+ * 3 0
+ * acs_x 0 4 9
+ * acs_y 4 4 9
+ * acs_z 8 4 9
+ */
+
+// Records up to this size are gathered on the stack.
+#define DLGR_FRAME_STACK_SIZE 0x1000
+
+// Rows reassembled from columns per pass.
+#define DLGR_COLUMN_CHUNK_SIZE 0x10000
+
+// Registers frame_name with layout, which it takes ownership of, and stores the layout in frame_name.frm.
+static int dlgr_register_layout(const char* frame_name, int frame_size, dlgr_member_layout_t* layout, int num_members, dlgr_options_t options){
+    // Columns are a property of the layout, which is only known here.
+    const int columnar = options.columnar ? 1 : 0;
+
+    // Registering the same layout again keeps the history.
+    int handle = dlgr_find_registration(frame_name, frame_size, options);
+    if(handle >= 0){
+        dlgr_var_t* var = dlgr_get_var(handle);
+        pthread_mutex_lock(&var->lock);
+        int same = var->num_members == num_members;
+        for(int i = 0; same && (i < num_members); i++){
+            same = (strcmp(var->members[i].name, layout[i].name) == 0) && (var->members[i].offset == layout[i].offset)
+                && (var->members[i].size == layout[i].size) && (var->members[i].type == layout[i].type);
+        }
+        pthread_mutex_unlock(&var->lock);
+        if(same){
+            free(layout);
+            return handle;
+        }
+    }
+
+    handle = dlgr_register_columns(frame_name, frame_size, options);
+    if(handle < 0){
+        free(layout);
+        return -1;
+    }
+
+    // Store the layout.
+    const int fname_buf_size = strlen(frame_name) + 7; // 7 == sizeof("_0.log")
+    char fname_buf[fname_buf_size];
+    snprintf(fname_buf, fname_buf_size, "%s.frm", frame_name);
+
+    FILE* frame_f = dlgr_fopen_log(fname_buf, "w");
+    if(frame_f == NULL){
+        eprintf("Registration failed: Could not open %s for writing.", fname_buf);
+        free(layout);
+        return -1;
+    }
+
+    int retval = fprintf(frame_f, "%d %d\n", num_members, columnar);
+    for(int i = 0; (i < num_members) && (retval > 0); i++){
+        retval = fprintf(frame_f, "%s %d %d %d\n", layout[i].name, layout[i].offset, layout[i].size, layout[i].type);
+    }
+    if((fclose(frame_f) != 0) || (retval <= 0)){
+        eprintf("Registration failed: Writing to %s failed.", fname_buf);
+        unlinkat(dlgr_log_dir_fd(), fname_buf, 0);
+        free(layout);
+        return -1;
+    }
+
+    // Columns replace the rows of the new _0 segment.
+    if(columnar){
+        snprintf(fname_buf, fname_buf_size, "%s_0.log", frame_name);
+        const int hot_fd = dlgr_hot_dir_fd();
+        unlinkat(hot_fd >= 0 ? hot_fd : dlgr_log_dir_fd(), fname_buf, 0);
+    }
+
+    dlgr_var_t* var = dlgr_get_var(handle);
+    pthread_mutex_lock(&var->lock);
+    free(var->members);
+    var->members = layout;
+    var->num_members = num_members;
+    var->columnar = columnar;
+    pthread_mutex_unlock(&var->lock);
+
+    return handle;
+}
+
+int dlgr_register_frame(const char* frame_name, const dlgr_member_t* members, int num_members, dlgr_options_t options){
+    // Check if frame_name is NULL.
+    if (frame_name == NULL){
+        eprintf("Frame name is NULL.");
+        return -1;
+    }
+
+    // Check if there are any members.
+    if ((members == NULL) || (num_members < 1)){
+        eprintf("Frame %s has no members.", frame_name);
+        return -1;
+    }
+
+    // Lay out the members back to back.
+    dlgr_member_layout_t* layout = calloc(num_members, sizeof(dlgr_member_layout_t));
+    if(layout == NULL){
+        eprintf("Could not allocate the layout of %s.", frame_name);
+        return -1;
+    }
+
+    int frame_size = 0;
+    for(int i = 0; i < num_members; i++){
+        if((members[i].name == NULL) || (strlen(members[i].name) >= MAX_VAR_NAME_SIZE) || (strchr(members[i].name, ' ') != NULL)){
+            eprintf("Member %d of %s has an invalid name.", i, frame_name);
+            free(layout);
+            return -1;
+        }
+        if((members[i].size < 1) || (members[i].size > (MAX_VAR_SIZE - frame_size))){
+            eprintf("Member %s of %s has invalid size %d.", members[i].name, frame_name, members[i].size);
+            free(layout);
+            return -1;
+        }
+        strcpy(layout[i].name, members[i].name);
+        layout[i].offset = frame_size;
+        layout[i].size = members[i].size;
+        layout[i].type = DLGR_TYPE_NONE;
+        frame_size += members[i].size;
+    }
+
+    // Register the frame as a variable the size of a whole record.
+    return dlgr_register_layout(frame_name, frame_size, layout, num_members, options);
+}
+
+int dlgr_register_struct(const char* struct_name, int struct_size, const dlgr_field_t* fields, int num_fields, dlgr_options_t options){
+    // Check if struct_name is NULL.
+    if (struct_name == NULL){
+        eprintf("Struct name is NULL.");
+        return -1;
+    }
+
+    // Check if there are any fields.
+    if ((fields == NULL) || (num_fields < 1)){
+        eprintf("Struct %s has no fields.", struct_name);
+        return -1;
+    }
+
+    // Check if struct_size is valid.
+    if ((struct_size < 1) || (struct_size > MAX_VAR_SIZE)){
+        eprintf("Struct size %d invalid.", struct_size);
+        return -1;
+    }
+
+    dlgr_member_layout_t* layout = calloc(num_fields, sizeof(dlgr_member_layout_t));
+    if(layout == NULL){
+        eprintf("Could not allocate the layout of %s.", struct_name);
+        return -1;
+    }
+
+    for(int i = 0; i < num_fields; i++){
+        if((fields[i].name == NULL) || (strlen(fields[i].name) >= MAX_VAR_NAME_SIZE) || (strchr(fields[i].name, ' ') != NULL)){
+            eprintf("Field %d of %s has an invalid name.", i, struct_name);
+            free(layout);
+            return -1;
+        }
+        const int type_size = dlgr_type_size(fields[i].type);
+        if((fields[i].offset < 0) || (fields[i].size < 1) || (fields[i].size > (struct_size - fields[i].offset))
+            || (type_size < 0) || ((type_size > 0) && ((fields[i].size % type_size) != 0))){
+            eprintf("Field %s of %s has invalid offset %d, size %d, or type %d.", fields[i].name, struct_name, fields[i].offset, fields[i].size, fields[i].type);
+            free(layout);
+            return -1;
+        }
+        for(int j = 0; j < i; j++){
+            if((fields[i].offset < (layout[j].offset + layout[j].size)) && (layout[j].offset < (fields[i].offset + fields[i].size))){
+                eprintf("Fields %s and %s of %s overlap.", layout[j].name, fields[i].name, struct_name);
+                free(layout);
+                return -1;
+            }
+        }
+        strcpy(layout[i].name, fields[i].name);
+        layout[i].offset = fields[i].offset;
+        layout[i].size = fields[i].size;
+        layout[i].type = fields[i].type;
+    }
+
+    return dlgr_register_layout(struct_name, struct_size, layout, num_fields, options);
+}
+
+int dlgr_load_frame(dlgr_var_t* var){
+    const int fname_buf_size = strlen(var->var_name) + 5; // 5 == sizeof(".frm")
+    char fname_buf[fname_buf_size];
+    snprintf(fname_buf, fname_buf_size, "%s.frm", var->var_name);
+
+    // Most variables are not frames.
+    FILE* frame_f = dlgr_fopen_log(fname_buf, "r");
+    if(frame_f == NULL){
+        return 0;
+    }
+
+    // Older layouts have neither the columnar flag nor types.
+    char line[MAX_VAR_NAME_SIZE + 0x40];
+    int num_members = 0, columnar = 0;
+    if((fgets(line, sizeof(line), frame_f) == NULL) || (sscanf(line, "%d %d", &num_members, &columnar) < 1) || (num_members < 1)){
+        eprintf("Frame file %s is corrupt.", fname_buf);
+        fclose(frame_f);
+        return -1;
+    }
+
+    dlgr_member_layout_t* layout = calloc(num_members, sizeof(dlgr_member_layout_t));
+    if(layout == NULL){
+        eprintf("Could not allocate the layout of %s.", var->var_name);
+        fclose(frame_f);
+        return -1;
+    }
+
+    char format[0x20];
+    snprintf(format, sizeof(format), "%%%ds %%d %%d %%d", MAX_VAR_NAME_SIZE - 1);
+    for(int i = 0; i < num_members; i++){
+        layout[i].type = DLGR_TYPE_NONE;
+        if((fgets(line, sizeof(line), frame_f) == NULL) || (sscanf(line, format, layout[i].name, &layout[i].offset, &layout[i].size, (int*) &layout[i].type) < 3)
+            || (layout[i].offset < 0) || (dlgr_type_size(layout[i].type) < 0) || (layout[i].size < 1) || ((layout[i].offset + layout[i].size) > var->var_size)){
+            eprintf("Frame file %s is corrupt at member %d.", fname_buf, i);
+            free(layout);
+            fclose(frame_f);
+            return -1;
+        }
+    }
+    fclose(frame_f);
+
+    var->members = layout;
+    var->num_members = num_members;
+    var->columnar = columnar ? 1 : 0;
+
+    return 1;
+}
+
+int dlgr_write_frame(int handle, const void* const* member_data){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    if(member_data == NULL){
+        eprintf("Member data is NULL.");
+        return -1;
+    }
+
+    unsigned char stack_record[DLGR_FRAME_STACK_SIZE];
+    unsigned char* record = stack_record;
+
+    // The layout is only replaced by re-registration, which must not race writers.
+    pthread_mutex_lock(&var->lock);
+    const int var_size = var->var_size;
+    if(var->num_members < 1){
+        pthread_mutex_unlock(&var->lock);
+        eprintf("%s is not a frame.", var->var_name);
+        return -1;
+    }
+    if((var_size > DLGR_FRAME_STACK_SIZE) && ((record = malloc(var_size)) == NULL)){
+        pthread_mutex_unlock(&var->lock);
+        eprintf("Could not allocate a record of %s.", var->var_name);
+        return -1;
+    }
+    for(int i = 0; i < var->num_members; i++){
+        if(member_data[i] == NULL){
+            pthread_mutex_unlock(&var->lock);
+            eprintf("Data of member %s of %s is NULL.", var->members[i].name, var->var_name);
+            if(record != stack_record){
+                free(record);
+            }
+            return -1;
+        }
+        memcpy(&record[var->members[i].offset], member_data[i], var->members[i].size);
+    }
+    pthread_mutex_unlock(&var->lock);
+
+    // Written as a single record, so all members land in the same slot of the log.
+    int retval = dlgr_write_timed_handle(handle, record, NULL, 1);
+
+    if(record != stack_record){
+        free(record);
+    }
+
+    return retval;
+}
+
+// Finds a member of var by name. Negative if there is none, its index otherwise.
+static int dlgr_find_member(dlgr_var_t* var, const char* member_name, dlgr_member_layout_t* member, int* columnar){
+    int index = -1;
+    pthread_mutex_lock(&var->lock);
+    for(int i = 0; i < var->num_members; i++){
+        if(strcmp(var->members[i].name, member_name) == 0){
+            *member = var->members[i];
+            index = i;
+            break;
+        }
+    }
+    *columnar = var->columnar;
+    pthread_mutex_unlock(&var->lock);
+
+    if(index < 0){
+        eprintf("%s has no member %s.", var->var_name, member_name);
+    }
+
+    return index;
+}
+
+int dlgr_read_member(int handle, const char* member_name, void* storage, int count){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    if((member_name == NULL) || (storage == NULL)){
+        eprintf("Member name or storage is NULL.");
+        return -1;
+    }
+
+    if(count <= 0){
+        eprintf("Count %d is invalid.", count);
+        return -1;
+    }
+
+    // Find the member.
+    dlgr_member_layout_t member;
+    int columnar;
+    if(dlgr_find_member(var, member_name, &member, &columnar) < 0){
+        return -1;
+    }
+    const int offset = member.offset;
+    const int size = member.size;
+    unsigned char* storage_ptr = (unsigned char*) storage;
+
+    // A column holds the newest values back to back; read them oldest first and turn them around.
+    if(columnar){
+        long long first_seq, next_seq;
+        if(dlgr_get_seq_range(handle, &first_seq, &next_seq) < 0){
+            return -1;
+        }
+        if((next_seq - first_seq) > count){
+            first_seq = next_seq - count;
+        }
+        if(next_seq == first_seq){
+            return 0;
+        }
+        const int number_read = dlgr_read_field_handle(handle, member_name, first_seq, next_seq - first_seq, storage);
+        unsigned char tmp[0x100];
+        for(int lo = 0, hi = number_read - 1; lo < hi; lo++, hi--){
+            for(int done = 0; done < size; done += sizeof(tmp)){
+                const int chunk = (size - done) < (int) sizeof(tmp) ? (size - done) : (int) sizeof(tmp);
+                memcpy(tmp, &storage_ptr[(size_t) lo * size + done], chunk);
+                memcpy(&storage_ptr[(size_t) lo * size + done], &storage_ptr[(size_t) hi * size + done], chunk);
+                memcpy(&storage_ptr[(size_t) hi * size + done], tmp, chunk);
+            }
+        }
+        return number_read;
+    }
+
+    // Pick the member out of each mapped record, so whole frames are never copied.
+    dlgr_view_t view;
+    if(dlgr_view_open(handle, &view) < 0){
+        return -1;
+    }
+
+    int number_read = 0;
+    for(int span = view.num_spans - 1; (span >= 0) && (number_read < count); span--){
+        const unsigned char* data = (const unsigned char*) view.spans[span].data;
+        for(int record = view.spans[span].count - 1; (record >= 0) && (number_read < count); record--){
+            memcpy(&storage_ptr[(size_t) number_read * size], &data[(size_t) record * view.var_size + offset], size);
+            number_read++;
+        }
+    }
+
+    dlgr_view_close(&view);
+
+    return number_read;
+}
+
+int dlgr_read_field(const char* var_name, const char* field_name, long long first_seq, int count, void* storage){
+    // Check if var_name is NULL.
+    if (var_name == NULL){
+        eprintf("Variable name is NULL.");
+        return -1;
+    }
+
+    int handle = dlgr_get_handle(var_name);
+    if(handle < 0){
+        eprintf("Read failed: %s has not been registered.", var_name);
+        return -1;
+    }
+
+    return dlgr_read_field_handle(handle, field_name, first_seq, count, storage);
+}
+
+int dlgr_read_field_handle(int handle, const char* field_name, long long first_seq, int count, void* storage){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    if((field_name == NULL) || (storage == NULL)){
+        eprintf("Field name or storage is NULL.");
+        return -1;
+    }
+
+    if((count <= 0) || (first_seq < 0)){
+        eprintf("Range of %d records from %lld is invalid.", count, first_seq);
+        return -1;
+    }
+
+    dlgr_member_layout_t member;
+    int columnar;
+    const int index = dlgr_find_member(var, field_name, &member, &columnar);
+    if(index < 0){
+        return -1;
+    }
+    const int size = member.size;
+    unsigned char* storage_ptr = (unsigned char*) storage;
+    int number_read = 0;
+
+    // Rows: pick the field out of each mapped record.
+    if(!columnar){
+        dlgr_view_t view;
+        if(dlgr_view_open_range(handle, first_seq, count, &view) < 0){
+            return -1;
+        }
+        if((view.num_spans > 0) && (first_seq < view.spans[0].first_seq)){
+            eprintf("Record %lld of %s has been removed, the oldest is %lld.", first_seq, var->var_name, view.spans[0].first_seq);
+            DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+            dlgr_view_close(&view);
+            return -1;
+        }
+        for(int span = 0; (span < view.num_spans) && (number_read < count); span++){
+            const dlgr_span_t* s = &view.spans[span];
+            long long seq = first_seq + number_read;
+            if(seq < s->first_seq){
+                break;
+            }
+            const unsigned char* data = (const unsigned char*) s->data;
+            for(; (seq < (s->first_seq + s->count)) && (number_read < count); seq++){
+                memcpy(&storage_ptr[(size_t) number_read * size], &data[(size_t) (seq - s->first_seq) * view.var_size + member.offset], size);
+                number_read++;
+            }
+        }
+        dlgr_view_close(&view);
+        return number_read;
+    }
+
+    // Columns: one contiguous read per segment, of this field only.
+    dlgr_snapshot_t snapshot;
+    if(dlgr_snapshot(handle, -1, &snapshot) < 0){
+        return -1;
+    }
+    const dlgr_segment_info_t* segments = snapshot.segments;
+
+    if(first_seq < segments[0].first_seq){
+        eprintf("Record %lld of %s has been removed, the oldest is %lld.", first_seq, var->var_name, segments[0].first_seq);
+        DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+        dlgr_snapshot_free(&snapshot);
+        return -1;
+    }
+
+    // Binary-search for the segment holding first_seq: the last one starting at or before it.
+    int lo = 0, hi = snapshot.num_segments - 1;
+    while(lo < hi){
+        const int mid = lo + ((hi - lo + 1) / 2);
+        if(segments[mid].first_seq <= first_seq){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    char ext[0x10];
+    snprintf(ext, sizeof(ext), "c%d", index);
+    for(int i = lo; (i < snapshot.num_segments) && (number_read < count); i++){
+        const long long seq = first_seq + number_read;
+        const int offset = seq - segments[i].first_seq;
+        int number_this_file = segments[i].records - offset;
+        if(number_this_file <= 0){
+            continue;
+        }
+        if(number_this_file > (count - number_read)){
+            number_this_file = count - number_read;
+        }
+
+        int column_fd = dlgr_open_segment_read(var, segments[i].var_index, ext);
+        if(column_fd < 0){
+            eprintf("Segment %d of %s has been removed.", segments[i].var_index, var->var_name);
+            DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+            dlgr_snapshot_free(&snapshot);
+            return -1;
+        }
+
+        const ssize_t bytes = (ssize_t) number_this_file * size;
+        ssize_t retval = pread(column_fd, &storage_ptr[(size_t) number_read * size], bytes, (off_t) offset * size);
+        close(column_fd);
+        if(retval != bytes){
+            eprintf("Failed to read %d values of %s of segment %d of %s.", number_this_file, field_name, segments[i].var_index, var->var_name);
+            DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+            dlgr_snapshot_free(&snapshot);
+            return -1;
+        }
+        number_read += number_this_file;
+    }
+
+    // Rows were counted by their view.
+    dlgr_snapshot_free(&snapshot);
+    DLGR_COUNT(var, reads, 1);
+    DLGR_COUNT(var, bytes_read, (unsigned long long) number_read * size);
+    return number_read;
+}
+
+int dlgr_open_columns(const dlgr_var_t* var, int var_index, int first_record, int count){
+    // The layout is only replaced by re-registration, which must not race readers; and callers may hold var->lock.
+    const int num_members = var->num_members;
+    const int var_size = var->var_size;
+    int* column_fds = malloc(num_members * sizeof(int));
+    if(column_fds == NULL){
+        eprintf("Could not allocate the columns of %s.", var->var_name);
+        return -1;
+    }
+
+    // Every column holds the whole records of the segment, and maybe part of one being written.
+    int records = -1;
+    int max_size = 0;
+    char ext[0x10];
+    int opened = 0;
+    for(; opened < num_members; opened++){
+        snprintf(ext, sizeof(ext), "c%d", opened);
+        struct stat stbuf;
+        if((column_fds[opened] = dlgr_open_segment_read(var, var_index, ext)) < 0){
+            break;
+        }
+        if(fstat(column_fds[opened], &stbuf) != 0){
+            close(column_fds[opened]);
+            break;
+        }
+        const int size = var->members[opened].size;
+        const int column_records = stbuf.st_size / size;
+        if((records < 0) || (column_records < records)){
+            records = column_records;
+        }
+        max_size = size > max_size ? size : max_size;
+    }
+
+    // Only the rows asked for.
+    int end = records;
+    if(first_record > records){
+        first_record = records;
+    }
+    if((count >= 0) && ((first_record + count) < end)){
+        end = first_record + count;
+    }
+
+    int fd = -1;
+    if(opened == num_members){
+        char name_buf[MAX_FNAME_SIZE];
+        snprintf(name_buf, MAX_FNAME_SIZE, "%s_%d", var->var_name, var_index);
+        fd = memfd_create(name_buf, MFD_CLOEXEC);
+    }
+
+    // Reassemble a chunk of rows at a time. Bytes between members stay zero.
+    const int chunk_records = var_size < DLGR_COLUMN_CHUNK_SIZE ? DLGR_COLUMN_CHUNK_SIZE / var_size : 1;
+    unsigned char* rows = fd >= 0 ? calloc(chunk_records, var_size) : NULL;
+    unsigned char* column = fd >= 0 ? malloc((size_t) chunk_records * max_size) : NULL;
+    int failed = (fd < 0) || (rows == NULL) || (column == NULL) || (ftruncate(fd, (off_t) end * var_size) != 0);
+    for(int done = first_record; !failed && (done < end); ){
+        const int chunk = (end - done) < chunk_records ? (end - done) : chunk_records;
+        for(int i = 0; !failed && (i < num_members); i++){
+            const int offset = var->members[i].offset;
+            const int size = var->members[i].size;
+            if(pread(column_fds[i], column, (size_t) chunk * size, (off_t) done * size) != (ssize_t) ((size_t) chunk * size)){
+                failed = 1;
+                break;
+            }
+            for(int record = 0; record < chunk; record++){
+                memcpy(&rows[(size_t) record * var_size + offset], &column[(size_t) record * size], size);
+            }
+        }
+        if(!failed && (pwrite(fd, rows, (size_t) chunk * var_size, (off_t) done * var_size) != (ssize_t) ((size_t) chunk * var_size))){
+            failed = 1;
+        }
+        done += chunk;
+    }
+
+    for(int i = 0; i < opened; i++){
+        close(column_fds[i]);
+    }
+    free(column_fds);
+    free(rows);
+    free(column);
+
+    if(failed){
+        if(fd >= 0){
+            eprintf("Could not reassemble segment %d of %s.", var_index, var->var_name);
+            close(fd);
+        }
+        return -1;
+    }
+
+    return fd;
+}
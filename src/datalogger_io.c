@@ -0,0 +1,627 @@
+/**
+ * @file datalogger_io.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Log file I/O: one system call per operation, or batched through Linux io_uring.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Batches
+/* Under DLGR_IO_URING the writer thread brackets each pass with dlgr_io_batch_begin() and dlgr_io_batch_end(), holding
+ * the lock of every variable it appended to until its writes land. Meanwhile writes are copied into an arena and queued
+ * as SQEs instead of being made, those of one variable linked in order, so a failed write cancels the rest of its chain.
+ * The end submits every chain in one io_uring_enter() and waits for them. A write that failed takes the variable back to
+ * the first record it carried, for the next write to overwrite, before any reader can see it; closing a segment
+ * completes the batch first, so rotation and compression see whole files.
+ * Syncs are not waited on under the locks: each file to sync is duplicated and set aside, and dlgr_io_batch_sync() syncs
+ * them all in one more submission once the writer has let the variables go. The duplicates keep the files open should
+ * a segment rotate meanwhile.
+ * Each thread has a ring of its own, set up on first use and torn down when the thread exits.
+ */
+
+#define DLGR_IO_QUEUE_DEPTH 0x100 // Entries of each ring, and operations in flight per submission.
+#define DLGR_IO_ARENA_SIZE 0x100000 // Bytes of writes a batch holds before it is submitted.
+
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    unsigned mask;
+    unsigned tail; // Next free SQE, published to the kernel when submitting.
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map; // Same as sq_map with IORING_FEAT_SINGLE_MMAP.
+    size_t cq_map_size;
+} dlgr_uring_t;
+
+// A batched write or sync, in the order queued.
+typedef struct
+{
+    dlgr_var_t* var;
+    int record; // First record the write carries.
+    unsigned len;
+} dlgr_io_op_t;
+
+typedef struct
+{
+    dlgr_var_t* var;
+    int var_index; // Segment being synced, as var may have rotated since.
+    int fd; // Duplicate of the file, closed once synced.
+    int counted; // Set on the last file of a segment, which counts the sync.
+} dlgr_io_sync_t;
+
+typedef struct
+{
+    dlgr_uring_t ring;
+    int results[DLGR_IO_QUEUE_DEPTH]; // Result of each SQE of the last submission, by user_data.
+    int batching;
+    unsigned char* arena;
+    size_t arena_used;
+    dlgr_io_op_t ops[DLGR_IO_QUEUE_DEPTH];
+    int num_ops;
+    dlgr_io_sync_t syncs[DLGR_IO_QUEUE_DEPTH];
+    int num_syncs;
+} dlgr_io_thread_t;
+
+static atomic_int dlgr_io_backend = DLGR_IO_POSIX;
+
+static pthread_key_t dlgr_io_key;
+static pthread_once_t dlgr_io_key_once = PTHREAD_ONCE_INIT;
+static __thread dlgr_io_thread_t* dlgr_io_self = NULL;
+
+static long long dlgr_io_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+// Counts a completed sync of var that took sync_ns.
+static void dlgr_io_count_sync(dlgr_var_t* var, unsigned long long sync_ns){
+    DLGR_COUNT(var, syncs, 1);
+    DLGR_COUNT(var, sync_ns, sync_ns);
+    // Batched syncs are counted without var->lock.
+    unsigned long long max_ns = atomic_load_explicit(&var->counters.sync_max_ns, memory_order_relaxed);
+    while((sync_ns > max_ns) && !atomic_compare_exchange_weak_explicit(&var->counters.sync_max_ns, &max_ns, sync_ns, memory_order_relaxed, memory_order_relaxed));
+}
+
+static void dlgr_uring_teardown(dlgr_uring_t* ring){
+    if(ring->fd < 0){
+        return;
+    }
+    if(ring->sqes != NULL){
+        munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+    }
+    if((ring->cq_map != NULL) && (ring->cq_map != ring->sq_map)){
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if(ring->sq_map != NULL){
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    close(ring->fd);
+    memset(ring, 0x0, sizeof(dlgr_uring_t));
+    ring->fd = -1;
+}
+
+// Sets up a ring and checks the kernel can read, write, and sync through it.
+static int dlgr_uring_setup(dlgr_uring_t* ring){
+    struct io_uring_params params;
+    memset(&params, 0x0, sizeof(params));
+    memset(ring, 0x0, sizeof(dlgr_uring_t));
+    ring->fd = syscall(__NR_io_uring_setup, DLGR_IO_QUEUE_DEPTH, &params);
+    if(ring->fd < 0){
+        return -1;
+    }
+    ring->entries = params.sq_entries;
+    ring->mask = params.sq_entries - 1;
+
+    ring->sq_map_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+    ring->cq_map_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    const int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(single && (ring->cq_map_size > ring->sq_map_size)){
+        ring->sq_map_size = ring->cq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_map == MAP_FAILED){
+        ring->sq_map = NULL;
+        dlgr_uring_teardown(ring);
+        return -1;
+    }
+    ring->cq_map = single ? ring->sq_map : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if(ring->cq_map == MAP_FAILED){
+        ring->cq_map = NULL;
+        dlgr_uring_teardown(ring);
+        return -1;
+    }
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED){
+        ring->sqes = NULL;
+        dlgr_uring_teardown(ring);
+        return -1;
+    }
+
+    unsigned char* sq = (unsigned char*) ring->sq_map;
+    unsigned char* cq = (unsigned char*) ring->cq_map;
+    ring->sq_head = (unsigned*) &sq[params.sq_off.head];
+    ring->sq_tail = (unsigned*) &sq[params.sq_off.tail];
+    ring->cq_head = (unsigned*) &cq[params.cq_off.head];
+    ring->cq_tail = (unsigned*) &cq[params.cq_off.tail];
+    ring->cq_mask = *(unsigned*) &cq[params.cq_off.ring_mask];
+    ring->cqes = (struct io_uring_cqe*) &cq[params.cq_off.cqes];
+    ring->tail = *ring->sq_tail;
+
+    // SQE i always sits in slot i of the submission queue.
+    unsigned* array = (unsigned*) &sq[params.sq_off.array];
+    for(unsigned i = 0; i < params.sq_entries; i++){
+        array[i] = i;
+    }
+
+    // Reads and writes at an offset came after io_uring itself, in Linux 5.6.
+    const int num_probe_ops = IORING_OP_LAST;
+    struct io_uring_probe* probe = calloc(1, sizeof(struct io_uring_probe) + (num_probe_ops * sizeof(struct io_uring_probe_op)));
+    int supported = 0;
+    if((probe != NULL) && (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, num_probe_ops) == 0)){
+        supported = (probe->last_op >= IORING_OP_WRITE)
+            && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+            && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)
+            && (probe->ops[IORING_OP_FSYNC].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if(!supported){
+        dlgr_uring_teardown(ring);
+        return -1;
+    }
+
+    return 1;
+}
+
+// Takes the next SQE, zeroed, or NULL if the queue is full.
+static struct io_uring_sqe* dlgr_uring_get_sqe(dlgr_uring_t* ring){
+    if((ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) >= ring->entries){
+        return NULL;
+    }
+    struct io_uring_sqe* sqe = &ring->sqes[ring->tail & ring->mask];
+    memset(sqe, 0x0, sizeof(struct io_uring_sqe));
+    sqe->user_data = ring->tail - *ring->sq_tail;
+    ring->tail++;
+    return sqe;
+}
+
+// Submits the queued SQEs and waits for all of them, storing each result by user_data. Negative if the ring failed.
+static int dlgr_uring_run(dlgr_uring_t* ring, int* results){
+    const unsigned number = ring->tail - *ring->sq_tail;
+    if(number == 0){
+        return 1;
+    }
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+
+    unsigned submitted = 0, completed = 0;
+    while(completed < number){
+        int retval = syscall(__NR_io_uring_enter, ring->fd, number - submitted, number - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(retval < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            if((errno != EAGAIN) && (errno != EBUSY)){
+                return -1;
+            }
+            // The completion queue is full, or the kernel is short of memory; reap what completed before entering again.
+            retval = 0;
+        }
+        submitted += retval;
+
+        unsigned head = *ring->cq_head;
+        const unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != cq_tail; head++){
+            const struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+            results[cqe->user_data] = cqe->res;
+            completed++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 1;
+}
+
+static void dlgr_io_thread_free(void* arg){
+    dlgr_io_thread_t* self = (dlgr_io_thread_t*) arg;
+    dlgr_uring_teardown(&self->ring);
+    free(self->arena);
+    free(self);
+}
+
+static void dlgr_io_make_key(void){
+    pthread_key_create(&dlgr_io_key, dlgr_io_thread_free);
+}
+
+// The io_uring state of the calling thread, set up on first use. Its ring.fd is -1 if the thread could not get a ring.
+static dlgr_io_thread_t* dlgr_io_thread(void){
+    if(dlgr_io_self != NULL){
+        return dlgr_io_self;
+    }
+
+    dlgr_io_thread_t* self = calloc(1, sizeof(dlgr_io_thread_t));
+    if(self == NULL){
+        return NULL;
+    }
+    if(dlgr_uring_setup(&self->ring) < 0){
+        self->ring.fd = -1;
+    }
+
+    pthread_once(&dlgr_io_key_once, dlgr_io_make_key);
+    pthread_setspecific(dlgr_io_key, self);
+    dlgr_io_self = self;
+    return self;
+}
+
+// Replaces a ring that failed, going back to POSIX calls if there can't be another.
+static void dlgr_io_reset(dlgr_io_thread_t* self){
+    dlgr_uring_teardown(&self->ring);
+    if(dlgr_uring_setup(&self->ring) < 0){
+        eprintf("Could not set up io_uring again, falling back to POSIX calls.");
+        atomic_store(&dlgr_io_backend, DLGR_IO_POSIX);
+        self->ring.fd = -1;
+    }
+}
+
+int dlgr_set_io_backend(dlgr_io_backend_t backend){
+    if((backend < DLGR_IO_POSIX) || (backend > DLGR_IO_URING)){
+        eprintf("I/O backend %d invalid.", backend);
+        return -1;
+    }
+
+    // Fall back on POSIX calls where the kernel has no io_uring, or forbids it.
+    if(backend == DLGR_IO_URING){
+        dlgr_io_thread_t* self = dlgr_io_thread();
+        if((self != NULL) && (self->ring.fd < 0) && (dlgr_uring_setup(&self->ring) < 0)){
+            self->ring.fd = -1;
+        }
+        if((self == NULL) || (self->ring.fd < 0)){
+            backend = DLGR_IO_POSIX;
+        }
+    }
+    atomic_store(&dlgr_io_backend, backend);
+
+    return backend;
+}
+
+int dlgr_io_batch_begin(void){
+    if(atomic_load_explicit(&dlgr_io_backend, memory_order_relaxed) != DLGR_IO_URING){
+        return 0;
+    }
+
+    dlgr_io_thread_t* self = dlgr_io_thread();
+    if((self == NULL) || (self->ring.fd < 0)){
+        return 0;
+    }
+    if((self->arena == NULL) && ((self->arena = malloc(DLGR_IO_ARENA_SIZE)) == NULL)){
+        return 0;
+    }
+
+    self->batching = 1;
+    return 1;
+}
+
+// Submits the batched writes of self and waits for them.
+static int dlgr_io_flush_writes(dlgr_io_thread_t* self){
+    if(self->num_ops == 0){
+        return 1;
+    }
+
+    // A submission cannot end mid-chain.
+    self->ring.sqes[(self->ring.tail - 1) & self->ring.mask].flags &= ~IOSQE_IO_LINK;
+
+    if(dlgr_uring_run(&self->ring, self->results) < 0){
+        // The ring is no use any more; fail whatever it did not complete, and start over with a new one.
+        eprintf("io_uring failed, %d batched writes lost.", self->num_ops);
+        for(int i = 0; i < self->num_ops; i++){
+            self->results[i] = -EIO;
+        }
+        dlgr_io_reset(self);
+    }
+
+    int retval = 1;
+    for(int i = 0; i < self->num_ops; i++){
+        const dlgr_io_op_t* op = &self->ops[i];
+        dlgr_var_t* var = op->var;
+        const int result = self->results[i];
+        if(result == (int) op->len){
+            continue;
+        }
+        // Go back to the first record of the write for the next write to overwrite; a cancelled one followed a failure already reported.
+        if(result != -ECANCELED){
+            eprintf("Write failed: Failed to write to segment %d of %s: %s.", var->var_index, var->var_name, result < 0 ? strerror(-result) : "short write");
+            DLGR_COUNT(var, errors[DLGR_ERROR_WRITE], 1);
+        }
+        if((op->record * var->var_size) < var->seg_fill){
+            var->seg_fill = op->record * var->var_size;
+        }
+        retval = -1;
+    }
+
+    self->num_ops = 0;
+    self->arena_used = 0;
+    return retval;
+}
+
+// Syncs the files set aside by dlgr_io_sync(), all in flight at once, and closes them. Needs no lock.
+static int dlgr_io_flush_syncs(dlgr_io_thread_t* self){
+    if(self->num_syncs == 0){
+        return 1;
+    }
+
+    const long long start_ns = dlgr_io_now_ns();
+    int done = 0;
+    if(self->ring.fd >= 0){
+        for(; done < self->num_syncs; done++){
+            struct io_uring_sqe* sqe = dlgr_uring_get_sqe(&self->ring);
+            if(sqe == NULL){
+                break;
+            }
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fd = self->syncs[done].fd;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        }
+        if(dlgr_uring_run(&self->ring, self->results) < 0){
+            eprintf("io_uring failed, syncing without it.");
+            dlgr_io_reset(self);
+            done = 0;
+        }
+    }
+    // Without a ring, and for whatever did not fit in it.
+    for(int i = done; i < self->num_syncs; i++){
+        self->results[i] = fdatasync(self->syncs[i].fd) != 0 ? -errno : 0;
+    }
+    const unsigned long long sync_ns = dlgr_io_now_ns() - start_ns;
+
+    int retval = 1;
+    int failed = 0;
+    for(int i = 0; i < self->num_syncs; i++){
+        const dlgr_io_sync_t* sync = &self->syncs[i];
+        close(sync->fd);
+        failed |= self->results[i] < 0;
+        if(!sync->counted){
+            continue;
+        }
+        if(failed){
+            eprintf("Could not sync log segment %d of %s.", sync->var_index, sync->var->var_name);
+            DLGR_COUNT(sync->var, errors[DLGR_ERROR_SYNC], 1);
+            retval = -1;
+        } else {
+            dlgr_io_count_sync(sync->var, sync_ns);
+        }
+        failed = 0;
+    }
+
+    self->num_syncs = 0;
+    return retval;
+}
+
+int dlgr_io_flush(void){
+    dlgr_io_thread_t* self = dlgr_io_self;
+    if(self == NULL){
+        return 1;
+    }
+
+    // Syncs follow the writes they cover.
+    const int retval = dlgr_io_flush_writes(self);
+    return dlgr_io_flush_syncs(self) < 0 ? -1 : retval;
+}
+
+int dlgr_io_batch_end(void){
+    dlgr_io_thread_t* self = dlgr_io_self;
+    if((self == NULL) || !self->batching){
+        return 1;
+    }
+
+    const int retval = dlgr_io_flush_writes(self);
+    self->batching = 0;
+    return retval;
+}
+
+int dlgr_io_batch_sync(void){
+    dlgr_io_thread_t* self = dlgr_io_self;
+    if(self == NULL){
+        return 1;
+    }
+
+    return dlgr_io_flush_syncs(self);
+}
+
+// Queues an operation of var, linked after the previous one if that was of var too. NULL if there is no ring, or if the
+// batch had to be submitted and took var back, so the caller's offsets are stale.
+static struct io_uring_sqe* dlgr_io_queue(dlgr_io_thread_t* self, dlgr_var_t* var, size_t bytes){
+    if(((self->arena_used + bytes) > DLGR_IO_ARENA_SIZE) || (self->num_ops == DLGR_IO_QUEUE_DEPTH)){
+        const int seg_fill = var->seg_fill;
+        dlgr_io_flush();
+        if((var->seg_fill != seg_fill) || (self->ring.fd < 0)){
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe* sqe = dlgr_uring_get_sqe(&self->ring);
+    if(sqe == NULL){
+        return NULL;
+    }
+    if((self->num_ops > 0) && (self->ops[self->num_ops - 1].var == var)){
+        self->ring.sqes[(self->ring.tail - 2) & self->ring.mask].flags |= IOSQE_IO_LINK;
+    }
+    return sqe;
+}
+
+ssize_t dlgr_io_pwrite(dlgr_var_t* var, int record, int fd, const void* buf, size_t bytes, off_t offset){
+    dlgr_io_thread_t* self = dlgr_io_self;
+    if((self == NULL) || !self->batching || (self->ring.fd < 0)){
+        return pwrite(fd, buf, bytes, offset);
+    }
+
+    // Too big to copy; made in order after the batch.
+    if(bytes > DLGR_IO_ARENA_SIZE){
+        const int seg_fill = var->seg_fill;
+        dlgr_io_flush();
+        return var->seg_fill == seg_fill ? pwrite(fd, buf, bytes, offset) : -1;
+    }
+
+    struct io_uring_sqe* sqe = dlgr_io_queue(self, var, bytes);
+    if(sqe == NULL){
+        return -1;
+    }
+
+    // Copied, so the caller may reuse buf right away.
+    unsigned char* copy = &self->arena[self->arena_used];
+    memcpy(copy, buf, bytes);
+    self->arena_used += bytes;
+
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) copy;
+    sqe->len = bytes;
+    sqe->off = offset;
+    self->ops[self->num_ops++] = (dlgr_io_op_t){var, record, bytes};
+
+    return bytes;
+}
+
+int dlgr_io_sync(dlgr_var_t* var){
+    // seg_fd is the first column.
+    int fds[3];
+    int num_fds = 0;
+    fds[num_fds++] = var->seg_fd;
+    if(var->ts_fd >= 0){
+        fds[num_fds++] = var->ts_fd;
+    }
+    if(var->tsi_fd >= 0){
+        fds[num_fds++] = var->tsi_fd;
+    }
+    const int num_columns = var->column_fds != NULL ? var->num_members - 1 : 0;
+
+    dlgr_io_thread_t* self = dlgr_io_self;
+    if((self == NULL) || !self->batching || (self->ring.fd < 0)){
+        const long long start_ns = dlgr_io_now_ns();
+        int failed = 0;
+        for(int i = 0; i < num_columns; i++){
+            failed |= fdatasync(var->column_fds[i + 1]) != 0;
+        }
+        for(int i = 0; i < num_fds; i++){
+            failed |= fdatasync(fds[i]) != 0;
+        }
+        if(failed){
+            return -1;
+        }
+        dlgr_io_count_sync(var, dlgr_io_now_ns() - start_ns);
+        return 1;
+    }
+
+    // Counted once the last of them is synced, see dlgr_io_flush_syncs().
+    if((self->num_syncs + num_columns + num_fds) > DLGR_IO_QUEUE_DEPTH){
+        dlgr_io_flush();
+    }
+    const int first = self->num_syncs;
+    for(int i = 0; i < (num_columns + num_fds); i++){
+        const int fd = fcntl(i < num_columns ? var->column_fds[i + 1] : fds[i - num_columns], F_DUPFD_CLOEXEC, 0);
+        if(fd < 0){
+            for(; self->num_syncs > first; self->num_syncs--){
+                close(self->syncs[self->num_syncs - 1].fd);
+            }
+            return -1;
+        }
+        self->syncs[self->num_syncs++] = (dlgr_io_sync_t){var, var->var_index, fd, i == (num_columns + num_fds - 1)};
+    }
+
+    return 0;
+}
+
+ssize_t dlgr_pread_full(int fd, void* buf, size_t bytes, off_t offset){
+    unsigned char* buf_ptr = (unsigned char*) buf;
+    size_t number_read = 0;
+    while(number_read < bytes){
+        ssize_t retval = pread(fd, &buf_ptr[number_read], bytes - number_read, offset + number_read);
+        if(retval < 0){
+            return -1;
+        }
+        if(retval == 0){
+            break;
+        }
+        number_read += retval;
+    }
+    return number_read;
+}
+
+int dlgr_io_read(dlgr_io_read_t* reads, int num_reads){
+    dlgr_io_thread_t* self = NULL;
+    if((num_reads > 1) && (atomic_load_explicit(&dlgr_io_backend, memory_order_relaxed) == DLGR_IO_URING)){
+        self = dlgr_io_thread();
+    }
+
+    // Reads batched on this thread would otherwise be submitted with them.
+    if((self != NULL) && (self->num_ops > 0)){
+        dlgr_io_flush();
+    }
+
+    int done = 0;
+    while((self != NULL) && (self->ring.fd >= 0) && (done < num_reads)){
+        const int first = done;
+        for(; (done < num_reads) && ((done - first) < DLGR_IO_QUEUE_DEPTH); done++){
+            struct io_uring_sqe* sqe = dlgr_uring_get_sqe(&self->ring);
+            if(sqe == NULL){
+                break;
+            }
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = reads[done].fd;
+            sqe->addr = (unsigned long) reads[done].buf;
+            sqe->len = reads[done].bytes;
+            sqe->off = reads[done].offset;
+        }
+        if(dlgr_uring_run(&self->ring, self->results) < 0){
+            eprintf("io_uring failed, reading without it.");
+            dlgr_io_reset(self);
+            done = first;
+            break;
+        }
+        for(int i = first; i < done; i++){
+            reads[i].result = self->results[i - first];
+        }
+    }
+
+    // Without io_uring, and to finish reads that came up short.
+    int retval = 1;
+    for(int i = 0; i < num_reads; i++){
+        if(i >= done){
+            reads[i].result = dlgr_pread_full(reads[i].fd, reads[i].buf, reads[i].bytes, reads[i].offset);
+        } else if((reads[i].result > 0) && ((size_t) reads[i].result < reads[i].bytes)){
+            const ssize_t rest = dlgr_pread_full(reads[i].fd, (unsigned char*) reads[i].buf + reads[i].result, reads[i].bytes - reads[i].result, reads[i].offset + reads[i].result);
+            reads[i].result = rest < 0 ? -1 : reads[i].result + rest;
+        }
+        if(reads[i].result != (ssize_t) reads[i].bytes){
+            retval = -1;
+        }
+    }
+
+    return retval;
+}
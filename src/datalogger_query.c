@@ -0,0 +1,526 @@
+/**
+ * @file datalogger_query.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Aggregation and downsampling queries over typed variables.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DLGR_QUERY_X86
+#endif
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Queries run over a view, so the kernels read the mapped segments in place. A kernel aggregates a run of elements
+// and merges the result into an accumulator; runs never cross a segment.
+
+// Timestamps read at a time while placing the window boundaries of dlgr_downsample_time().
+#define DLGR_DOWNSAMPLE_CHUNK 4096
+
+typedef void (*dlgr_kernel_t)(const void* data, size_t n, dlgr_aggregate_t* acc);
+
+int dlgr_type_size(dlgr_type_t type){
+    switch(type){
+        case DLGR_TYPE_NONE:
+            return 0;
+        case DLGR_TYPE_I8:
+        case DLGR_TYPE_U8:
+            return 1;
+        case DLGR_TYPE_I16:
+        case DLGR_TYPE_U16:
+            return 2;
+        case DLGR_TYPE_I32:
+        case DLGR_TYPE_U32:
+        case DLGR_TYPE_F32:
+            return 4;
+        case DLGR_TYPE_I64:
+        case DLGR_TYPE_U64:
+        case DLGR_TYPE_F64:
+            return 8;
+        default:
+            return -1;
+    }
+}
+
+static void dlgr_aggregate_merge(dlgr_aggregate_t* acc, size_t n, double min, double max, double sum){
+    if(n == 0){
+        return;
+    }
+    if(acc->count == 0){
+        acc->min = min;
+        acc->max = max;
+    } else {
+        acc->min = min < acc->min ? min : acc->min;
+        acc->max = max > acc->max ? max : acc->max;
+    }
+    acc->count += n;
+    acc->sum += sum;
+}
+
+// Portable kernels, one per type. Integers are summed exactly, in 64 bits or in 128 for the 64-bit types.
+#define DLGR_SCALAR_KERNEL(name, ctype, sumtype)                        \
+static void name(const void* data, size_t n, dlgr_aggregate_t* acc){    \
+    const ctype* values = (const ctype*) data;                          \
+    if(n == 0){                                                         \
+        return;                                                         \
+    }                                                                   \
+    ctype min = values[0], max = values[0];                             \
+    sumtype sum = 0;                                                    \
+    for(size_t i = 0; i < n; i++){                                      \
+        min = values[i] < min ? values[i] : min;                        \
+        max = values[i] > max ? values[i] : max;                        \
+        sum += values[i];                                               \
+    }                                                                   \
+    dlgr_aggregate_merge(acc, n, (double) min, (double) max, (double) sum); \
+}
+
+DLGR_SCALAR_KERNEL(dlgr_kernel_i8, int8_t, int64_t)
+DLGR_SCALAR_KERNEL(dlgr_kernel_i16, int16_t, int64_t)
+DLGR_SCALAR_KERNEL(dlgr_kernel_i32, int32_t, int64_t)
+DLGR_SCALAR_KERNEL(dlgr_kernel_i64, int64_t, __int128)
+DLGR_SCALAR_KERNEL(dlgr_kernel_u8, uint8_t, uint64_t)
+DLGR_SCALAR_KERNEL(dlgr_kernel_u16, uint16_t, uint64_t)
+DLGR_SCALAR_KERNEL(dlgr_kernel_u32, uint32_t, uint64_t)
+DLGR_SCALAR_KERNEL(dlgr_kernel_u64, uint64_t, unsigned __int128)
+DLGR_SCALAR_KERNEL(dlgr_kernel_f32, float, double)
+DLGR_SCALAR_KERNEL(dlgr_kernel_f64, double, double)
+
+#ifdef DLGR_QUERY_X86
+// Vector kernels for the types telemetry is mostly made of. Loads are unaligned: a span starts on a page, but the
+// first record of a query may not. Float sums are widened to double, int sums to 64 bits, as in the portable kernels.
+
+__attribute__((target("sse2")))
+static void dlgr_kernel_f32_sse2(const void* data, size_t n, dlgr_aggregate_t* acc){
+    const float* values = (const float*) data;
+    if(n < 4){
+        dlgr_kernel_f32(data, n, acc);
+        return;
+    }
+    __m128 vmin = _mm_loadu_ps(values), vmax = vmin;
+    __m128d vsum = _mm_setzero_pd();
+    size_t i = 0;
+    for(; (i + 4) <= n; i += 4){
+        const __m128 v = _mm_loadu_ps(&values[i]);
+        vmin = _mm_min_ps(vmin, v);
+        vmax = _mm_max_ps(vmax, v);
+        vsum = _mm_add_pd(vsum, _mm_cvtps_pd(v));
+        vsum = _mm_add_pd(vsum, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+    float mins[4], maxs[4];
+    double sums[2];
+    _mm_storeu_ps(mins, vmin);
+    _mm_storeu_ps(maxs, vmax);
+    _mm_storeu_pd(sums, vsum);
+    for(int lane = 1; lane < 4; lane++){
+        mins[0] = mins[lane] < mins[0] ? mins[lane] : mins[0];
+        maxs[0] = maxs[lane] > maxs[0] ? maxs[lane] : maxs[0];
+    }
+    dlgr_aggregate_merge(acc, i, mins[0], maxs[0], sums[0] + sums[1]);
+    dlgr_kernel_f32(&values[i], n - i, acc);
+}
+
+__attribute__((target("sse2")))
+static void dlgr_kernel_f64_sse2(const void* data, size_t n, dlgr_aggregate_t* acc){
+    const double* values = (const double*) data;
+    if(n < 2){
+        dlgr_kernel_f64(data, n, acc);
+        return;
+    }
+    __m128d vmin = _mm_loadu_pd(values), vmax = vmin;
+    __m128d vsum = _mm_setzero_pd();
+    size_t i = 0;
+    for(; (i + 2) <= n; i += 2){
+        const __m128d v = _mm_loadu_pd(&values[i]);
+        vmin = _mm_min_pd(vmin, v);
+        vmax = _mm_max_pd(vmax, v);
+        vsum = _mm_add_pd(vsum, v);
+    }
+    double mins[2], maxs[2], sums[2];
+    _mm_storeu_pd(mins, vmin);
+    _mm_storeu_pd(maxs, vmax);
+    _mm_storeu_pd(sums, vsum);
+    dlgr_aggregate_merge(acc, i, mins[1] < mins[0] ? mins[1] : mins[0], maxs[1] > maxs[0] ? maxs[1] : maxs[0], sums[0] + sums[1]);
+    dlgr_kernel_f64(&values[i], n - i, acc);
+}
+
+__attribute__((target("avx2")))
+static void dlgr_kernel_f32_avx2(const void* data, size_t n, dlgr_aggregate_t* acc){
+    const float* values = (const float*) data;
+    if(n < 8){
+        dlgr_kernel_f32(data, n, acc);
+        return;
+    }
+    __m256 vmin = _mm256_loadu_ps(values), vmax = vmin;
+    __m256d vsum = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; (i + 8) <= n; i += 8){
+        const __m256 v = _mm256_loadu_ps(&values[i]);
+        vmin = _mm256_min_ps(vmin, v);
+        vmax = _mm256_max_ps(vmax, v);
+        vsum = _mm256_add_pd(vsum, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+        vsum = _mm256_add_pd(vsum, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+    }
+    float mins[8], maxs[8];
+    double sums[4];
+    _mm256_storeu_ps(mins, vmin);
+    _mm256_storeu_ps(maxs, vmax);
+    _mm256_storeu_pd(sums, vsum);
+    for(int lane = 1; lane < 8; lane++){
+        mins[0] = mins[lane] < mins[0] ? mins[lane] : mins[0];
+        maxs[0] = maxs[lane] > maxs[0] ? maxs[lane] : maxs[0];
+    }
+    dlgr_aggregate_merge(acc, i, mins[0], maxs[0], (sums[0] + sums[1]) + (sums[2] + sums[3]));
+    dlgr_kernel_f32(&values[i], n - i, acc);
+}
+
+__attribute__((target("avx2")))
+static void dlgr_kernel_f64_avx2(const void* data, size_t n, dlgr_aggregate_t* acc){
+    const double* values = (const double*) data;
+    if(n < 4){
+        dlgr_kernel_f64(data, n, acc);
+        return;
+    }
+    __m256d vmin = _mm256_loadu_pd(values), vmax = vmin;
+    __m256d vsum = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; (i + 4) <= n; i += 4){
+        const __m256d v = _mm256_loadu_pd(&values[i]);
+        vmin = _mm256_min_pd(vmin, v);
+        vmax = _mm256_max_pd(vmax, v);
+        vsum = _mm256_add_pd(vsum, v);
+    }
+    double mins[4], maxs[4], sums[4];
+    _mm256_storeu_pd(mins, vmin);
+    _mm256_storeu_pd(maxs, vmax);
+    _mm256_storeu_pd(sums, vsum);
+    for(int lane = 1; lane < 4; lane++){
+        mins[0] = mins[lane] < mins[0] ? mins[lane] : mins[0];
+        maxs[0] = maxs[lane] > maxs[0] ? maxs[lane] : maxs[0];
+    }
+    dlgr_aggregate_merge(acc, i, mins[0], maxs[0], (sums[0] + sums[1]) + (sums[2] + sums[3]));
+    dlgr_kernel_f64(&values[i], n - i, acc);
+}
+
+__attribute__((target("avx2")))
+static void dlgr_kernel_i32_avx2(const void* data, size_t n, dlgr_aggregate_t* acc){
+    const int32_t* values = (const int32_t*) data;
+    if(n < 8){
+        dlgr_kernel_i32(data, n, acc);
+        return;
+    }
+    __m256i vmin = _mm256_loadu_si256((const __m256i*) values), vmax = vmin;
+    __m256i vsum = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; (i + 8) <= n; i += 8){
+        const __m256i v = _mm256_loadu_si256((const __m256i*) &values[i]);
+        vmin = _mm256_min_epi32(vmin, v);
+        vmax = _mm256_max_epi32(vmax, v);
+        vsum = _mm256_add_epi64(vsum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        vsum = _mm256_add_epi64(vsum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    int32_t mins[8], maxs[8];
+    int64_t sums[4];
+    _mm256_storeu_si256((__m256i*) mins, vmin);
+    _mm256_storeu_si256((__m256i*) maxs, vmax);
+    _mm256_storeu_si256((__m256i*) sums, vsum);
+    for(int lane = 1; lane < 8; lane++){
+        mins[0] = mins[lane] < mins[0] ? mins[lane] : mins[0];
+        maxs[0] = maxs[lane] > maxs[0] ? maxs[lane] : maxs[0];
+    }
+    dlgr_aggregate_merge(acc, i, mins[0], maxs[0], (double) (sums[0] + sums[1] + sums[2] + sums[3]));
+    dlgr_kernel_i32(&values[i], n - i, acc);
+}
+#endif // DLGR_QUERY_X86
+
+// Picks the fastest kernel the CPU supports for a type.
+static dlgr_kernel_t dlgr_kernel_for(dlgr_type_t type){
+#ifdef DLGR_QUERY_X86
+    const int avx2 = __builtin_cpu_supports("avx2");
+    const int sse2 = __builtin_cpu_supports("sse2");
+#endif
+    switch(type){
+        case DLGR_TYPE_I8:
+            return dlgr_kernel_i8;
+        case DLGR_TYPE_I16:
+            return dlgr_kernel_i16;
+        case DLGR_TYPE_I32:
+#ifdef DLGR_QUERY_X86
+            if(avx2){
+                return dlgr_kernel_i32_avx2;
+            }
+#endif
+            return dlgr_kernel_i32;
+        case DLGR_TYPE_I64:
+            return dlgr_kernel_i64;
+        case DLGR_TYPE_U8:
+            return dlgr_kernel_u8;
+        case DLGR_TYPE_U16:
+            return dlgr_kernel_u16;
+        case DLGR_TYPE_U32:
+            return dlgr_kernel_u32;
+        case DLGR_TYPE_U64:
+            return dlgr_kernel_u64;
+        case DLGR_TYPE_F32:
+#ifdef DLGR_QUERY_X86
+            if(avx2){
+                return dlgr_kernel_f32_avx2;
+            }
+            if(sse2){
+                return dlgr_kernel_f32_sse2;
+            }
+#endif
+            return dlgr_kernel_f32;
+        case DLGR_TYPE_F64:
+#ifdef DLGR_QUERY_X86
+            if(avx2){
+                return dlgr_kernel_f64_avx2;
+            }
+            if(sse2){
+                return dlgr_kernel_f64_sse2;
+            }
+#endif
+            return dlgr_kernel_f64;
+        default:
+            return NULL;
+    }
+}
+
+// Gets the kernel and elements per record of a typed variable. Negative if it is not typed.
+static int dlgr_query_prepare(int handle, dlgr_kernel_t* kernel, int* elements){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    pthread_mutex_lock(&var->lock);
+    const dlgr_type_t type = var->type;
+    const int var_size = var->var_size;
+    pthread_mutex_unlock(&var->lock);
+
+    if((*kernel = dlgr_kernel_for(type)) == NULL){
+        eprintf("%s has no type to aggregate.", var->var_name);
+        return -1;
+    }
+    *elements = var_size / dlgr_type_size(type);
+
+    return 1;
+}
+
+static void dlgr_aggregate_finish(dlgr_aggregate_t* result){
+    result->mean = result->count > 0 ? result->sum / result->count : 0;
+}
+
+// Aggregates records start to end - 1 of a view. Spans before *span are skipped, and *span is left at the first span
+// that may hold records after end, so consecutive windows walk the view once.
+static void dlgr_aggregate_view(const dlgr_view_t* view, int* span, dlgr_kernel_t kernel, int elements, long long start, long long end, dlgr_aggregate_t* result){
+    memset(result, 0x0, sizeof(dlgr_aggregate_t));
+    for(int i = *span; i < view->num_spans; i++){
+        const dlgr_span_t* s = &view->spans[i];
+        const long long span_end = s->first_seq + s->count;
+        if(span_end <= start){
+            *span = i + 1;
+            continue;
+        }
+        if(s->first_seq >= end){
+            break;
+        }
+
+        const long long from = start > s->first_seq ? start : s->first_seq;
+        const long long to = end < span_end ? end : span_end;
+        const unsigned char* data = (const unsigned char*) s->data;
+        kernel(&data[(size_t) (from - s->first_seq) * view->var_size], (size_t) (to - from) * elements, result);
+
+        if(span_end > end){
+            break;
+        }
+        *span = i + 1;
+    }
+    dlgr_aggregate_finish(result);
+}
+
+int dlgr_aggregate(int handle, long long first_seq, long long count, dlgr_aggregate_t* result){
+    if(result == NULL){
+        eprintf("Result is NULL.");
+        return -1;
+    }
+
+    if((first_seq < 0) || (count < 0)){
+        eprintf("Range %lld + %lld is invalid.", first_seq, count);
+        return -1;
+    }
+
+    dlgr_kernel_t kernel;
+    int elements;
+    if(dlgr_query_prepare(handle, &kernel, &elements) < 0){
+        return -1;
+    }
+
+    dlgr_view_t view;
+    if(dlgr_view_open_range(handle, first_seq, count, &view) < 0){
+        return -1;
+    }
+
+    int span = 0;
+    dlgr_aggregate_view(&view, &span, kernel, elements, first_seq, first_seq + count, result);
+
+    dlgr_view_close(&view);
+    return 1;
+}
+
+int dlgr_aggregate_time(int handle, long long t0, long long t1, dlgr_aggregate_t* result){
+    if(result == NULL){
+        eprintf("Result is NULL.");
+        return -1;
+    }
+
+    if(t1 < t0){
+        memset(result, 0x0, sizeof(dlgr_aggregate_t));
+        return 1;
+    }
+
+    long long first_seq, end_seq;
+    if((dlgr_time_to_seq(handle, t0, 0, &first_seq) < 0) || (dlgr_time_to_seq(handle, t1, 1, &end_seq) < 0)){
+        return -1;
+    }
+
+    return dlgr_aggregate(handle, first_seq, end_seq > first_seq ? end_seq - first_seq : 0, result);
+}
+
+int dlgr_downsample(int handle, long long first_seq, long long count, long long window, dlgr_aggregate_t* buckets, int max_buckets){
+    if(buckets == NULL){
+        eprintf("Buckets are NULL.");
+        return -1;
+    }
+
+    if((first_seq < 0) || (count < 0) || (window <= 0) || (max_buckets <= 0)){
+        eprintf("Range %lld + %lld, window %lld, or %d buckets is invalid.", first_seq, count, window, max_buckets);
+        return -1;
+    }
+
+    dlgr_kernel_t kernel;
+    int elements;
+    if(dlgr_query_prepare(handle, &kernel, &elements) < 0){
+        return -1;
+    }
+
+    dlgr_view_t view;
+    if(dlgr_view_open_range(handle, first_seq, count, &view) < 0){
+        return -1;
+    }
+
+    // Windows start at the first record still retained, and end at the last written.
+    long long start = first_seq;
+    long long end = first_seq + count;
+    if(view.num_spans > 0){
+        const dlgr_span_t* last = &view.spans[view.num_spans - 1];
+        start = view.spans[0].first_seq > start ? view.spans[0].first_seq : start;
+        end = (last->first_seq + last->count) < end ? (last->first_seq + last->count) : end;
+    } else {
+        end = start;
+    }
+
+    int number_buckets = 0;
+    int span = 0;
+    for(long long from = start; (from < end) && (number_buckets < max_buckets); from += window){
+        const long long to = (end - from) > window ? from + window : end;
+        dlgr_aggregate_view(&view, &span, kernel, elements, from, to, &buckets[number_buckets]);
+        number_buckets++;
+    }
+
+    dlgr_view_close(&view);
+    return number_buckets;
+}
+
+int dlgr_downsample_time(int handle, long long t0, long long t1, long long window, dlgr_aggregate_t* buckets, int max_buckets){
+    if(buckets == NULL){
+        eprintf("Buckets are NULL.");
+        return -1;
+    }
+
+    if((window <= 0) || (max_buckets <= 0)){
+        eprintf("Window %lld or %d buckets is invalid.", window, max_buckets);
+        return -1;
+    }
+
+    if(t1 < t0){
+        return 0;
+    }
+
+    dlgr_kernel_t kernel;
+    int elements;
+    if(dlgr_query_prepare(handle, &kernel, &elements) < 0){
+        return -1;
+    }
+
+    int number_buckets = max_buckets;
+    if(((t1 - t0) / window) < (max_buckets - 1)){
+        number_buckets = ((t1 - t0) / window) + 1;
+    }
+
+    // Window boundaries as sequence numbers: bounds[k] is the first record stamped at or after t0 + k * window. The
+    // ends of the range are searched for, the boundaries between them found in one pass over its timestamps.
+    long long* bounds = malloc((number_buckets + 1) * sizeof(long long));
+    long long* timestamps = malloc(DLGR_DOWNSAMPLE_CHUNK * sizeof(long long));
+    if((bounds == NULL) || (timestamps == NULL)){
+        eprintf("Could not allocate %d window bounds.", number_buckets);
+        free(bounds);
+        free(timestamps);
+        return -1;
+    }
+    const long long t_end = ((t1 - t0) / window) < number_buckets ? t1 : t0 + (number_buckets * window) - 1;
+    if((dlgr_time_to_seq(handle, t0, 0, &bounds[0]) < 0) || (dlgr_time_to_seq(handle, t_end, 1, &bounds[number_buckets]) < 0)){
+        free(bounds);
+        free(timestamps);
+        return -1;
+    }
+
+    const long long end = bounds[number_buckets] > bounds[0] ? bounds[number_buckets] : bounds[0];
+    int k = 1;
+    for(long long seq = bounds[0]; (seq < end) && (k < number_buckets); ){
+        const int chunk = (end - seq) < DLGR_DOWNSAMPLE_CHUNK ? (int) (end - seq) : DLGR_DOWNSAMPLE_CHUNK;
+        if(dlgr_read_timestamps(handle, seq, chunk, timestamps) != chunk){
+            free(bounds);
+            free(timestamps);
+            return -1;
+        }
+        for(int i = 0; i < chunk; i++){
+            while((k < number_buckets) && (timestamps[i] >= (t0 + (k * window)))){
+                bounds[k++] = seq + i;
+            }
+        }
+        seq += chunk;
+    }
+    for(; k < number_buckets; k++){
+        bounds[k] = end;
+    }
+    free(timestamps);
+
+    dlgr_view_t view;
+    if(dlgr_view_open_range(handle, bounds[0], end - bounds[0], &view) < 0){
+        free(bounds);
+        return -1;
+    }
+
+    int span = 0;
+    for(k = 0; k < number_buckets; k++){
+        const long long to = bounds[k + 1] > bounds[k] ? bounds[k + 1] : bounds[k];
+        dlgr_aggregate_view(&view, &span, kernel, elements, bounds[k], to, &buckets[k]);
+    }
+
+    dlgr_view_close(&view);
+    free(bounds);
+    return number_buckets;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file datalogger_stats.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Per-variable instrumentation counters and counted diagnostics.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Counters are relaxed atomics, bumped where the work is done, so neither writers nor readers take a lock for them.
+// A snapshot of them is consistent per counter, not across counters.
+
+static const char* dlgr_error_names[DLGR_ERROR_COUNT] = {"open", "write", "sync", "read", "compress", "manifest"};
+
+// Diagnostics counted with -DDLGR_COUNT_EVENTS, and where the latest came from.
+static atomic_ullong dlgr_events = 0;
+static _Atomic(const char*) dlgr_event_func = NULL;
+static atomic_int dlgr_event_line = 0;
+
+void dlgr_count_event(const char* func, int line){
+    atomic_fetch_add_explicit(&dlgr_events, 1, memory_order_relaxed);
+    atomic_store_explicit(&dlgr_event_func, func, memory_order_relaxed);
+    atomic_store_explicit(&dlgr_event_line, line, memory_order_relaxed);
+}
+
+int dlgr_stats(int handle, dlgr_stats_t* stats){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    if(stats == NULL){
+        eprintf("Stats is NULL.");
+        return -1;
+    }
+
+    const dlgr_counters_t* counters = &var->counters;
+    stats->records_written = atomic_load_explicit(&counters->records_written, memory_order_relaxed);
+    stats->bytes_written = atomic_load_explicit(&counters->bytes_written, memory_order_relaxed);
+    stats->rotations = atomic_load_explicit(&counters->rotations, memory_order_relaxed);
+    stats->retention_deletions = atomic_load_explicit(&counters->retention_deletions, memory_order_relaxed);
+    stats->syncs = atomic_load_explicit(&counters->syncs, memory_order_relaxed);
+    stats->sync_ns = atomic_load_explicit(&counters->sync_ns, memory_order_relaxed);
+    stats->sync_max_ns = atomic_load_explicit(&counters->sync_max_ns, memory_order_relaxed);
+    stats->reads = atomic_load_explicit(&counters->reads, memory_order_relaxed);
+    stats->bytes_read = atomic_load_explicit(&counters->bytes_read, memory_order_relaxed);
+    for(int i = 0; i < DLGR_ERROR_COUNT; i++){
+        stats->errors[i] = atomic_load_explicit(&counters->errors[i], memory_order_relaxed);
+    }
+
+    return 1;
+}
+
+int dlgr_stats_dump(FILE* stream){
+    if(stream == NULL){
+        eprintf("Stream is NULL.");
+        return -1;
+    }
+
+    // Handles are handed out in order and never reused, so the registry ends at the first empty one.
+    int number_dumped = 0;
+    for(int handle = 0; dlgr_get_var(handle) != NULL; handle++){
+        dlgr_stats_t stats;
+        dlgr_stats(handle, &stats);
+
+        fprintf(stream, "%s records=%llu bytes=%llu rotations=%llu deletions=%llu syncs=%llu sync_ns=%llu sync_max_ns=%llu reads=%llu bytes_read=%llu",
+                dlgr_get_var(handle)->var_name, stats.records_written, stats.bytes_written, stats.rotations, stats.retention_deletions,
+                stats.syncs, stats.sync_ns, stats.sync_max_ns, stats.reads, stats.bytes_read);
+        for(int i = 0; i < DLGR_ERROR_COUNT; i++){
+            fprintf(stream, " %s_errors=%llu", dlgr_error_names[i], stats.errors[i]);
+        }
+        fprintf(stream, "\n");
+        number_dumped++;
+    }
+
+    const unsigned long long events = atomic_load(&dlgr_events);
+    const char* func = atomic_load(&dlgr_event_func);
+    if(func != NULL){
+        fprintf(stream, "events=%llu last=%s:%d\n", events, func, atomic_load(&dlgr_event_line));
+    } else {
+        fprintf(stream, "events=%llu\n", events);
+    }
+    fflush(stream);
+
+    return number_dumped;
+}
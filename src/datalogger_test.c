@@ -12,13 +12,62 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "datalogger.h"
 #include "datalogger_extern.h"
 
+typedef struct
+{
+    char mode;
+    double rate;
+    int count;
+} testmod_state_t;
+
 int main(){
     printf("Datalogger test start.\n");
     fflush(stdout);
 
+    // Log to a scratch directory of our own, so every run starts from nothing and the working directory is left alone.
+    char scratch_dir[] = "/tmp/datalogger_test_XXXXXX";
+    char settings_path[sizeof(scratch_dir) + 0x10], hot_path[sizeof(scratch_dir) + 0x10];
+    if(mkdtemp(scratch_dir) == NULL){
+        eprintf("Could not create a scratch directory.");
+        return -1;
+    }
+    printf("Logging to %s.\n", scratch_dir);
+
+    // Small segments, so the test exercises rotation and retention.
+    snprintf(settings_path, sizeof(settings_path), "%s/settings.cfg", scratch_dir);
+    FILE* settings_f = fopen(settings_path, "w");
+    if(settings_f == NULL){
+        return -1;
+    }
+    fprintf(settings_f, "# name segment_size max_bytes [max_segments [max_age_ms]]\n* 0x10 0x40\ntestmod_packed 0x40 0x100\ntestmod_state 0x60 0x200\n");
+    fclose(settings_f);
+    if(dlgr_load_settings(settings_path) < 0){
+        return -1;
+    }
+    unlink(settings_path);
+
+    // Nothing has been registered there yet.
+    const int number_loaded = dlgr_open(scratch_dir);
+    if(number_loaded != 0){
+        eprintf("Loaded %d variables from a new log directory.", number_loaded);
+        return -1;
+    }
+
+    // Write current segments to a hot directory, as a tmpfs would be, and keep closed ones in the log directory.
+    snprintf(hot_path, sizeof(hot_path), "%s/hot", scratch_dir);
+    mkdir(hot_path, 0755);
+    if(dlgr_set_hot_dir(hot_path) < 0){
+        return -1;
+    }
+
+    // Batch the writer thread's passes, and reads across segments, through io_uring where the kernel has it.
+    printf("Logging through %s.\n", dlgr_set_io_backend(DLGR_IO_URING) == DLGR_IO_URING ? "io_uring" : "POSIX calls");
+
     int testmod_testvar = 0;
 
     printf("Registering testmod_testvar: %d\n", testmod_testvar);
@@ -27,6 +76,16 @@ int main(){
         return -1;
     }
 
+    if(DLGR_SET_DURABILITY(testmod_testvar, DLGR_SYNC_GROUP, 16, 100) < 0){
+        return -1;
+    }
+
+    printf("Starting asynchronous logging.\n");
+    fflush(stdout);
+    if(DLGR_ASYNC_START(64, 64, DLGR_OVERFLOW_BLOCK) < 0){
+        return -1;
+    }
+
     printf("Writing testmod_testvar: %d\n", testmod_testvar);
     fflush(stdout);
     while(testmod_testvar < 128){
@@ -37,6 +96,47 @@ int main(){
         testmod_testvar++;
     }
 
+    if(DLGR_FLUSH(testmod_testvar) < 0){
+        return -1;
+    }
+
+    // Group durability syncs at least every 16 records.
+    dlgr_stats_t sync_stats;
+    DLGR_STATS(testmod_testvar, &sync_stats);
+    if((sync_stats.syncs < (128 / 16)) || (sync_stats.errors[DLGR_ERROR_SYNC] != 0)){
+        eprintf("testmod_testvar synced %llu times with %llu errors for 128 records.", sync_stats.syncs, sync_stats.errors[DLGR_ERROR_SYNC]);
+        return -1;
+    }
+
+    dlgr_async_stats_t async_stats;
+    dlgr_async_stats(&async_stats);
+    if((async_stats.enqueued != 128) || (async_stats.written != 128) || (async_stats.write_errors != 0)){
+        eprintf("Asynchronously wrote %llu of %llu records, with %llu errors, instead of all 128.", async_stats.written, async_stats.enqueued, async_stats.write_errors);
+        return -1;
+    }
+    printf("Asynchronously wrote %llu of %llu records.\n", async_stats.written, async_stats.enqueued);
+    DLGR_ASYNC_STOP();
+
+    int testmod_testarr[40];
+    for(int i = 0; i < 40; i++){
+        testmod_testarr[i] = i;
+    }
+
+    printf("Writing testmod_testarr in one batch.\n");
+    fflush(stdout);
+    if(DLGR_REGISTER(testmod_testarr, sizeof(testmod_testarr[0])) < 0){
+        return -1;
+    }
+    if(DLGR_WRITE_ARRAY(testmod_testarr, 40) < 0){
+        eprintf("Error!");
+        return -1;
+    }
+    long long testarr_written = 0;
+    if((dlgr_get_seq_range(DLGR_HANDLE(testmod_testarr), NULL, &testarr_written) < 0) || (testarr_written != 40)){
+        eprintf("Wrote %lld testmod_testarrs in one batch, not 40.", testarr_written);
+        return -1;
+    }
+
     printf("Priming read of some testmod_testvars.\n");
     fflush(stdout);
     int bytes = DLGR_PRIME_READ(testmod_testvar, 128);
@@ -46,7 +146,25 @@ int main(){
     printf("Reading some testmod_testvars.\n");
     fflush(stdout);
     if(DLGR_PERFORM_READ(read_data, bytes) < 0){
-        printf("dlgr read error\n");
+        eprintf("dlgr read error");
+        return -1;
+    }
+
+    // Newest first, as far back as retention kept them.
+    long long kept_first = 0, kept_next = 0;
+    dlgr_get_seq_range(DLGR_HANDLE(testmod_testvar), &kept_first, &kept_next);
+    // The default of 0x40 bytes from settings.cfg keeps the newest 16.
+    if((bytes != (128 * (int) sizeof(int))) || (kept_next != 128) || ((kept_next - kept_first) != (0x40 / (int) sizeof(int)))){
+        eprintf("Primed %d bytes of testmod_testvar, which holds records %lld to %lld.", bytes, kept_first, kept_next - 1);
+        return -1;
+    }
+    for(int i = 0; i < (kept_next - kept_first); i++){
+        int value;
+        memcpy(&value, &read_data[i * sizeof(int)], sizeof(int));
+        if(value != (127 - i)){
+            eprintf("Read testmod_testvar %d back as %d.", 127 - i, value);
+            return -1;
+        }
     }
 
     printf("Printing read data:\n");
@@ -64,7 +182,344 @@ int main(){
     printf("\n");
     fflush(stdout);
 
-    printf("Number of log files: %d.\n", DLGR_COUNT_LOGS(testmod_testvar));
+    // Segments of 4 records hold the ones retention kept.
+    const int number_logs = DLGR_COUNT_LOGS(testmod_testvar);
+    if(number_logs != (int) ((kept_next - kept_first + 3) / 4)){
+        eprintf("testmod_testvar has %d log files for records %lld to %lld.", number_logs, kept_first, kept_next - 1);
+        return -1;
+    }
+    printf("Number of log files: %d.\n", number_logs);
+
+    int latest[8];
+    int number_latest = DLGR_READ_LATEST(testmod_testarr, latest, 8);
+    if(number_latest != 8){
+        eprintf("Read %d latest testmod_testarrs, not 8.", number_latest);
+        return -1;
+    }
+    for(int i = 0; i < number_latest; i++){
+        if(latest[i] != (39 - i)){
+            eprintf("Latest testmod_testarr %d is %d, not %d.", i, latest[i], 39 - i);
+            return -1;
+        }
+    }
+    printf("Read %d latest testmod_testarrs:", number_latest);
+    for(int i = 0; i < number_latest; i++){
+        printf(" %d", latest[i]);
+    }
+    printf("\n");
+
+    DLGR_SHUTDOWN();
+
+    int testmod_timed = 0;
+    if(DLGR_REGISTER_OPTS(testmod_timed, sizeof(testmod_timed), .timestamped = 1) < 0){
+        return -1;
+    }
+    for(testmod_timed = 0; testmod_timed < 10; testmod_timed++){
+        DLGR_WRITE_TIMED(testmod_timed, 1000 + testmod_timed);
+    }
+    int timed[10];
+    int number_timed = DLGR_READ_TIME_RANGE(testmod_timed, 1007, 1008, timed, 10);
+    if((number_timed != 2) || (timed[0] != 7) || (timed[1] != 8)){
+        eprintf("Read %d testmod_timeds between t=1007 and t=1008 instead of 7 and 8.", number_timed);
+        return -1;
+    }
+    printf("Read %d testmod_timeds between t=1007 and t=1008: %d %d\n", number_timed, timed[0], timed[1]);
+
+    long long timed_first, timed_next, timed_stamps[2];
+    dlgr_get_seq_range(DLGR_HANDLE(testmod_timed), &timed_first, &timed_next);
+    int number_stamps = DLGR_READ_TIMESTAMPS(testmod_timed, timed_next - 2, timed_stamps, 2);
+    if((number_stamps != 2) || (timed_stamps[0] != 1008) || (timed_stamps[1] != 1009)){
+        eprintf("Read %d timestamps of the newest testmod_timeds instead of 1008 and 1009.", number_stamps);
+        return -1;
+    }
+    printf("Read %d timestamps of the newest testmod_timeds: %lld %lld\n", number_stamps, timed_stamps[0], timed_stamps[1]);
+
+    // A view maps every record retention kept, and testmod_testarr records hold their sequence numbers.
+    dlgr_view_t view;
+    long long testarr_first, testarr_next;
+    dlgr_get_seq_range(DLGR_HANDLE(testmod_testarr), &testarr_first, &testarr_next);
+    if(DLGR_VIEW_OPEN(testmod_testarr, &view) < 0){
+        return -1;
+    }
+    if((view.num_spans == 0) || (view.total_count != (testarr_next - testarr_first)) || (*(const int*) view.spans[0].data != testarr_first)){
+        eprintf("Viewing %lld testmod_testarrs in %d spans, instead of records %lld to %lld.", view.total_count, view.num_spans, testarr_first, testarr_next - 1);
+        dlgr_view_close(&view);
+        return -1;
+    }
+    printf("Viewing %lld testmod_testarrs in %d spans, oldest %d.\n", view.total_count, view.num_spans, *(const int*) view.spans[0].data);
+    dlgr_view_close(&view);
+
+    short testmod_x = 0;
+    double testmod_y = 0;
+    if(DLGR_REGISTER_FRAME(testmod_frame, DLGR_FRAME_MEMBER(testmod_x), DLGR_FRAME_MEMBER(testmod_y)) < 0){
+        return -1;
+    }
+    for(testmod_x = 0; testmod_x < 10; testmod_x++){
+        testmod_y = testmod_x * 0.5;
+        DLGR_WRITE_FRAME(testmod_frame, &testmod_x, &testmod_y);
+    }
+    double frame_y[3];
+    int number_frame = DLGR_READ_MEMBER(testmod_frame, testmod_y, frame_y, 3);
+    if((number_frame != 3) || (frame_y[0] != 4.5) || (frame_y[1] != 4.0) || (frame_y[2] != 3.5)){
+        eprintf("Read %d testmod_ys of testmod_frame instead of 4.5, 4.0 and 3.5.", number_frame);
+        return -1;
+    }
+    printf("Read %d testmod_ys of testmod_frame: %.1f %.1f %.1f\n", number_frame, frame_y[0], frame_y[1], frame_y[2]);
+
+    int testmod_packed = 0;
+    if(DLGR_REGISTER_OPTS(testmod_packed, sizeof(testmod_packed), .timestamped = 1, .codec = DLGR_CODEC_DELTA) < 0){
+        return -1;
+    }
+    for(testmod_packed = 0; testmod_packed < 40; testmod_packed++){
+        DLGR_WRITE_TIMED(testmod_packed, 2000 + testmod_packed);
+    }
+    int packed[4];
+    int number_packed = DLGR_READ_LATEST(testmod_packed, packed, 4);
+    int number_packed_range = DLGR_READ_TIME_RANGE(testmod_packed, 2020, 2029, timed, 10);
+    if(number_packed != 4){
+        eprintf("Read %d compressed testmod_packeds, not 4.", number_packed);
+        return -1;
+    }
+    if(number_packed_range != 10){
+        eprintf("Read %d compressed testmod_packeds between t=2020 and t=2029, not 10.", number_packed_range);
+        return -1;
+    }
+    for(int i = 0; i < 10; i++){
+        if(((i < 4) && (packed[i] != (39 - i))) || (timed[i] != (20 + i))){
+            eprintf("Compressed testmod_packed %d read back wrong.", i);
+            return -1;
+        }
+    }
+    printf("Read %d compressed testmod_packeds: %d %d %d %d, %d between t=2020 and t=2029 starting %d.\n", number_packed, packed[0], packed[1], packed[2], packed[3], number_packed_range, timed[0]);
+
+    const char* multi_names[] = {"testmod_timed", "testmod_packed"};
+    int multi_timed[3], multi_packed[3];
+    const int multi_counts[] = {3, 3};
+    void* const multi_storages[] = {multi_timed, multi_packed};
+    int number_multi[2];
+    if(dlgr_read_multi(multi_names, multi_counts, multi_storages, number_multi, 2) < 0){
+        return -1;
+    }
+    if((number_multi[0] != 3) || (number_multi[1] != 3)){
+        eprintf("Read %d testmod_timeds and %d testmod_packeds at once, not 3 of each.", number_multi[0], number_multi[1]);
+        return -1;
+    }
+    for(int i = 0; i < 3; i++){
+        if((multi_timed[i] != (9 - i)) || (multi_packed[i] != (39 - i))){
+            eprintf("Read testmod_timed %d and testmod_packed %d at once, not %d and %d.", multi_timed[i], multi_packed[i], 9 - i, 39 - i);
+            return -1;
+        }
+    }
+    printf("Read %d testmod_timeds and %d testmod_packeds at once: %d %d %d, %d %d %d\n", number_multi[0], number_multi[1], multi_timed[0], multi_timed[1], multi_timed[2], multi_packed[0], multi_packed[1], multi_packed[2]);
+
+    long long first_seq = 0, next_seq = 0;
+    int range[4];
+    dlgr_get_seq_range(DLGR_HANDLE(testmod_testvar), &first_seq, &next_seq);
+    int number_range = DLGR_READ_RANGE(testmod_testvar, first_seq + 2, range, 4);
+    if(number_range != 4){
+        eprintf("Read %d testmod_testvars from %lld, not 4.", number_range, first_seq + 2);
+        return -1;
+    }
+    for(int i = 0; i < 4; i++){
+        if(range[i] != (first_seq + 2 + i)){
+            eprintf("testmod_testvar record %lld is %d.", first_seq + 2 + i, range[i]);
+            return -1;
+        }
+    }
+    printf("testmod_testvar holds records %lld to %lld, read %d from %lld: %d %d %d %d\n", first_seq, next_seq - 1, number_range, first_seq + 2, range[0], range[1], range[2], range[3]);
+
+    // Replaying from 0 skips what retention removed, then returns every record in order.
+    dlgr_cursor_t cursor;
+    if(DLGR_CURSOR_OPEN(testmod_testvar, 0, &cursor) < 0){
+        return -1;
+    }
+    int replay[5], number_replayed = 0, number_chunk, last_replayed = -1;
+    while((number_chunk = dlgr_cursor_next(&cursor, replay, 5)) > 0){
+        for(int i = 0; i < number_chunk; i++){
+            if(replay[i] != (first_seq + number_replayed + i)){
+                eprintf("Replayed testmod_testvar record %lld as %d.", first_seq + number_replayed + i, replay[i]);
+                dlgr_cursor_close(&cursor);
+                return -1;
+            }
+            last_replayed = replay[i];
+        }
+        number_replayed += number_chunk;
+    }
+    dlgr_cursor_close(&cursor);
+    if((number_chunk < 0) || (number_replayed != (next_seq - first_seq))){
+        eprintf("Replayed %d testmod_testvars of %lld.", number_replayed, next_seq - first_seq);
+        return -1;
+    }
+    printf("Replayed %d testmod_testvars oldest first, up to %d.\n", number_replayed, last_replayed);
+
+    float testmod_level = 0;
+    if(DLGR_REGISTER_OPTS(testmod_level, sizeof(testmod_level), .timestamped = 1, .type = DLGR_TYPE_F32) < 0){
+        return -1;
+    }
+    for(int i = 0; i < 100; i++){
+        testmod_level = (i % 10) * 0.5f;
+        DLGR_WRITE_TIMED(testmod_level, 3000 + i);
+    }
+    // Settle retention, then work out what the queries should find in what it kept: record i is (i % 10) * 0.5 at t=3000+i.
+    if(DLGR_FLUSH(testmod_level) < 0){
+        return -1;
+    }
+    dlgr_get_seq_range(DLGR_HANDLE(testmod_level), &first_seq, &next_seq);
+    dlgr_aggregate_t expected = {0, 5.0, -1.0, 0.0, 0.0}, expected_window = {0, 5.0, -1.0, 0.0, 0.0};
+    long long expected_buckets[4] = {0, 0, 0, 0};
+    for(long long i = first_seq; i < next_seq; i++){
+        const double value = (i % 10) * 0.5;
+        expected.count++;
+        expected.sum += value;
+        expected.min = value < expected.min ? value : expected.min;
+        expected.max = value > expected.max ? value : expected.max;
+        if((i >= 90) && (i <= 94)){
+            expected_window.count++;
+            expected_window.sum += value;
+        }
+        if(i >= 80){
+            expected_buckets[(i - 80) / 5]++;
+        }
+    }
+
+    dlgr_aggregate_t level, level_window, level_buckets[4];
+    if((DLGR_AGGREGATE(testmod_level, 0, 100, &level) < 0) || (DLGR_AGGREGATE_TIME(testmod_level, 3090, 3094, &level_window) < 0)){
+        return -1;
+    }
+    if((level.count != expected.count) || (level.min != expected.min) || (level.max != expected.max) || (level.sum != expected.sum)
+        || (level_window.count != expected_window.count) || (level_window.sum != expected_window.sum)){
+        eprintf("testmod_level aggregated to %lld from %.1f to %.1f, sum %.1f, and %lld at t=3090 to t=3094, sum %.1f; expected %lld from %.1f to %.1f, sum %.1f, and %lld, sum %.1f.",
+            level.count, level.min, level.max, level.sum, level_window.count, level_window.sum, expected.count, expected.min, expected.max, expected.sum, expected_window.count, expected_window.sum);
+        return -1;
+    }
+    int number_buckets = dlgr_downsample_time(DLGR_HANDLE(testmod_level), 3080, 3099, 5, level_buckets, 4);
+    if(number_buckets != 4){
+        eprintf("Downsampled testmod_level into %d buckets, not 4.", number_buckets);
+        return -1;
+    }
+    for(int i = 0; i < number_buckets; i++){
+        if(level_buckets[i].count != expected_buckets[i]){
+            eprintf("testmod_level bucket %d holds %lld records, not %lld.", i, level_buckets[i].count, expected_buckets[i]);
+            return -1;
+        }
+    }
+    printf("testmod_level: %lld retained from %.1f to %.1f, mean %.2f; %lld at t=3090 to t=3094, mean %.2f; %d buckets, the first of %lld.\n", level.count, level.min, level.max, level.mean, level_window.count, level_window.mean, number_buckets, level_buckets[0].count);
+
+    testmod_state_t testmod_state;
+    memset(&testmod_state, 0x0, sizeof(testmod_state));
+    if(DLGR_REGISTER_STRUCT(testmod_state, ((dlgr_options_t){.columnar = 1, .codec = DLGR_CODEC_DELTA}),
+        DLGR_STRUCT_FIELD(testmod_state_t, mode, DLGR_TYPE_I8),
+        DLGR_STRUCT_FIELD(testmod_state_t, rate, DLGR_TYPE_F64),
+        DLGR_STRUCT_FIELD(testmod_state_t, count, DLGR_TYPE_I32)) < 0){
+        return -1;
+    }
+    for(int i = 0; i < 30; i++){
+        testmod_state.mode = i % 3;
+        testmod_state.rate = i * 0.25;
+        testmod_state.count = 100 + i;
+        DLGR_WRITE(testmod_state);
+    }
+    // Row i has count 100 + i; the last is mode 2, rate 7.25, count 129.
+    int state_counts[4];
+    testmod_state_t state_latest;
+    if(DLGR_FLUSH(testmod_state) < 0){
+        return -1;
+    }
+    dlgr_get_seq_range(DLGR_HANDLE(testmod_state), &first_seq, &next_seq);
+    int number_counts = DLGR_READ_FIELD(testmod_state, count, first_seq, state_counts, 4);
+    if(number_counts != 4){
+        eprintf("Read %d testmod_state counts, not 4.", number_counts);
+        return -1;
+    }
+    for(int i = 0; i < 4; i++){
+        if(state_counts[i] != (100 + first_seq + i)){
+            eprintf("testmod_state %lld has count %d.", first_seq + i, state_counts[i]);
+            return -1;
+        }
+    }
+    if((DLGR_READ_LATEST(testmod_state, &state_latest, 1) != 1) || (state_latest.mode != 2) || (state_latest.rate != 7.25) || (state_latest.count != 129)){
+        eprintf("Latest testmod_state row is not mode 2, rate 7.25, count 129.");
+        return -1;
+    }
+    printf("Read %d testmod_state counts from %lld: %d %d %d %d; latest row mode %d rate %.2f count %d.\n", number_counts, first_seq, state_counts[0], state_counts[1], state_counts[2], state_counts[3], state_latest.mode, state_latest.rate, state_latest.count);
+
+    // Registering at boot again keeps the history, and the handle.
+    long long before_first = 0, before_next = 0;
+    dlgr_get_seq_range(DLGR_HANDLE(testmod_testvar), &before_first, &before_next);
+    int handle_again = DLGR_REGISTER(testmod_testvar, sizeof(testmod_testvar));
+    if((handle_again != DLGR_HANDLE(testmod_testvar)) || (dlgr_get_seq_range(handle_again, &first_seq, &next_seq) < 0)
+        || (first_seq != before_first) || (next_seq != before_next)){
+        eprintf("Registering testmod_testvar again lost records %lld to %lld.", before_first, before_next - 1);
+        return -1;
+    }
+    printf("Registering testmod_testvar again kept records %lld to %lld.\n", first_seq, next_seq - 1);
+
+    // Registering at another size starts over, without records of the old size in any segment.
+    int testmod_resized = 0;
+    if((DLGR_REGISTER(testmod_resized, sizeof(testmod_resized)) < 0) || (DLGR_SET_STORAGE(testmod_resized, .segment_size = 32) < 0)){
+        return -1;
+    }
+    for(testmod_resized = 0; testmod_resized < 20; testmod_resized++){
+        DLGR_WRITE(testmod_resized);
+    }
+    long long testmod_resized_wide = 100;
+    if(dlgr_register("testmod_resized", sizeof(testmod_resized_wide)) < 0){
+        return -1;
+    }
+    for(; testmod_resized_wide < 106; testmod_resized_wide++){
+        dlgr_write("testmod_resized", &testmod_resized_wide);
+    }
+    long long resized_values[6];
+    dlgr_get_seq_range(DLGR_HANDLE(testmod_resized), &first_seq, &next_seq);
+    if(((next_seq - first_seq) != 6) || (dlgr_read_range_handle(DLGR_HANDLE(testmod_resized), first_seq, 6, resized_values) != 6)){
+        eprintf("Error!");
+        return -1;
+    }
+    for(int i = 0; i < 6; i++){
+        if(resized_values[i] != (100 + i)){
+            eprintf("testmod_resized record %lld is %lld, not %d.", first_seq + i, resized_values[i], 100 + i);
+            return -1;
+        }
+    }
+    printf("Registering testmod_resized at %d bytes read back %lld to %lld.\n", (int) sizeof(testmod_resized_wide), resized_values[0], resized_values[5]);
+
+    // 128 records in segments of 4 rotated 31 times, and retention removed all but the segments still listed.
+    dlgr_stats_t stats;
+    if(DLGR_STATS(testmod_testvar, &stats) < 0){
+        return -1;
+    }
+    unsigned long long number_errors = 0;
+    for(int i = 0; i < DLGR_ERROR_COUNT; i++){
+        number_errors += stats.errors[i];
+    }
+    if((stats.records_written != 128) || (stats.bytes_written != (128 * sizeof(int))) || (stats.rotations != 31)
+        || (stats.retention_deletions != (unsigned long long) (32 - number_logs)) || (stats.reads == 0) || (number_errors != 0)){
+        eprintf("testmod_testvar counted %llu records in %llu bytes, %llu rotations, %llu deletions, %llu reads and %llu errors.",
+            stats.records_written, stats.bytes_written, stats.rotations, stats.retention_deletions, stats.reads, number_errors);
+        return -1;
+    }
+    printf("testmod_testvar wrote %llu records in %llu bytes, rotated %llu segments and removed %llu, read %llu times, failed %llu reads.\n", stats.records_written, stats.bytes_written, stats.rotations, stats.retention_deletions, stats.reads, stats.errors[DLGR_ERROR_READ]);
+    dlgr_stats_dump(stdout);
+
+    // Shutting down moves every segment out of the hot directory.
+    if(dlgr_shutdown() < 0){
+        return -1;
+    }
+    int number_hot = 0;
+    DIR* hot_dir = opendir(hot_path);
+    for(struct dirent* entry; (hot_dir != NULL) && ((entry = readdir(hot_dir)) != NULL); ){
+        number_hot += entry->d_name[0] != '.';
+    }
+    if(hot_dir == NULL){
+        eprintf("Could not list the hot directory %s.", hot_path);
+        return -1;
+    }
+    closedir(hot_dir);
+    if(number_hot != 0){
+        eprintf("Shut down with %d files left in the hot directory.", number_hot);
+        return -1;
+    }
+    printf("Shut down with %d files left in the hot directory.\n", number_hot);
 
     printf("Datalogger test end.\n");
     fflush(stdout);
@@ -0,0 +1,353 @@
+/**
+ * @file datalogger_tier.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Tiered storage: current segments in a hot directory, moved into the log directory once closed.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <pthread.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Closed segments are handed to one background thread, which compresses them if their variable has a codec, then moves
+// them out of the hot directory if there is one; rotations never wait on either. Each rotation also hands it the segment
+// it switched to, to store the manifest, apply retention, and open the segment after it ahead, see dlgr_prepare_segment().
+//
+// A move copies each file of a segment from the hot directory to var_name_N.ext.mig in the log directory, then renames
+// the copies into place before removing the originals. A reader that looks in the hot directory first, as
+// dlgr_open_segment_read() does, always finds a whole file in one directory or the other.
+
+// A segment queued for the background thread.
+typedef struct
+{
+    dlgr_var_t* var;
+    int var_index;
+    int prepare; // Set for a current segment to prepare the next one of, clear for a closed one to compress and move.
+} dlgr_migration_t;
+
+static int dlgr_hot_fd = -1;
+static _Atomic int dlgr_log_fd = -1;
+
+static pthread_mutex_t dlgr_migrate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dlgr_migrate_work = PTHREAD_COND_INITIALIZER; // Signalled when a segment is queued.
+static pthread_cond_t dlgr_migrate_idle = PTHREAD_COND_INITIALIZER; // Signalled when the queue has drained.
+static dlgr_migration_t* dlgr_migrations = NULL;
+static int dlgr_migrations_head = 0; // Next to move.
+static int dlgr_num_migrations = 0; // Queued, including the one being moved.
+static int dlgr_migrations_capacity = 0;
+static int dlgr_migrate_started = 0;
+
+int dlgr_hot_dir_fd(void){
+    return dlgr_hot_fd;
+}
+
+int dlgr_log_dir_fd(void){
+    int fd = atomic_load_explicit(&dlgr_log_fd, memory_order_acquire);
+    if(fd >= 0){
+        return fd;
+    }
+
+    // Racing first uses open the same directory; one keeps its descriptor.
+    int expected = -1;
+    if((fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0){
+        eprintf("Could not open the working directory as the log directory.");
+        return -1;
+    }
+    if(!atomic_compare_exchange_strong(&dlgr_log_fd, &expected, fd)){
+        close(fd);
+        fd = expected;
+    }
+    return fd;
+}
+
+int dlgr_set_log_dir(const char* dir){
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0){
+        eprintf("Could not open log directory %s.", dir);
+        return -1;
+    }
+
+    // Once variables exist, readers, the background thread, and open segments may be using the old descriptor, and its
+    // number could be reused by the time they do; only the same directory is accepted then.
+    int old_fd = atomic_load(&dlgr_log_fd);
+    if((old_fd >= 0) && (dlgr_get_var(0) != NULL)){
+        struct stat old_stbuf, stbuf;
+        const int same = (fstat(old_fd, &old_stbuf) == 0) && (fstat(fd, &stbuf) == 0) && (old_stbuf.st_dev == stbuf.st_dev) && (old_stbuf.st_ino == stbuf.st_ino);
+        close(fd);
+        if(!same){
+            eprintf("Variables are already logged elsewhere, %s cannot be the log directory.", dir);
+            return -1;
+        }
+        return 1;
+    }
+
+    if((old_fd = atomic_exchange(&dlgr_log_fd, fd)) >= 0){
+        close(old_fd);
+    }
+    return 1;
+}
+
+// Names file number i of segment var_index: the records, timestamps, and index, then each column, raw and compressed. 0 past the last.
+static int dlgr_segment_file(const char* var_name, int var_index, int num_members, int i, char* fname_buf){
+    static const char* exts[] = {"log", "log.z", "ts", "ts.z", "tsi"};
+    const int num_exts = sizeof(exts) / sizeof(exts[0]);
+    if(i < num_exts){
+        snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.%s", var_name, var_index, exts[i]);
+        return 1;
+    }
+    i -= num_exts;
+    if(i >= (num_members * 2)){
+        return 0;
+    }
+    snprintf(fname_buf, MAX_FNAME_SIZE, "%s_%d.c%d%s", var_name, var_index, i / 2, (i % 2) ? ".z" : "");
+    return 1;
+}
+
+// Copies fname from the hot directory to fname.mig in the log directory. 0 if it is not in the hot directory.
+static int dlgr_copy_out(const char* fname, int sync){
+    int src_fd = openat(dlgr_hot_fd, fname, O_RDONLY | O_CLOEXEC);
+    if(src_fd < 0){
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    char tmp_buf[MAX_FNAME_SIZE + 4];
+    snprintf(tmp_buf, sizeof(tmp_buf), "%s.mig", fname);
+    const int log_fd = dlgr_log_dir_fd();
+    int dst_fd = openat(log_fd, tmp_buf, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(dst_fd < 0){
+        eprintf("Could not open %s.", tmp_buf);
+        close(src_fd);
+        return -1;
+    }
+
+    // One sequential copy, kernel to kernel.
+    struct stat stbuf;
+    int retval = fstat(src_fd, &stbuf) == 0 ? 1 : -1;
+    off_t offset = 0;
+    while((retval > 0) && (offset < stbuf.st_size)){
+        const ssize_t sent = sendfile(dst_fd, src_fd, &offset, stbuf.st_size - offset);
+        if(sent <= 0){
+            retval = -1;
+        }
+    }
+    if((retval > 0) && sync && (fdatasync(dst_fd) != 0)){
+        retval = -1;
+    }
+    close(src_fd);
+    close(dst_fd);
+
+    if(retval < 0){
+        eprintf("Could not copy %s into the log directory.", fname);
+        unlinkat(log_fd, tmp_buf, 0);
+    }
+
+    return retval;
+}
+
+int dlgr_migrate_segment(dlgr_var_t* var, int var_index){
+    if(dlgr_hot_fd < 0){
+        return 0;
+    }
+
+    pthread_mutex_lock(&var->lock);
+    const int num_members = var->num_members;
+    const int sync = var->durability.mode != DLGR_SYNC_NONE;
+    pthread_mutex_unlock(&var->lock);
+
+    // Copy without holding the lock; the files of a closed segment don't change.
+    char fname_buf[MAX_FNAME_SIZE], tmp_buf[MAX_FNAME_SIZE + 4];
+    int copied = 0, failed = 0;
+    for(int i = 0; dlgr_segment_file(var->var_name, var_index, num_members, i, fname_buf); i++){
+        const int retval = dlgr_copy_out(fname_buf, sync);
+        if(retval < 0){
+            failed = 1;
+            break;
+        }
+        copied += retval;
+    }
+
+    // Only put a segment in place that is still live and not being written. The current one moves only once closed.
+    const int log_fd = dlgr_log_dir_fd();
+    pthread_mutex_lock(&var->lock);
+    int live = 0;
+    for(int i = 0; i < var->num_segments; i++){
+        if(var->segments[i].var_index == var_index){
+            live = (i < (var->num_segments - 1)) || (var->seg_fd < 0);
+            break;
+        }
+    }
+    int renamed[(num_members * 2) + 5]; // Every file dlgr_segment_file() names.
+    int num_renamed = 0;
+    for(int i = 0; dlgr_segment_file(var->var_name, var_index, num_members, i, fname_buf); i++){
+        snprintf(tmp_buf, sizeof(tmp_buf), "%s.mig", fname_buf);
+        if(!live || failed){
+            unlinkat(log_fd, tmp_buf, 0);
+        } else if(renameat(log_fd, tmp_buf, log_fd, fname_buf) == 0){
+            renamed[num_renamed++] = i;
+        }
+    }
+    // The hot copies go only once the renames are durable, so a power loss never leaves neither.
+    if((num_renamed > 0) && sync && (fsync(log_fd) != 0)){
+        eprintf("Could not sync the log directory, segment %d of %s stays in the hot directory too.", var_index, var->var_name);
+        num_renamed = 0;
+    }
+    for(int i = 0; i < num_renamed; i++){
+        dlgr_segment_file(var->var_name, var_index, num_members, renamed[i], fname_buf);
+        unlinkat(dlgr_hot_fd, fname_buf, 0);
+    }
+    pthread_mutex_unlock(&var->lock);
+
+    if(failed){
+        eprintf("Could not move segment %d of %s into the log directory, it stays in the hot directory.", var_index, var->var_name);
+        return -1;
+    }
+
+    return (live && (copied > 0)) ? 1 : 0;
+}
+
+static void* dlgr_migrate_main(void* arg){
+    (void) arg;
+
+    pthread_mutex_lock(&dlgr_migrate_lock);
+    for(;;){
+        while(dlgr_num_migrations == 0){
+            dlgr_migrations_head = 0;
+            pthread_cond_broadcast(&dlgr_migrate_idle);
+            pthread_cond_wait(&dlgr_migrate_work, &dlgr_migrate_lock);
+        }
+
+        // Handled outside the queue lock, so rotations queueing more never wait on a copy. Compressed first, so less is copied.
+        const dlgr_migration_t migration = dlgr_migrations[dlgr_migrations_head];
+        pthread_mutex_unlock(&dlgr_migrate_lock);
+        if(migration.prepare){
+            dlgr_prepare_segment(migration.var, migration.var_index);
+        } else {
+            dlgr_compress_segment(migration.var, migration.var_index);
+            dlgr_migrate_segment(migration.var, migration.var_index);
+        }
+        pthread_mutex_lock(&dlgr_migrate_lock);
+
+        dlgr_migrations_head++;
+        dlgr_num_migrations--;
+    }
+
+    return NULL;
+}
+
+// Starts the thread that compresses and moves closed segments, once. Caller must hold dlgr_migrate_lock.
+static int dlgr_migrate_start(void){
+    if(!dlgr_migrate_started){
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, dlgr_migrate_main, NULL) != 0){
+            eprintf("Could not start the migration thread.");
+            return -1;
+        }
+        pthread_detach(thread);
+        dlgr_migrate_started = 1;
+    }
+    return 1;
+}
+
+int dlgr_set_hot_dir(const char* dir){
+    if(dir == NULL){
+        eprintf("Hot directory is NULL.");
+        return -1;
+    }
+
+    // Segments already open stay where they are, so there must not be any.
+    if(dlgr_get_var(0) != NULL){
+        eprintf("Set the hot directory before registering or loading variables.");
+        return -1;
+    }
+
+    // The log directory is pinned along with the hot one, if dlgr_open() hasn't already.
+    if(dlgr_log_dir_fd() < 0){
+        return -1;
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0){
+        eprintf("Could not open hot directory %s.", dir);
+        return -1;
+    }
+
+    pthread_mutex_lock(&dlgr_migrate_lock);
+    if(dlgr_migrate_start() < 0){
+        pthread_mutex_unlock(&dlgr_migrate_lock);
+        close(fd);
+        return -1;
+    }
+    if(dlgr_hot_fd >= 0){
+        close(dlgr_hot_fd);
+    }
+    dlgr_hot_fd = fd;
+    pthread_mutex_unlock(&dlgr_migrate_lock);
+
+    return 1;
+}
+
+// Queues segment var_index of var for the background thread.
+static int dlgr_queue(dlgr_var_t* var, int var_index, int prepare){
+    pthread_mutex_lock(&dlgr_migrate_lock);
+    if(dlgr_migrate_start() < 0){
+        pthread_mutex_unlock(&dlgr_migrate_lock);
+        return -1;
+    }
+
+    // Compact the queue into the front of its array once it runs out of room, and grow it if that isn't enough.
+    if((dlgr_migrations_head + dlgr_num_migrations) == dlgr_migrations_capacity){
+        if(dlgr_migrations_head > 0){
+            memmove(dlgr_migrations, &dlgr_migrations[dlgr_migrations_head], dlgr_num_migrations * sizeof(dlgr_migration_t));
+            dlgr_migrations_head = 0;
+        } else {
+            const int new_capacity = dlgr_migrations_capacity ? dlgr_migrations_capacity * 2 : 64;
+            dlgr_migration_t* migrations = realloc(dlgr_migrations, new_capacity * sizeof(dlgr_migration_t));
+            if(migrations == NULL){
+                pthread_mutex_unlock(&dlgr_migrate_lock);
+                eprintf("Could not queue segment %d of %s for the background thread.", var_index, var->var_name);
+                return -1;
+            }
+            dlgr_migrations = migrations;
+            dlgr_migrations_capacity = new_capacity;
+        }
+    }
+
+    dlgr_migrations[dlgr_migrations_head + dlgr_num_migrations] = (dlgr_migration_t){var, var_index, prepare};
+    dlgr_num_migrations++;
+    pthread_cond_signal(&dlgr_migrate_work);
+    pthread_mutex_unlock(&dlgr_migrate_lock);
+
+    return 1;
+}
+
+int dlgr_migrate(dlgr_var_t* var, int var_index){
+    return dlgr_queue(var, var_index, 0);
+}
+
+int dlgr_prepare(dlgr_var_t* var, int var_index){
+    return dlgr_queue(var, var_index, 1);
+}
+
+int dlgr_migrate_flush(void){
+    pthread_mutex_lock(&dlgr_migrate_lock);
+    while(dlgr_migrate_started && (dlgr_num_migrations > 0)){
+        pthread_cond_wait(&dlgr_migrate_idle, &dlgr_migrate_lock);
+    }
+    const int hot = dlgr_hot_fd >= 0;
+    pthread_mutex_unlock(&dlgr_migrate_lock);
+
+    return hot ? 1 : 0;
+}
@@ -0,0 +1,412 @@
+/**
+ * @file datalogger_time.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Time-range queries over timestamped variables.
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Timestamped segment layout
+/* acs_x_3.log          <-- Records, as for any variable.
+ * acs_x_3.ts           <-- One long long timestamp per record, in record order.
+ * acs_x_3.tsi          <-- One dlgr_time_index_entry_t per DLGR_TIME_INDEX_STRIDE records.
+ */
+
+// An open timestamped segment.
+typedef struct
+{
+    int var_index;
+    int log_fd;
+    int ts_fd;
+    int tsi_fd;
+    int records; // Committed records with both data and a timestamp.
+} dlgr_time_segment_t;
+
+static void dlgr_time_segment_close(dlgr_time_segment_t* seg){
+    if(seg->log_fd >= 0){
+        close(seg->log_fd);
+    }
+    if(seg->ts_fd >= 0){
+        close(seg->ts_fd);
+    }
+    if(seg->tsi_fd >= 0){
+        close(seg->tsi_fd);
+    }
+    seg->log_fd = seg->ts_fd = seg->tsi_fd = -1;
+}
+
+// Opens the timestamps of a segment, bounded to the records it held when the query started. The records themselves
+// are opened by the reads that need them, see dlgr_time_segment_records().
+static int dlgr_time_segment_open(const dlgr_var_t* var, const dlgr_segment_info_t* info, dlgr_time_segment_t* seg){
+    seg->var_index = info->var_index;
+    seg->log_fd = -1;
+    seg->ts_fd = dlgr_open_segment_read(var, info->var_index, "ts");
+    seg->tsi_fd = dlgr_open_segment_read(var, info->var_index, "tsi");
+
+    struct stat stbuf;
+    if((seg->ts_fd < 0) || (fstat(seg->ts_fd, &stbuf) != 0)){
+        dlgr_time_segment_close(seg);
+        return -1;
+    }
+
+    seg->records = info->records;
+    if((stbuf.st_size / (off_t) sizeof(long long)) < seg->records){
+        seg->records = stbuf.st_size / sizeof(long long);
+    }
+
+    return 1;
+}
+
+// Opens count records of an open timestamped segment from first_record, once.
+static int dlgr_time_segment_records(const dlgr_var_t* var, dlgr_time_segment_t* seg, int first_record, int count){
+    if(seg->log_fd < 0){
+        seg->log_fd = dlgr_open_segment_rows(var, seg->var_index, first_record, count);
+    }
+    return seg->log_fd;
+}
+
+// Checks if a segment of a snapshot that could not be opened is allowed to be missing: removed by retention since the
+// snapshot, or never written to.
+static int dlgr_time_segment_gone(int handle, const dlgr_segment_info_t* info){
+    long long first_seq;
+    return (info->records == 0) || ((dlgr_get_seq_range(handle, &first_seq, NULL) > 0) && ((info->first_seq + info->records) <= first_seq));
+}
+
+static int dlgr_time_at(const dlgr_time_segment_t* seg, int record, long long* timestamp){
+    return pread(seg->ts_fd, timestamp, sizeof(long long), (off_t) record * sizeof(long long)) == sizeof(long long) ? 1 : -1;
+}
+
+// Returns the first record of seg whose timestamp is >= t, or > t if after is set; seg->records if there is none.
+static int dlgr_time_search(const dlgr_time_segment_t* seg, long long t, int after){
+    int lo = 0, hi = seg->records;
+
+    // Narrow down to one index block with the sparse time index.
+    if(seg->tsi_fd >= 0){
+        struct stat stbuf;
+        int number_entries = fstat(seg->tsi_fd, &stbuf) == 0 ? stbuf.st_size / sizeof(dlgr_time_index_entry_t) : 0;
+        if(number_entries > ((seg->records + DLGR_TIME_INDEX_STRIDE - 1) / DLGR_TIME_INDEX_STRIDE)){
+            number_entries = (seg->records + DLGR_TIME_INDEX_STRIDE - 1) / DLGR_TIME_INDEX_STRIDE;
+        }
+
+        dlgr_time_index_entry_t* entries = number_entries > 0 ? malloc(number_entries * sizeof(dlgr_time_index_entry_t)) : NULL;
+        if((entries != NULL) && (pread(seg->tsi_fd, entries, number_entries * sizeof(dlgr_time_index_entry_t), 0) == (ssize_t) (number_entries * sizeof(dlgr_time_index_entry_t)))){
+            // Last entry that precedes the answer.
+            int entry_lo = 0, entry_hi = number_entries;
+            while(entry_lo < entry_hi){
+                const int mid = (entry_lo + entry_hi) / 2;
+                const int before = after ? (entries[mid].timestamp <= t) : (entries[mid].timestamp < t);
+                if(before){
+                    entry_lo = mid + 1;
+                } else {
+                    entry_hi = mid;
+                }
+            }
+            if(entry_lo > 0){
+                lo = entries[entry_lo - 1].record;
+            }
+            if(entry_lo < number_entries){
+                hi = entries[entry_lo].record;
+            }
+        }
+        free(entries);
+    }
+
+    // Without an index, halve with single timestamp reads until one block is left.
+    while((hi - lo) > DLGR_TIME_INDEX_STRIDE){
+        const int mid = lo + ((hi - lo) / 2);
+        long long timestamp;
+        if(dlgr_time_at(seg, mid, &timestamp) < 0){
+            break;
+        }
+        if(after ? (timestamp <= t) : (timestamp < t)){
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // Scan the block.
+    long long block[DLGR_TIME_INDEX_STRIDE];
+    while(lo < hi){
+        const int chunk = (hi - lo) < DLGR_TIME_INDEX_STRIDE ? (hi - lo) : DLGR_TIME_INDEX_STRIDE;
+        if(pread(seg->ts_fd, block, chunk * sizeof(long long), (off_t) lo * sizeof(long long)) != (ssize_t) (chunk * sizeof(long long))){
+            return lo;
+        }
+        for(int i = 0; i < chunk; i++){
+            if(after ? (block[i] > t) : (block[i] >= t)){
+                return lo + i;
+            }
+        }
+        lo += chunk;
+    }
+
+    return hi;
+}
+
+// Returns the last segment of a snapshot whose first record is at or before t, or the oldest one written to if none
+// is. Searches the timestamps the manifest keeps of each segment, so no segment is opened.
+static int dlgr_time_find_segment(const dlgr_snapshot_t* snapshot, long long t){
+    // Skip segments never written.
+    const dlgr_segment_info_t* segments = snapshot->segments;
+    const int newest = snapshot->num_segments - 1;
+    int lo = 0;
+    while((lo < newest) && (segments[lo].records == 0)){
+        lo++;
+    }
+
+    int hi = newest;
+    while(lo < hi){
+        const int mid = lo + ((hi - lo + 1) / 2);
+        if((segments[mid].records > 0) && (segments[mid].first_ts <= t)){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+
+int dlgr_read_time_range(int handle, long long t0, long long t1, void* storage, long long* timestamps, int max_count){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    if(storage == NULL){
+        eprintf("Storage is NULL.");
+        return -1;
+    }
+
+    if(max_count <= 0){
+        eprintf("Count %d is invalid.", max_count);
+        return -1;
+    }
+
+    // Snapshot the live segments.
+    dlgr_snapshot_t snapshot;
+    if(dlgr_snapshot(handle, -1, &snapshot) < 0){
+        return -1;
+    }
+    const int var_size = snapshot.var_size;
+
+    if(!snapshot.timestamped){
+        eprintf("%s is not timestamped.", var->var_name);
+        dlgr_snapshot_free(&snapshot);
+        return -1;
+    }
+
+    if(t1 < t0){
+        dlgr_snapshot_free(&snapshot);
+        return 0;
+    }
+
+    // The last segment starting at or before t0; the range can't begin earlier.
+    const int lo = dlgr_time_find_segment(&snapshot, t0);
+    const int newest = snapshot.num_segments - 1;
+
+    unsigned char* storage_ptr = (unsigned char*) storage;
+    int number_read = 0;
+    for(int i = lo; (i <= newest) && (number_read < max_count); i++){
+        const int var_index = snapshot.segments[i].var_index;
+        dlgr_time_segment_t seg;
+        if(dlgr_time_segment_open(var, &snapshot.segments[i], &seg) < 0){
+            if(dlgr_time_segment_gone(handle, &snapshot.segments[i])){
+                continue;
+            }
+            eprintf("Segment %d of %s has gone missing.", var_index, var->var_name);
+            DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+            dlgr_snapshot_free(&snapshot);
+            return -1;
+        }
+
+        const int start = dlgr_time_search(&seg, t0, 0);
+        const int end = dlgr_time_search(&seg, t1, 1);
+        int number_this_file = end - start;
+        if(number_this_file > (max_count - number_read)){
+            number_this_file = max_count - number_read;
+        }
+
+        if(number_this_file > 0){
+            const ssize_t bytes = (ssize_t) number_this_file * var_size;
+            if((dlgr_time_segment_records(var, &seg, start, number_this_file) < 0) || (dlgr_pread_full(seg.log_fd, &storage_ptr[(size_t) number_read * var_size], bytes, (off_t) start * var_size) != bytes)){
+                eprintf("Failed to read %d records of segment %d of %s.", number_this_file, var_index, var->var_name);
+                DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+                dlgr_time_segment_close(&seg);
+                dlgr_snapshot_free(&snapshot);
+                return -1;
+            }
+            if(timestamps != NULL){
+                const ssize_t ts_bytes = (ssize_t) number_this_file * sizeof(long long);
+                if(dlgr_pread_full(seg.ts_fd, &timestamps[number_read], ts_bytes, (off_t) start * sizeof(long long)) != ts_bytes){
+                    eprintf("Failed to read %d timestamps of segment %d of %s.", number_this_file, var_index, var->var_name);
+                    DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+                    dlgr_time_segment_close(&seg);
+                    dlgr_snapshot_free(&snapshot);
+                    return -1;
+                }
+            }
+            number_read += number_this_file;
+        }
+
+        const int passed_t1 = end < seg.records;
+        dlgr_time_segment_close(&seg);
+
+        // Later segments only hold later records.
+        if(passed_t1){
+            break;
+        }
+    }
+
+    dlgr_snapshot_free(&snapshot);
+    DLGR_COUNT(var, reads, 1);
+    DLGR_COUNT(var, bytes_read, (unsigned long long) number_read * var_size);
+    return number_read;
+}
+
+int dlgr_time_to_seq(int handle, long long t, int after, long long* seq){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    if(seq == NULL){
+        eprintf("Sequence number storage is NULL.");
+        return -1;
+    }
+
+    dlgr_snapshot_t snapshot;
+    if(dlgr_snapshot(handle, -1, &snapshot) < 0){
+        return -1;
+    }
+
+    if(!snapshot.timestamped){
+        eprintf("%s is not timestamped.", var->var_name);
+        dlgr_snapshot_free(&snapshot);
+        return -1;
+    }
+
+    // Last segment starting at or before t; the answer is in it, or is the first record of the next.
+    const int lo = dlgr_time_find_segment(&snapshot, t);
+    const int newest = snapshot.num_segments - 1;
+
+    *seq = snapshot.segments[newest].first_seq + snapshot.segments[newest].records;
+    for(int i = lo; i <= newest; i++){
+        dlgr_time_segment_t seg;
+        if(dlgr_time_segment_open(var, &snapshot.segments[i], &seg) < 0){
+            if(dlgr_time_segment_gone(handle, &snapshot.segments[i])){
+                continue;
+            }
+            eprintf("Segment %d of %s has gone missing.", snapshot.segments[i].var_index, var->var_name);
+            DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+            dlgr_snapshot_free(&snapshot);
+            return -1;
+        }
+        const int position = dlgr_time_search(&seg, t, after);
+        const int records = seg.records;
+        dlgr_time_segment_close(&seg);
+
+        if(position < records){
+            *seq = snapshot.segments[i].first_seq + position;
+            break;
+        }
+    }
+
+    dlgr_snapshot_free(&snapshot);
+    return 1;
+}
+
+int dlgr_read_timestamps(int handle, long long first_seq, int count, long long* timestamps){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    if(timestamps == NULL){
+        eprintf("Timestamp storage is NULL.");
+        return -1;
+    }
+
+    if((count <= 0) || (first_seq < 0)){
+        eprintf("Range of %d records from %lld is invalid.", count, first_seq);
+        return -1;
+    }
+
+    dlgr_snapshot_t snapshot;
+    if(dlgr_snapshot(handle, -1, &snapshot) < 0){
+        return -1;
+    }
+
+    if(!snapshot.timestamped){
+        eprintf("%s is not timestamped.", var->var_name);
+        dlgr_snapshot_free(&snapshot);
+        return -1;
+    }
+
+    const dlgr_segment_info_t* segments = snapshot.segments;
+    if(first_seq < segments[0].first_seq){
+        eprintf("Record %lld of %s has been removed, the oldest is %lld.", first_seq, var->var_name, segments[0].first_seq);
+        DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+        dlgr_snapshot_free(&snapshot);
+        return -1;
+    }
+
+    // The segment holding first_seq, then forward through the timestamp column of each.
+    int lo = 0, hi = snapshot.num_segments - 1;
+    while(lo < hi){
+        const int mid = lo + ((hi - lo + 1) / 2);
+        if(segments[mid].first_seq <= first_seq){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    int number_read = 0;
+    for(int i = lo; (i < snapshot.num_segments) && (number_read < count); i++){
+        const int offset = (first_seq + number_read) - segments[i].first_seq;
+        int number_this_file = segments[i].records - offset;
+        if(number_this_file <= 0){
+            continue;
+        }
+        if(number_this_file > (count - number_read)){
+            number_this_file = count - number_read;
+        }
+
+        int ts_fd = dlgr_open_segment_read(var, segments[i].var_index, "ts");
+        const size_t bytes = (size_t) number_this_file * sizeof(long long);
+        if((ts_fd < 0) || (dlgr_pread_full(ts_fd, &timestamps[number_read], bytes, (off_t) offset * sizeof(long long)) != (ssize_t) bytes)){
+            eprintf("Failed to read %d timestamps of segment %d of %s.", number_this_file, segments[i].var_index, var->var_name);
+            DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+            if(ts_fd >= 0){
+                close(ts_fd);
+            }
+            dlgr_snapshot_free(&snapshot);
+            return -1;
+        }
+        close(ts_fd);
+        number_read += number_this_file;
+    }
+
+    dlgr_snapshot_free(&snapshot);
+    DLGR_COUNT(var, reads, 1);
+    DLGR_COUNT(var, bytes_read, (unsigned long long) number_read * sizeof(long long));
+    return number_read;
+}
@@ -0,0 +1,165 @@
+/**
+ * @file datalogger_view.c
+ * @author Mit Bailey (mitbailey99@gmail.com)
+ * @brief Zero-copy memory-mapped read views of logged history.
+ * @version 0.1
+ * @date 2021-04-07
+ * 
+ * @copyright Copyright (c) 2021
+ * 
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#include "datalogger.h"
+#include "datalogger_extern.h"
+
+// Mappings outlive their files: a segment removed by retention stays readable until the view is closed, and the
+// head segment is only mapped up to the records committed when the view was opened, which the writer never rewrites.
+
+// Adds a span to the view, growing its arrays as needed.
+static int dlgr_view_push(dlgr_view_t* view, int* capacity, const void* data, size_t map_size, int count, int var_index, long long first_seq){
+    if(view->num_spans == *capacity){
+        const int new_capacity = *capacity ? *capacity * 2 : 16;
+        dlgr_span_t* spans = realloc(view->spans, new_capacity * sizeof(dlgr_span_t));
+        if(spans == NULL){
+            return -1;
+        }
+        view->spans = spans;
+        size_t* map_sizes = realloc(view->map_sizes, new_capacity * sizeof(size_t));
+        if(map_sizes == NULL){
+            return -1;
+        }
+        view->map_sizes = map_sizes;
+        *capacity = new_capacity;
+    }
+
+    view->spans[view->num_spans].data = data;
+    view->spans[view->num_spans].count = count;
+    view->spans[view->num_spans].var_index = var_index;
+    view->spans[view->num_spans].first_seq = first_seq;
+    view->map_sizes[view->num_spans] = map_size;
+    view->num_spans++;
+
+    return 1;
+}
+
+int dlgr_view_open(int handle, dlgr_view_t* view){
+    return dlgr_view_open_range(handle, 0, -1, view);
+}
+
+int dlgr_view_open_range(int handle, long long first_seq, long long count, dlgr_view_t* view){
+    dlgr_var_t* var = dlgr_get_var(handle);
+    if (var == NULL){
+        eprintf("Invalid handle %d.", handle);
+        return -1;
+    }
+
+    if(view == NULL){
+        eprintf("View is NULL.");
+        return -1;
+    }
+
+    memset(view, 0x0, sizeof(dlgr_view_t));
+
+    // Snapshot the live segments.
+    dlgr_snapshot_t snapshot;
+    if(dlgr_snapshot(handle, -1, &snapshot) < 0){
+        return -1;
+    }
+    const int var_size = snapshot.var_size;
+
+    view->var_size = var_size;
+
+    // Map newest to oldest until a segment is missing, or precedes the range. A negative count means all records.
+    int capacity = 0;
+    for(int i = snapshot.num_segments - 1; i >= 0; i--){
+        const dlgr_segment_info_t* segment = &snapshot.segments[i];
+        if((count >= 0) && (segment->first_seq >= (first_seq + count))){
+            continue;
+        }
+        if((segment->first_seq + segment->records) <= first_seq){
+            break;
+        }
+
+        const int var_index = segment->var_index;
+        int var_log_fd = dlgr_open_segment_read(var, var_index, "log");
+        if(var_log_fd < 0){
+            break;
+        }
+
+        // Never map past the end of the file, touching that would fault.
+        struct stat stbuf;
+        int records = segment->records;
+        if(fstat(var_log_fd, &stbuf) != 0){
+            records = 0;
+        } else if((stbuf.st_size / var_size) < records){
+            records = stbuf.st_size / var_size;
+        }
+        if(records == 0){
+            close(var_log_fd);
+            continue;
+        }
+
+        const size_t map_size = (size_t) records * var_size;
+        void* data = mmap(NULL, map_size, PROT_READ, MAP_SHARED, var_log_fd, 0);
+        close(var_log_fd);
+        if(data == MAP_FAILED){
+            eprintf("Could not map segment %d of %s.", var_index, var->var_name);
+            DLGR_COUNT(var, errors[DLGR_ERROR_READ], 1);
+            dlgr_snapshot_free(&snapshot);
+            dlgr_view_close(view);
+            return -1;
+        }
+        madvise(data, map_size, MADV_SEQUENTIAL);
+
+        if(dlgr_view_push(view, &capacity, data, map_size, records, var_index, segment->first_seq) < 0){
+            eprintf("Could not allocate view of %s.", var->var_name);
+            munmap(data, map_size);
+            dlgr_snapshot_free(&snapshot);
+            dlgr_view_close(view);
+            return -1;
+        }
+
+        view->total_count += records;
+    }
+    dlgr_snapshot_free(&snapshot);
+    DLGR_COUNT(var, reads, 1);
+    DLGR_COUNT(var, bytes_read, (unsigned long long) view->total_count * var_size);
+
+    // Oldest first.
+    for(int lo = 0, hi = view->num_spans - 1; lo < hi; lo++, hi--){
+        dlgr_span_t span = view->spans[lo];
+        view->spans[lo] = view->spans[hi];
+        view->spans[hi] = span;
+        size_t map_size = view->map_sizes[lo];
+        view->map_sizes[lo] = view->map_sizes[hi];
+        view->map_sizes[hi] = map_size;
+    }
+
+    return view->num_spans;
+}
+
+int dlgr_view_close(dlgr_view_t* view){
+    if(view == NULL){
+        eprintf("View is NULL.");
+        return -1;
+    }
+
+    for(int i = 0; i < view->num_spans; i++){
+        munmap((void*) view->spans[i].data, view->map_sizes[i]);
+    }
+
+    free(view->spans);
+    free(view->map_sizes);
+    memset(view, 0x0, sizeof(dlgr_view_t));
+
+    return 1;
+}